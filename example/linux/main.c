@@ -16,6 +16,7 @@
  */
 
 #include <stdio.h>
+#include <unistd.h>
 
 // to achieve more identical behaviour with mbed device you can active ncurses
 //#define EXAMPLE_USE_NCURSES 1
@@ -43,6 +44,63 @@ static int cmd_dummy(int argc, char *argv[])
     }
     return CMDLINE_RETCODE_SUCCESS;
 }
+// history is kept in a file over restarts, compacted log is written to a spare file
+#define HISTORY_FILE ".cli_history"
+#define HISTORY_SPARE_FILE ".cli_history.new"
+typedef struct history_files_s {
+    FILE *log;
+    FILE *spare;
+} history_files_t;
+static int history_read(void *ctx, uint32_t offset, void *data, uint16_t length)
+{
+    FILE *file = ((history_files_t *)ctx)->log;
+    if (fseek(file, offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    return fread(data, 1, length, file);
+}
+static int history_append(void *ctx, const void *data, uint16_t length)
+{
+    FILE *file = ((history_files_t *)ctx)->log;
+    if (fseek(file, 0, SEEK_END) != 0 || fwrite(data, 1, length, file) != length) {
+        return -1;
+    }
+    return fflush(file);
+}
+static int history_reset(void *ctx)
+{
+    FILE *file = ((history_files_t *)ctx)->log;
+    fflush(file);
+    return ftruncate(fileno(file), 0);
+}
+static int history_spare_write(void *ctx, uint32_t offset, const void *data, uint16_t length)
+{
+    history_files_t *files = (history_files_t *)ctx;
+    if (offset == 0) {
+        if (files->spare) {
+            fclose(files->spare);
+        }
+        files->spare = fopen(HISTORY_SPARE_FILE, "w+b");
+    }
+    if (files->spare == NULL || fwrite(data, 1, length, files->spare) != length) {
+        return -1;
+    }
+    return 0;
+}
+static int history_spare_commit(void *ctx, uint32_t length)
+{
+    history_files_t *files = (history_files_t *)ctx;
+    (void)length; // spare file has just the written bytes
+    // rename replaces the log atomically, spare is on disk before that
+    if (files->spare == NULL || fflush(files->spare) != 0 || fsync(fileno(files->spare)) != 0 ||
+            rename(HISTORY_SPARE_FILE, HISTORY_FILE) != 0) {
+        return -1;
+    }
+    fclose(files->log);
+    files->log = files->spare;
+    files->spare = NULL;
+    return 0;
+}
 volatile bool running = true;
 static int cmd_exit(int argc, char *argv[])
 {
@@ -63,6 +121,14 @@ int main(void)
     // Initialize trace library
     mbed_trace_init();
     cmd_init(0);   // initialize cmdline with print function
+    history_files_t history_files = { fopen(HISTORY_FILE, "a+b"), NULL };
+    if (history_files.log) {
+        cmd_history_store_t store = {
+            history_read, history_append, history_reset,
+            history_spare_write, history_spare_commit, &history_files
+        };
+        cmd_history_set_store(&store);
+    }
     cmd_add("exit", cmd_exit, "exit shell", 0);
     cmd_add("dummy", cmd_dummy,
             "dummy command",
@@ -90,5 +156,12 @@ int main(void)
     endwin();
 #endif
     cmd_free();
+    cmd_history_set_store(NULL);
+    if (history_files.log) {
+        fclose(history_files.log);
+    }
+    if (history_files.spare) {
+        fclose(history_files.spare);
+    }
     return 0;
 }
@@ -82,6 +82,11 @@ extern "C" {
  */
 typedef void (cmd_print_t)(const char *, va_list);
 
+/**
+ * typedef for raw write functions, writes len characters of str as they are
+ */
+typedef void (cmd_write_t)(const char *str, size_t len);
+
 /**
  * Initialize cmdline class.
  * This is command line editor without any commands. Application
@@ -98,6 +103,9 @@ void cmd_init(cmd_print_t *outf);
  * This need to be call if command implementation return CMDLINE_RETCODE_EXECUTING_CONTINUE
  * because there is some background stuff ongoing before command is finally completed.
  * Normally there is some event, which call cmd_ready().
+ * If commands are being executed when cmd_ready() is called, e.g. command callback
+ * itself or another thread calls it, completion is queued and handled by the running
+ * execution loop without re-entering it.
  * \param retcode return code for command
  */
 void cmd_ready(int retcode);
@@ -121,6 +129,113 @@ void cmd_next(int retcode);
 /** Free cmd class */
 void cmd_free(void);
 
+/** Memory allocator used by the command line library. */
+typedef struct cmd_allocator_s {
+    void *(*alloc)(void *ctx, size_t size); //!< allocate size bytes, NULL when out of memory
+    void (*free)(void *ctx, void *ptr);     //!< free memory given by alloc, ptr is never NULL
+    void *ctx;                              //!< context given to alloc and free
+} cmd_allocator_t;
+
+/** Configure memory allocator.
+ * By default memory is allocated with MEM_ALLOC/MEM_FREE (malloc/free, or nanostack
+ * dynamic memory). Allocator can be changed only before cmd_init() or after cmd_free().
+ * \code
+   static void *heap_alloc(void *ctx, size_t size) { return malloc(size); }
+   static void heap_free(void *ctx, void *ptr) { free(ptr); }
+
+   static uint8_t cli_heap[4096];
+   static cmd_pool_t pool;
+   // line buffers do not fit pool blocks, they are taken from heap
+   cmd_allocator_t heap = { heap_alloc, heap_free, NULL };
+   cmd_pool_init(&pool, cli_heap, sizeof(cli_heap), &heap);
+   cmd_allocator_t allocator = { cmd_pool_alloc, cmd_pool_free, &pool };
+   cmd_set_allocator(&allocator);
+   cmd_init(&myprint);
+ * \endcode
+ * \param allocator allocator to be used, content is copied. NULL restores default allocator.
+ */
+void cmd_set_allocator(const cmd_allocator_t *allocator);
+
+/** Memory users inside the library */
+typedef enum {
+    CMDLINE_MEM_COMMANDS,   //!< command registry
+    CMDLINE_MEM_ALIASES,    //!< aliases
+    CMDLINE_MEM_VARIABLES,  //!< variables
+    CMDLINE_MEM_HISTORY,    //!< command history
+    CMDLINE_MEM_EXEC,       //!< execution queue and command line buffers
+    CMDLINE_MEM_TOTAL       //!< all of above
+} cmd_mem_subsystem_t;
+
+/** Memory usage statistics */
+typedef struct cmd_mem_stats_s {
+    size_t   current;       //!< bytes currently allocated
+    size_t   peak;          //!< maximum of current
+    uint32_t allocs;        //!< count of successful allocations
+    uint32_t failures;      //!< count of failed allocations
+} cmd_mem_stats_t;
+
+/** Get memory usage statistics.
+ * Requires MBED_CONF_CMDLINE_ENABLE_MEM_STATS. Statistics are also printed by "meminfo" command.
+ * Sizes are requested sizes without allocator overhead.
+ * \param subsystem subsystem, or CMDLINE_MEM_TOTAL for whole library
+ * \param stats     statistics are written here
+ * \return true when statistics are available
+ */
+bool cmd_mem_stats(cmd_mem_subsystem_t subsystem, cmd_mem_stats_t *stats);
+
+/** Bump arena allocator.
+ * Allocations are taken sequentially from given memory region. Freeing the latest
+ * allocation returns its memory back to arena and when all allocations are freed arena
+ * is reset, other frees are ignored. Suitable for memory which is allocated once,
+ * e.g. as pool fallback for registered commands, or with cmd_arena_reset() after cmd_free().
+ */
+typedef struct cmd_arena_s {
+    uint8_t *mem;       //!< memory region
+    size_t   size;      //!< region size
+    size_t   used;      //!< bytes in use
+    size_t   last;      //!< offset of latest allocation
+    size_t   count;     //!< count of allocations not freed
+} cmd_arena_t;
+
+/** Initialize arena to use given memory region */
+void cmd_arena_init(cmd_arena_t *arena, void *mem, size_t size);
+/** Free all allocations of arena */
+void cmd_arena_reset(cmd_arena_t *arena);
+/** Allocate from arena, cmd_allocator_t::alloc compatible. ctx is cmd_arena_t pointer. */
+void *cmd_arena_alloc(void *ctx, size_t size);
+/** Free arena allocation, cmd_allocator_t::free compatible. ctx is cmd_arena_t pointer. */
+void cmd_arena_free(void *ctx, void *ptr);
+
+/** Fixed size block pool allocator.
+ * Memory region is divided to blocks, which fits any of the library internal objects
+ * (commands, aliases, variables, queued commands, history entries) and short strings.
+ * Blocks are allocated and freed in constant time without fragmentation.
+ * Larger allocations, and allocations when pool is exhausted, are given to fallback allocator.
+ * Executing a command needs a MBED_CONF_CMDLINE_MAX_LINE_LENGTH sized buffer, so pool
+ * used as library allocator requires a fallback.
+ */
+typedef struct cmd_pool_s {
+    uint8_t *mem;               //!< first block
+    size_t   size;              //!< size of blocks area
+    void    *free_list;         //!< first free block
+    size_t   block_size;        //!< block size
+    size_t   free_count;        //!< count of free blocks
+    cmd_allocator_t fallback;   //!< allocator for other allocations, alloc can be NULL
+} cmd_pool_t;
+
+/** Initialize pool to use given memory region
+ * \param pool      pool to be initialized
+ * \param mem       memory region for blocks
+ * \param size      size of memory region
+ * \param fallback  allocator for larger allocations and when pool is exhausted, can be NULL
+ *                  when pool is used only for objects which fit to its blocks
+ */
+void cmd_pool_init(cmd_pool_t *pool, void *mem, size_t size, const cmd_allocator_t *fallback);
+/** Allocate from pool, cmd_allocator_t::alloc compatible. ctx is cmd_pool_t pointer. */
+void *cmd_pool_alloc(void *ctx, size_t size);
+/** Free pool allocation, cmd_allocator_t::free compatible. ctx is cmd_pool_t pointer. */
+void cmd_pool_free(void *ctx, void *ptr);
+
 /** Reset cmdline to default values
  *  detach external commands, delete all variables and aliases
  */
@@ -134,6 +249,48 @@ void cmd_reset(void);
  */
 uint8_t cmd_history_size(uint8_t max);
 
+/** Storage for persistent command history.
+ * History is written to an append-only log, where each executed command is one
+ * zero terminated record. Log can be e.g. a file or a KV/flash region.
+ * Compacted log is written to a spare log, e.g. a second file or region, which
+ * replaces the log only when it is complete. Spare functions are optional, without
+ * them log is not compacted.
+ */
+typedef struct cmd_history_store_s {
+    /** read up to length bytes from offset, return count of bytes read, 0 at end of log */
+    int (*read)(void *ctx, uint32_t offset, void *data, uint16_t length);
+    /** append length bytes to end of log, return 0 on success */
+    int (*append)(void *ctx, const void *data, uint16_t length);
+    /** remove all data from log, return 0 on success */
+    int (*reset)(void *ctx);
+    /** write length bytes to offset of spare log, offsets grow and 0 starts it over, return 0 on success */
+    int (*spare_write)(void *ctx, uint32_t offset, const void *data, uint16_t length);
+    /** replace log with first length bytes of spare log in one step, return 0 on success */
+    int (*spare_commit)(void *ctx, uint32_t length);
+    void *ctx;  //!< context given to the functions
+} cmd_history_store_t;
+
+/** Configure persistent history storage.
+ * Executed commands are appended to the log. Most recent entries are loaded from the
+ * log when history is first browsed (key up, page up or history command), not in cmd_init().
+ * When the log contains more than twice the history size of records the current history
+ * is written to the spare log, one record at a time when interpreter is idle and no
+ * other events are pending, and spare log is then committed. Log stays valid, if the
+ * compaction is interrupted. "history clear" resets the log.
+ * \code
+   static int file_read(void *ctx, uint32_t offset, void *data, uint16_t length) {
+       fseek((FILE *)ctx, offset, SEEK_SET);
+       return fread(data, 1, length, (FILE *)ctx);
+   }
+   ...
+   // spare_commit renames the spare file over the log file
+   cmd_history_store_t store = { file_read, file_append, file_reset, spare_write, spare_commit, &files };
+   cmd_history_set_store(&store);
+ * \endcode
+ * \param store storage functions, content is copied. NULL disables persistence.
+ */
+void cmd_history_set_store(const cmd_history_store_t *store);
+
 /** command line print function
  *  This function should be used when user want to print something to the console
  *  \param fmt   console print function (like printf)
@@ -160,6 +317,15 @@ void cmd_vprintf(const char *fmt, va_list ap);
  */
 void cmd_out_func(cmd_print_t *outf);
 
+/** Configure raw write function for library's own output
+ * Prompt, line refresh, retcodes and other output formatted by the library
+ * is written with this function without the printf engine. When not set, the
+ * output is given to the print function with "%.*s" format.
+ * cmd_init() resets it, so configure it after cmd_init().
+ * \param writef  write function, NULL to use the print function
+ */
+void cmd_out_write_func(cmd_write_t *writef);
+
 /** Configure function, which will be called when Ctrl+A is pressed
  * \param sohf control function which called every time when user input control keys
  */
@@ -209,6 +375,114 @@ void cmd_mutex_lock(void);
  */
 void cmd_mutex_unlock(void);
 
+/**
+ * Configure function returning identifier of the calling thread
+ * When set, cmd_exe_capture() captures only output and cmd_ready() of the thread which called it.
+ * Output of other threads goes to the output function and their completions are handled
+ * when capture is ready.
+ */
+void cmd_thread_id_func(uintptr_t (*thread_id_f)(void));
+
+/** Output modes */
+typedef enum {
+    CMDLINE_OUTPUT_HUMAN,   //!< human readable output (default)
+    CMDLINE_OUTPUT_JSON     //!< structured output, one JSON object per line
+} cmd_output_mode_t;
+
+/** Select output mode.
+ * In JSON mode built-in commands (help, set, alias, history) print one record per item,
+ * e.g. {"type":"variable","name":"PS1","value":"/>"}, and each executed command is
+ * followed by a result record {"type":"result","line":"<cmd>","retcode":0,"elapsed":12}.
+ * Elapsed time is included only when clock function is configured.
+ * Retcode print (set --retcode) is not used in JSON mode.
+ * Mode can be changed also with command "set --json <bool>".
+ * Requires MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT, otherwise output is always human readable.
+ * \param mode output mode
+ */
+void cmd_set_output_mode(cmd_output_mode_t mode);
+
+/** Get current output mode
+ * \return current output mode
+ */
+cmd_output_mode_t cmd_get_output_mode(void);
+
+/** Configure clock function, which is used to measure command execution time.
+ * \param clock_f function which returns monotonic time in microseconds, NULL to disable.
+ */
+void cmd_set_clock_func(uint32_t (*clock_f)(void));
+
+/** Execution statistics of a command.
+ * Times are measured with the function given to cmd_set_clock_func(), from start of
+ * the command until cmd_ready(), and they stay zero when clock function is not set.
+ */
+typedef struct cmd_stats_s {
+    uint32_t calls;         //!< count of started executions
+    uint32_t failures;      //!< count of executions completed with negative retcode
+    uint32_t busy;          //!< count of executions rejected because command was still running
+    uint32_t total_time;    //!< sum of execution times
+    uint32_t min_time;      //!< shortest execution time
+    uint32_t max_time;      //!< longest execution time
+    uint32_t last_time;     //!< latest execution time
+} cmd_stats_t;
+
+/** Get execution statistics of a command.
+ * Requires MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS. Statistics are also printed by "stats" command.
+ * \param name  command name
+ * \param stats statistics are written here
+ * \return true when command is found and statistics are available
+ */
+bool cmd_stats(const char *name, cmd_stats_t *stats);
+
+/** Reset execution statistics.
+ * \param name  command name, or NULL for all commands
+ */
+void cmd_stats_reset(const char *name);
+
+/** Events of the interpreter trace ring */
+typedef enum {
+    CMDLINE_TRACE_INPUT = 1,    //!< character input, arg is the character
+    CMDLINE_TRACE_SPLIT,        //!< line was split to commands, arg is count of commands
+    CMDLINE_TRACE_EXPAND,       //!< aliases and variables were replaced, arg is length of command
+    CMDLINE_TRACE_DISPATCH,     //!< command callback is called, arg is argc
+    CMDLINE_TRACE_READY,        //!< command completed, arg is retcode
+    CMDLINE_TRACE_OUTPUT        //!< output was printed, arg is 1 when output was captured
+} cmd_trace_event_t;
+
+/** Trace ring record */
+typedef struct cmd_trace_record_s {
+    uint32_t time;          //!< time from function given to cmd_set_clock_func(), 0 without it
+    uint8_t  event;         //!< cmd_trace_event_t
+    uint16_t arg;           //!< event specific argument
+} cmd_trace_record_t;
+
+/** Read interpreter trace ring.
+ * Requires MBED_CONF_CMDLINE_ENABLE_TRACE_RING. The ring keeps the latest
+ * MBED_CONF_CMDLINE_TRACE_RING_SIZE events, they are also exported by "trace" command.
+ * \param records  oldest events are written here first
+ * \param count    maximum count of records
+ * \param dropped  if not NULL, count of events overwritten before they were read
+ * \return count of records written
+ */
+size_t cmd_trace_read(cmd_trace_record_t *records, size_t count, uint32_t *dropped);
+
+/** Clear interpreter trace ring */
+void cmd_trace_clear(void);
+
+/** Emit key-value pair from command.
+ * In human readable mode prints "key: value", in JSON mode prints record
+ * {"type":"kv","cmd":"<command name>","key":"<key>","value":"<value>"}
+ * \param key   key name
+ * \param value string value, NULL is printed as JSON null
+ */
+void cmd_emit_kv(const char *key, const char *value);
+
+/** Emit key-value pair with integer value from command.
+ * Same as cmd_emit_kv() but value is given as JSON number.
+ * \param key   key name
+ * \param value integer value
+ */
+void cmd_emit_kv_int(const char *key, int32_t value);
+
 /** Refresh output */
 void cmd_output(void);
 
@@ -263,6 +537,130 @@ typedef int (cmd_run_cb)(int argc, char *argv[]);
  */
 void cmd_add(const char *name, cmd_run_cb *callback, const char *info, const char *man);
 
+/** Value types of command arguments */
+typedef enum {
+    CMD_ARG_FLAG,       //!< option without value, bool which tells if option is given
+    CMD_ARG_BOOL,       //!< bool, "1", "on", "true", "enable" and "allow" are true like in cmd_parameter_bool()
+    CMD_ARG_INT,        //!< int32_t
+    CMD_ARG_STRING      //!< char pointer to the value
+} cmd_arg_type_t;
+
+/** Command argument */
+typedef struct cmd_arg_s {
+    const char     *name;       //!< option, e.g. "--count" or "-v"
+    cmd_arg_type_t  type;       //!< value type
+    bool            required;   //!< command is not run when option is missing
+    int32_t         min;        //!< minimum integer value or string length
+    int32_t         max;        //!< maximum integer value or string length, range is not checked when min and max are 0
+    size_t          offset;     //!< offset of the value in parsed arguments, e.g. offsetof(ping_args_t, count)
+    const char     *help;       //!< description for generated help, or NULL
+} cmd_arg_t;
+
+/** Argument schema of a command.
+ * Interpreter parses and validates options of a command with schema before its callback is
+ * called. Options are given as "--name value" or "--name=value", values are converted to
+ * a zero initialized struct of size bytes, which the callback gets with cmd_args().
+ * Unknown options, missing required options and invalid values fail the command with
+ * CMDLINE_RETCODE_INVALID_PARAMETERS without calling the callback. Arguments which do not
+ * start with '-' are not options and are left for the callback. Help text is generated from
+ * the schema when command has no man page, and options are completed with TAB.
+ * \code
+   typedef struct { int32_t count; bool verbose; char *host; } ping_args_t;
+   static const cmd_arg_t ping_args[] = {
+       { "--count", CMD_ARG_INT, false, 1, 100, offsetof(ping_args_t, count), "count of requests" },
+       { "-v", CMD_ARG_FLAG, false, 0, 0, offsetof(ping_args_t, verbose), "verbose output" },
+       { "--host", CMD_ARG_STRING, true, 1, 64, offsetof(ping_args_t, host), "target host" }
+   };
+   static const cmd_schema_t ping_schema = { ping_args, 3, sizeof(ping_args_t) };
+   int ping_command(int argc, char *argv[]) {
+       const ping_args_t *args = (const ping_args_t *)cmd_args();
+       ...
+   }
+   cmd_add("ping", ping_command, "ping host", NULL);
+   cmd_set_schema("ping", &ping_schema);
+ * \endcode
+ */
+typedef struct cmd_schema_s {
+    const cmd_arg_t *args;      //!< options
+    uint8_t          count;     //!< count of options
+    size_t           size;      //!< size of parsed arguments struct
+} cmd_schema_t;
+
+/** Set argument schema of a command
+ * \param name    command name
+ * \param schema  argument schema, which must stay valid while command exists. NULL removes schema.
+ */
+void cmd_set_schema(const char *name, const cmd_schema_t *schema);
+
+/** Get parsed arguments of the running command.
+ * \return arguments parsed with command schema, valid until callback returns, or NULL when command has no schema
+ */
+const void *cmd_args(void);
+
+/** State of argument completion, see cmd_set_completion() */
+typedef struct cmd_complete_s {
+    int         argc;       //!< count of arguments before the completed one, argv[0] is command name
+    char      **argv;       //!< arguments before the completed one, valid during the callback
+    const char *prefix;     //!< typed beginning of the completed argument, not zero terminated
+    int         prefix_len; //!< length of prefix
+    uint32_t    index;      //!< count of candidates given so far
+    void       *state;      //!< free for the callback, NULL when completion starts
+} cmd_complete_t;
+
+/** Argument completion callback.
+ * Gives candidates for the argument under the cursor one at a time, so that
+ * candidate sets are never collected to memory. Iteration continues from the
+ * previous candidate when TAB is pressed again, and starts over with a
+ * zeroed state when line has changed or TAB cycles backwards. Iteration can be
+ * abandoned at any candidate, so state must not own resources.
+ * \param it  completion state
+ * \return next candidate, or NULL when there are no more. Candidates which do not
+ *         start with prefix are skipped, so callback may ignore prefix.
+ */
+typedef const char *(cmd_complete_cb_f)(cmd_complete_t *it);
+
+/** Set argument completion of a command
+ * \code
+   static const char *const ifaces[] = { "eth0", "wlan0", "lo" };
+   const char *ifconfig_complete(cmd_complete_t *it) {
+       return it->index < 3 ? ifaces[it->index] : NULL;
+   }
+   cmd_set_completion("ifconfig", ifconfig_complete);
+ * \endcode
+ * \param name         command name
+ * \param complete_cb  completion callback, or NULL
+ */
+void cmd_set_completion(const char *name, cmd_complete_cb_f *complete_cb);
+
+/** Size of library internal block of cmd_descriptor_t, in pointers */
+#define CMD_DESCRIPTOR_INTERNAL_SIZE 6
+
+/** Command descriptor for cmd_add_static().
+ * Descriptor is owned by the application and linked to the command list in place, so it
+ * needs to stay valid until the command is deleted with cmd_delete(), cmd_reset() or cmd_free().
+ * Application sets name_ptr, run_cb, info_ptr, man_ptr, schema_ptr and complete_cb. Internal
+ * block is opaque library state, which needs to be zero initialized and is not to be accessed.
+ * \code
+   static cmd_descriptor_t dummy_cmd = { "dummy", cmd_dummy, "dummy command", NULL };
+   cmd_add_static(&dummy_cmd);
+ * \endcode
+ */
+typedef struct cmd_descriptor_s {
+    const char *name_ptr;   //!< command string
+    cmd_run_cb *run_cb;     //!< called when command line starts executing
+    const char *info_ptr;   //!< short description for help command, or NULL
+    const char *man_ptr;    //!< help page, or NULL
+    const cmd_schema_t *schema_ptr; //!< argument schema, or NULL
+    cmd_complete_cb_f *complete_cb; //!< argument completion, or NULL
+    void *internal[CMD_DESCRIPTOR_INTERNAL_SIZE]; //!< library internal
+} cmd_descriptor_t;
+
+/** Add command to intepreter without allocating memory
+ * \param desc  command descriptor, which is linked to the command list as it is.
+ *              Same descriptor can not be added twice.
+ */
+void cmd_add_static(cmd_descriptor_t *desc);
+
 /** delete command from intepreter
  *  \param name command to be delete
  */
@@ -278,6 +676,37 @@ void cmd_delete(const char *name);
  */
 void cmd_exe(char *str);
 
+/** Execute command line synchronously and capture its output.
+ * Output of the executed command(s) is written to the given buffer instead of the
+ * configured output function, other output is not affected. Can be called also from
+ * a running command, e.g. to use output of one command in another. State of the
+ * running command, like its busy flag and options, is not affected.
+ * Output mutex is not held while commands execute. When output mutex functions are
+ * configured, cmd_thread_id_func() is required so that output and cmd_ready() of other
+ * threads are not captured, and capture fails without it.
+ * cmd_ready() called by other contexts during execution is handled after the capture.
+ * Commands returning CMDLINE_RETCODE_EXCUTING_CONTINUE are supported only when they
+ * call cmd_ready() before returning, otherwise execution of the line stops there and
+ * CMDLINE_RETCODE_EXCUTING_CONTINUE is given as retcode. Such a command stays busy
+ * until it completes, and the next cmd_ready() called outside of captured execution
+ * is taken as its completion instead of completing the running command.
+ * \code
+   char out[64];
+   int retcode;
+   if (cmd_exe_capture("echo hello", out, sizeof(out), &retcode) >= sizeof(out)) {
+       // output truncated
+   }
+ * \endcode
+ * \param line     command line, e.g. "help"
+ * \param buf      buffer for output, always null terminated when cap > 0
+ * \param cap      buffer size
+ * \param retcode  retcode of the last executed command, can be NULL
+ * \return total length of the output, which is cap or more when output was truncated,
+ *         or -1 in case of invalid parameters, missing thread id function or memory
+ *         allocation failure
+ */
+int cmd_exe_capture(const char *line, char *buf, size_t cap, int *retcode);
+
 /** Add alias to interpreter.
  * Aliases are replaced with values before executing a command. All aliases must be started from beginning of line.
  * null or empty value deletes alias.
@@ -324,6 +753,57 @@ void cmd_variable_add_int(char *variable, int value);
  */
 void cmd_request_screen_size(void);
 
+/** Size of option index hash table, power of two. Half of it is used for arguments.
+ * Size is not configurable, because cmd_options_t is shared by the library and application.
+ */
+#define CMDLINE_OPTIONS_SLOTS 64
+
+/** Option index.
+ * Indexes command arguments once, so that lookups do not scan argv.
+ * Interpreter indexes arguments of the running command, and cmd_parameter_*() helpers
+ * and cmd_has_option() use that index when they are called with the command's argc and argv.
+ * Commands with more than CMDLINE_OPTIONS_SLOTS / 2 arguments are indexed partly,
+ * rest of the arguments are searched linearly. Index is reentrant, it has no global state.
+ * \code
+   int mycmd_command(int argc, char *argv[]) {
+        cmd_options_t opts;
+        cmd_options_init(&opts, argc, argv);
+        bool verbose = cmd_options_has(&opts, "v");
+        const char *mode = cmd_options_value(&opts, "--mode"); // "--mode fast" or "--mode=fast"
+   }
+ * \endcode
+ */
+typedef struct cmd_options_s {
+    char **argv;                            //!< indexed arguments
+    int argc;                               //!< count of arguments
+    int indexed;                            //!< arguments before this index are in hash table
+    uint32_t short_opts[8];                 //!< characters used in short options, e.g. "-abc"
+    uint8_t slots[CMDLINE_OPTIONS_SLOTS];   //!< argv index of each argument, 0 when slot is empty
+} cmd_options_t;
+
+/** Index command arguments. argv must not be modified while index is used.
+ * \param opts  index to be initialized
+ * \param argc  count of arguments
+ * \param argv  arguments, argv[0] is the command name
+ */
+void cmd_options_init(cmd_options_t *opts, int argc, char *argv[]);
+
+/** Find argument, same as cmd_parameter_index()
+ * \return index of argument which equals to key or -1 when not found
+ */
+int cmd_options_index(const cmd_options_t *opts, const char *key);
+
+/** Check short option, same as cmd_has_option()
+ * \return true when key is part of a short option argument, e.g. "-abc" contains "b"
+ */
+bool cmd_options_has(const cmd_options_t *opts, const char *key);
+
+/** Get option value.
+ * Value is the argument following key, or with "--key=value" arguments the part after '='.
+ * \return value or NULL when key or its value not found
+ */
+char *cmd_options_value(const cmd_options_t *opts, const char *key);
+
 /** find command parameter index by key.
  * e.g.
  * \code
@@ -389,6 +869,7 @@ bool cmd_parameter_bool(int argc, char *argv[], const char *key, bool *value);
  * \param argv  is list of arguments. List size is given in argc parameter. Value in argv[0] is string to name of command.
  * \param key   parameter key to be find
  * \param value pointer to pointer, which will point to cli input data when key and value found. if key or value not found this parameter are untouched.
+ *              Long options can give value also as "--key=value".
  * \return true if parameter key and value found otherwise false
  */
 bool cmd_parameter_val(int argc, char *argv[], const char *key, char **value);
@@ -421,6 +902,39 @@ bool cmd_parameter_int(int argc, char *argv[], const char *key, int32_t *value);
  */
 bool cmd_parameter_float(int argc, char *argv[], const char *key, float *value);
 
+/** find command parameter by key and convert its value (next parameter) from hex to bytes.
+ * Supported formats are "0011aabb", "0x0011aabb", "00:11:aa:bb" and "00 11 aa bb". With separators
+ * a byte can be also one digit, e.g. "0:11:a:bb".
+ * e.g. cmd: "mycmd --key 00:11:22"
+ * \code
+     uint8_t key[16];
+     int len = cmd_parameter_bytes( argc, argv, "--key", key, sizeof(key) );
+ * \endcode
+ * \param argc  argc is the count of arguments given in argv pointer list. value begins from 1 and this means that the 0 item in list argv is a string to name of command.
+ * \param argv  is list of arguments. List size is given in argc parameter. Value in argv[0] is string to name of command.
+ * \param key   parameter key to be found
+ * \param buf   buffer for bytes
+ * \param size  size of buf
+ * \return count of bytes, or -1 when key is not found, value is invalid or does not fit to buf
+ */
+int cmd_parameter_bytes(int argc, char *argv[], const char *key, uint8_t *buf, size_t size);
+
+/** find command parameter by key and convert its value (next parameter) to array of integers.
+ * Values are decimal or hex with "0x" prefix, separated with ',' or spaces, e.g. "1,-2,0x30" or "1, 2, 3".
+ * e.g. cmd: "mycmd --values 1,2,3"
+ * \code
+     int32_t values[8];
+     int count = cmd_parameter_int_array( argc, argv, "--values", values, 8 );
+ * \endcode
+ * \param argc  argc is the count of arguments given in argv pointer list. value begins from 1 and this means that the 0 item in list argv is a string to name of command.
+ * \param argv  is list of arguments. List size is given in argc parameter. Value in argv[0] is string to name of command.
+ * \param key   parameter key to be found
+ * \param values array for values
+ * \param count  size of values
+ * \return count of values, or -1 when key is not found, value is invalid, out of int32_t range or does not fit to values
+ */
+int cmd_parameter_int_array(int argc, char *argv[], const char *key, int32_t *values, size_t count);
+
 /** Get last command line parameter as string.
  * e.g.
  *     cmd: "mycmd hello world"
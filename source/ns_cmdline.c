@@ -20,8 +20,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 
-#if defined(_WIN32) || defined(__unix__) || defined(__unix) || defined(unix) || defined(MBED_CONF_RTOS_PRESENT) || defined(__APPLE__)
+#if defined(MBED_CONF_CMDLINE_STATIC_MEMORY) && MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+// no heap in use
+#elif defined(_WIN32) || defined(__unix__) || defined(__unix) || defined(unix) || defined(MBED_CONF_RTOS_PRESENT) || defined(__APPLE__)
 #include <stdlib.h> //malloc
 #ifndef MEM_ALLOC
 #define MEM_ALLOC malloc
@@ -57,6 +60,19 @@
 //#define MBED_CONF_CMDLINE_BOOT_MESSAGE "hello there\n"
 //#define MBED_CONF_CMDLINE_ENABLE_INTERNAL_TRACES 1
 //#define MBED_CONF_CMDLINE_ENABLE_DEEP_INTERNAL_TRACES 1
+//#define MBED_CONF_CMDLINE_ENABLE_BOUNDED_STACK 1
+//#define MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT 0
+//#define MBED_CONF_CMDLINE_ENABLE_MEM_STATS 1
+//#define MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS 1
+//#define MBED_CONF_CMDLINE_ENABLE_TRACE_RING 1
+//#define MBED_CONF_CMDLINE_STATIC_MEMORY 1
+//#define MBED_CONF_CMDLINE_STATIC_COMMANDS_MAX 32
+//#define MBED_CONF_CMDLINE_STATIC_ALIASES_MAX 8
+//#define MBED_CONF_CMDLINE_STATIC_VARIABLES_MAX 8
+//#define MBED_CONF_CMDLINE_STATIC_EXEC_MAX 8
+//#define MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH 64
+//#define MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION 1
+//#define MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE 1024
 
 
 
@@ -124,6 +140,9 @@
 #ifndef MBED_CONF_CMDLINE_HISTORY_MAX_COUNT
 #define MBED_CONF_CMDLINE_HISTORY_MAX_COUNT 0
 #endif
+#ifndef MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT
+#define MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT 0
+#endif
 // end of default configurations
 #endif
 
@@ -174,9 +193,11 @@
 #define CR_S "\r"
 #define LF_S "\n"
 #define CLEAR_ENTIRE_LINE ESCAPE("[2K")
+#define CLEAR_TO_END_OF_LINE ESCAPE("[K")
 #define CLEAR_ENTIRE_SCREEN ESCAPE("[2J")
 #define ENABLE_AUTO_WRAP_MODE ESCAPE("[7h")
-#define MOVE_CURSOR_LEFT_N_CHAR ESCAPE("[%dD")
+#define MOVE_CURSOR_LEFT ESCAPE("[")
+#define MOVE_CURSOR_RIGHT ESCAPE("[")
 
 #define SET_TOP_AND_BOTTOM_LINES ESCAPE("[;r")
 #define MOVE_CURSOR_TO_BOTTOM_RIGHT ESCAPE("[999;999H")
@@ -194,12 +215,33 @@
 #define ETB 0x17
 #define TAB 0x09
 #define CAN 0x18
+#define BEL 0x07
+#define DC2 0x12
 
 #define DEFAULT_RETFMT "retcode: %i\r\n"
 #define DEFAULT_PROMPT "/>"
 #define VAR_PROMPT "PS1"
 #define VAR_RETFMT "RETFMT"
+#define VAR_RETCODE "?"
+#define ALIAS_LAST "_"
+// values shorter than this are stored inside the variable
+#define MBED_CMDLINE_VALUE_INLINE_SIZE 16
 #define MBED_CMDLINE_ESCAPE_BUFFER_SIZE 10
+// maximum count of pending cmd_ready()/cmd_next() events
+#define MBED_CMDLINE_EVENT_QUEUE_SIZE 4
+// size of the internal output formatter buffer, line refresh with a short prompt fits to it
+#define MBED_CMDLINE_FMT_BUFFER_SIZE (MBED_CONF_CMDLINE_MAX_LINE_LENGTH + 32)
+// maximum count of records used to decode compressed history entry
+#define MBED_CMDLINE_HISTORY_MAX_DEPTH 8
+// longest command name which gets suggestions, and maximum count of them
+#define MBED_CMDLINE_SUGGEST_MAX_LENGTH 32
+#define MBED_CMDLINE_SUGGEST_COUNT 3
+// count of history hash buckets, power of two
+#define MBED_CMDLINE_HISTORY_HASH_BUCKETS 32
+// maximum length of history search pattern
+#define MBED_CMDLINE_SEARCH_MAX_LENGTH 32
+// enough characters for any 32-bit integer including sign and null terminator
+#define MBED_CMDLINE_INT_STR_SIZE 12
 
 // by default use
 #ifndef MBED_CONF_CMDLINE_ENABLE_ALIASES
@@ -210,13 +252,32 @@
 #elif defined(MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS) && MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1 && MBED_CONF_CMDLINE_USE_DUMMY_SET_ECHO_COMMANDS == 1
 #warning "Cannot set MBED_CONF_CMDLINE_USE_DUMMY_SET_ECHO_COMMANDS along with MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS"
 #endif
+#if defined(MBED_CONF_CMDLINE_STATIC_MEMORY) && MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+// static memory reserves every line and history buffer up front, defaults fit to MCUs
+#ifndef MBED_CONF_CMDLINE_MAX_LINE_LENGTH
+#define MBED_CONF_CMDLINE_MAX_LINE_LENGTH 128
+#endif
+#ifndef MBED_CONF_CMDLINE_HISTORY_MAX_COUNT
+#define MBED_CONF_CMDLINE_HISTORY_MAX_COUNT 8
+#endif
+#endif
 // Maximum length of input line
 #ifndef MBED_CONF_CMDLINE_MAX_LINE_LENGTH
 #define MBED_CONF_CMDLINE_MAX_LINE_LENGTH 2000
 #endif
 // Maximum number of arguments in a single command
 #ifndef MBED_CONF_CMDLINE_ARGS_MAX_COUNT
-#define MBED_CONF_CMDLINE_ARGS_MAX_COUNT 30
+#if defined(MBED_CONF_CMDLINE_STATIC_MEMORY) && MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+// argv of a full line fits to a line buffer with 32-bit pointers
+#define MBED_CONF_CMDLINE_ARGS_MAX_COUNT (MBED_CONF_CMDLINE_MAX_LINE_LENGTH / 4)
+#else
+// every argument takes at least one character and a separator, so any line fits
+#define MBED_CONF_CMDLINE_ARGS_MAX_COUNT ((MBED_CONF_CMDLINE_MAX_LINE_LENGTH + 1) / 2)
+#endif
+#endif
+// Number of arguments kept without allocation, longer lines allocate argv
+#ifndef MBED_CONF_CMDLINE_ARGS_INLINE_COUNT
+#define MBED_CONF_CMDLINE_ARGS_INLINE_COUNT 8
 #endif
 // initialize automation mode at startup phase, no need to send set -commands
 #ifndef MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE
@@ -250,27 +311,155 @@
 #ifndef MBED_CONF_CMDLINE_ENABLE_OPERATORS
 #define MBED_CONF_CMDLINE_ENABLE_OPERATORS 1
 #endif
+// keep stack usage independent of arguments count
+#ifndef MBED_CONF_CMDLINE_ENABLE_BOUNDED_STACK
+#define MBED_CONF_CMDLINE_ENABLE_BOUNDED_STACK 0
+#endif
+// allow structured JSON-lines output mode
+#ifndef MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT
+#define MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT 1
+#endif
+// account memory usage per subsystem
+#ifndef MBED_CONF_CMDLINE_ENABLE_MEM_STATS
+#define MBED_CONF_CMDLINE_ENABLE_MEM_STATS 0
+#endif
+// count executions and execution times per command
+#ifndef MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS
+#define MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS 0
+#endif
+// record interpreter events to a binary ring
+#ifndef MBED_CONF_CMDLINE_ENABLE_TRACE_RING
+#define MBED_CONF_CMDLINE_ENABLE_TRACE_RING 0
+#endif
+// count of events in trace ring, power of two
+#ifndef MBED_CONF_CMDLINE_TRACE_RING_SIZE
+#define MBED_CONF_CMDLINE_TRACE_RING_SIZE 64
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1 && \
+    (MBED_CONF_CMDLINE_TRACE_RING_SIZE & (MBED_CONF_CMDLINE_TRACE_RING_SIZE - 1)) != 0
+#error "MBED_CONF_CMDLINE_TRACE_RING_SIZE must be power of two"
+#endif
+// use statically allocated storage instead of heap
+#ifndef MBED_CONF_CMDLINE_STATIC_MEMORY
+#define MBED_CONF_CMDLINE_STATIC_MEMORY 0
+#endif
+// capacities of static storage
+#ifndef MBED_CONF_CMDLINE_STATIC_COMMANDS_MAX
+#define MBED_CONF_CMDLINE_STATIC_COMMANDS_MAX 32
+#endif
+#ifndef MBED_CONF_CMDLINE_STATIC_ALIASES_MAX
+#define MBED_CONF_CMDLINE_STATIC_ALIASES_MAX 8
+#endif
+#ifndef MBED_CONF_CMDLINE_STATIC_VARIABLES_MAX
+#define MBED_CONF_CMDLINE_STATIC_VARIABLES_MAX 8
+#endif
+#ifndef MBED_CONF_CMDLINE_STATIC_EXEC_MAX
+#define MBED_CONF_CMDLINE_STATIC_EXEC_MAX 8
+#endif
+// maximum length of alias and variable names and values
+#ifndef MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH
+#define MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH 64
+#endif
+// TAB inserts common prefix of candidates and second TAB lists them, instead of cycling them
+#ifndef MBED_CONF_CMDLINE_ENABLE_TAB_LISTING
+#define MBED_CONF_CMDLINE_ENABLE_TAB_LISTING 0
+#endif
+// suggest similar commands when command is not found
+#ifndef MBED_CONF_CMDLINE_ENABLE_SUGGESTIONS
+#define MBED_CONF_CMDLINE_ENABLE_SUGGESTIONS 0
+#endif
+// reverse incremental history search with ctrl+r
+#ifndef MBED_CONF_CMDLINE_ENABLE_HISTORY_SEARCH
+#define MBED_CONF_CMDLINE_ENABLE_HISTORY_SEARCH 0
+#endif
+// store history front coded to a fixed size arena
+#ifndef MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION
+#define MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION 0
+#endif
+// size of compressed history in bytes
+#ifndef MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE
+#define MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE 1024
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 1 && MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE > 65535
+#error "MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE must be less than 64kB"
+#endif
+// executed command which is already in history is moved to the start instead of stored again
+#ifndef MBED_CONF_CMDLINE_ENABLE_HISTORY_ERASE_DUPS
+#define MBED_CONF_CMDLINE_ENABLE_HISTORY_ERASE_DUPS 0
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_ERASE_DUPS == 1 && MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 1
+#error "MBED_CONF_CMDLINE_ENABLE_HISTORY_ERASE_DUPS can not be used with history compression"
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1 && MBED_CONF_CMDLINE_ENABLE_HISTORY_ERASE_DUPS == 1
+#define CMD_HISTORY_ERASE_DUPS 1
+#else
+#define CMD_HISTORY_ERASE_DUPS 0
+#endif
+// bash style history expansion of executed lines: !!, !n, !-n, !prefix and ^old^new
+#ifndef MBED_CONF_CMDLINE_ENABLE_HISTORY_EXPANSION
+#define MBED_CONF_CMDLINE_ENABLE_HISTORY_EXPANSION 0
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1 && MBED_CONF_CMDLINE_ENABLE_HISTORY_EXPANSION == 1
+#define CMD_HISTORY_EXPANSION 1
+#else
+#define CMD_HISTORY_EXPANSION 0
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1 && MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1 && \
+    MBED_CONF_CMDLINE_ENABLE_HISTORY_SEARCH == 1
+#define CMD_HISTORY_SEARCH 1
+#else
+#define CMD_HISTORY_SEARCH 0
+#endif
+// argv array of the running command, larger lines spill to allocated array
+#if MBED_CONF_CMDLINE_ARGS_INLINE_COUNT < MBED_CONF_CMDLINE_ARGS_MAX_COUNT
+#define CMD_ARGV_INLINE_COUNT MBED_CONF_CMDLINE_ARGS_INLINE_COUNT
+#else
+#define CMD_ARGV_INLINE_COUNT MBED_CONF_CMDLINE_ARGS_MAX_COUNT
+#endif
+#if CMD_ARGV_INLINE_COUNT < 1
+#error "MBED_CONF_CMDLINE_ARGS_INLINE_COUNT must be at least 1"
+#endif
+// cmd_parse_argv() failures
+#define CMD_ARGV_TOO_MANY   -1
+#define CMD_ARGV_NO_MEMORY  -2
 
 
 typedef struct cmd_history_s {
     char *command_ptr;
+#if CMD_HISTORY_SEARCH == 1
+    uint32_t sig;                     // characters of command, see cmd_str_sig()
+#endif
+#if CMD_HISTORY_ERASE_DUPS == 1
+    uint32_t hash;                    // hash of command, see cmd_str_hash()
+    struct cmd_history_s *hash_next;  // next entry in the same hash bucket
+#endif
     ns_list_link_t link;
 } cmd_history_t;
 typedef NS_LIST_HEAD(cmd_history_t, link) history_list_t;
 
-typedef struct cmd_command_s {
-    const char *name_ptr;
-    const char *info_ptr;
-    const char *man_ptr;
-    cmd_run_cb *run_cb;
-    bool        busy;
-    ns_list_link_t link;
-} cmd_command_t;
-typedef NS_LIST_HEAD(cmd_command_t, link) command_list_t;
+// commands are linked using cmd_descriptor_t, which may be owned by application.
+// Library state of a command is kept in the internal block of the descriptor.
+typedef struct cmd_command_internal_s {
+    ns_list_link_t link;              // first, list head uses offset of the block
+    cmd_stats_t *stats_ptr;           // execution statistics, or NULL
+    uint32_t name_sig;                // characters of name for suggestions
+    uint8_t name_len;                 // length of name for suggestions
+    bool busy;
+    bool allocated;                   // descriptor was allocated by cmd_add()
+    bool abandoned;                   // cmd_exe_capture() returned before command completed
+} cmd_command_internal_t;
+NS_STATIC_ASSERT(offsetof(cmd_command_internal_t, link) == 0, "command link must start internal block")
+NS_STATIC_ASSERT(sizeof(cmd_command_internal_t) <= sizeof(((cmd_descriptor_t *)0)->internal),
+                 "cmd_descriptor_t internal block too small")
+#define CMD_INTERNAL(cmd_ptr) ((cmd_command_internal_t *)(void *)(cmd_ptr)->internal)
+
+typedef cmd_descriptor_t cmd_command_t;
+typedef NS_LIST_HEAD(cmd_command_t, internal) command_list_t;
 
 typedef struct cmd_alias_s {
     char *name_ptr;
     char *value_ptr;
+    size_t value_size;                // allocated size of value
     ns_list_link_t link;
 } cmd_alias_t;
 typedef NS_LIST_HEAD(cmd_alias_t, link) alias_list_t;
@@ -278,20 +467,31 @@ typedef NS_LIST_HEAD(cmd_alias_t, link) alias_list_t;
 union Data {
     char *ptr;
     int i;
+    char str[MBED_CMDLINE_VALUE_INLINE_SIZE];
 };
 typedef enum value_type_s {
     VALUE_TYPE_STR,
-    VALUE_TYPE_INT
+    VALUE_TYPE_INT,
+    VALUE_TYPE_INLINE
 } value_type_t;
 
 typedef struct cmd_variable_s {
     char *name_ptr;
     union Data value;
     value_type_t type;
+    size_t value_size;                // allocated size of VALUE_TYPE_STR value
     ns_list_link_t link;
 } cmd_variable_t;
 typedef NS_LIST_HEAD(cmd_variable_t, link) variable_list_t;
 
+// variables updated by the interpreter itself have fixed slots
+typedef enum cmd_special_var_s {
+    CMD_VAR_PROMPT,
+    CMD_VAR_RETCODE,
+    CMD_VAR_RETFMT,
+    CMD_VAR_SPECIAL_COUNT
+} cmd_special_var_t;
+
 typedef enum operator_s {
     OPERATOR_SEMI_COLON,  //default
     OPERATOR_AND,
@@ -307,22 +507,93 @@ typedef struct cmd_exe_s {
 } cmd_exe_t;
 typedef NS_LIST_HEAD(cmd_exe_t, link) cmd_list_t;
 
+typedef enum cmd_event_type_s {
+    CMD_EVENT_READY,      // command completed, cmd_ready()
+    CMD_EVENT_NEXT        // continue to next command, cmd_next()
+} cmd_event_type_t;
+
+typedef struct cmd_event_s {
+    cmd_event_type_t type;
+    int              retcode;
+} cmd_event_t;
+
+// output buffer of the internal formatter
+typedef struct cmd_fmt_s {
+    int  len;
+    char buf[MBED_CMDLINE_FMT_BUFFER_SIZE];
+} cmd_fmt_t;
+
+typedef struct cmd_capture_s {
+    char  *buf;                       // caller buffer
+    size_t cap;                       // caller buffer size
+    size_t len;                       // total output length, can exceed cap
+    int    retcode;                   // retcode given by cmd_ready()
+    bool   done;                      // cmd_ready() called during execution
+    bool   running;                   // command callback is running
+    bool   started;                   // command callback was called and marked busy
+    uintptr_t thread_id;              // calling thread, when thread id function is configured
+} cmd_capture_t;
+
+
+#if CMD_HISTORY_SEARCH == 1
+/* State of reverse incremental history search. Entries are filtered with a
+ * signature of characters and matched with Horspool using the same (c & 31)
+ * character classes, so shift table stays small.
+ */
+typedef struct cmd_search_s {
+    char pattern[MBED_CMDLINE_SEARCH_MAX_LENGTH + 1]; // kept for ctrl+r with empty pattern
+    uint8_t len;                      // length of current pattern
+    uint8_t shift[32];                // bad character shifts of pattern
+    uint32_t sig;                     // characters of pattern
+    int16_t origin;                   // history position when search was started
+    int16_t index;                    // history entry shown, origin until something is found
+    bool active;
+    bool failed;                      // last search did not find anything
+    // what is on the terminal, for differential redraw
+    bool drawn;
+    bool drawn_failed;
+    uint8_t drawn_len;
+    int16_t drawn_index;
+} cmd_search_t;
+#endif
 
 typedef struct cmd_class_s {
     char input[MBED_CONF_CMDLINE_MAX_LINE_LENGTH]; // input data
 
 #if MBED_CONF_CMDLINE_ENABLE_HISTORY
     int16_t history;                  // history position
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 1
+    uint8_t history_arena[MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE]; // front coded input history
+    uint16_t history_used;            // used bytes of history arena
+    int16_t history_count;            // count of history entries
+#else
     history_list_t history_list;      // input history
+#if CMD_HISTORY_ERASE_DUPS == 1
+    cmd_history_t *history_hash[MBED_CMDLINE_HISTORY_HASH_BUCKETS]; // history entries by hash of command
+#endif
+#endif
     uint8_t history_max_count;        // history max size
+    cmd_history_store_t history_store; // persistent history log, disabled when read is NULL
+    bool history_loaded;              // history log has been loaded
+    uint32_t history_log_count;       // count of records in log, only appended ones until loaded
+    uint32_t history_spare_length;    // bytes written to spare log by compaction
+    int16_t history_compact;          // next entry written to spare log, -1 when not compacting
+#endif
+#if CMD_HISTORY_SEARCH == 1
+    cmd_search_t search;              // ctrl+r history search
 #endif
     int16_t cursor;                   // cursor position
     command_list_t command_list;      // commands list
 #if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
     alias_list_t alias_list;          // alias list
+    cmd_alias_t last_alias;           // slot for "_" alias, in list when name_ptr is set
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+    char last_alias_value[MBED_CONF_CMDLINE_MAX_LINE_LENGTH]; // value of "_" alias, whole command line
+#endif
 #endif
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
     variable_list_t variable_list;    // variables list
+    cmd_variable_t special_vars[CMD_VAR_SPECIAL_COUNT]; // slots for special variables, in list when name_ptr is set
 #endif
 #if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
     bool vt100_on;                    // control characters
@@ -335,20 +606,53 @@ typedef struct cmd_class_s {
     int  tab_lookup;                  // originally lookup characters count
     int  tab_lookup_cmd_n;            // index in command list
     int  tab_lookup_n;                //
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+    cmd_complete_t complete;          // argument completion in progress
+    cmd_command_t *complete_cmd;      // command which completion is in progress
+    int  complete_n;                  // count of matching candidates given, -1 when not started
+#endif
     bool prev_cr;                     // indicate if cr was last char
     bool echo;                        // echo inputs
     cmd_ready_cb_f *ready_cb;         // ready cb function
     cmd_list_t  cmd_buffer;
     cmd_exe_t  *cmd_buffer_ptr;
     cmd_command_t  *cmd_ptr;
+    cmd_options_t options;            // option index of running command
+    void       *args_ptr;             // arguments of running command parsed with its schema
     int8_t      tasklet_id;
     int8_t      network_tasklet_id;
     bool        idle;
+    cmd_event_t events[MBED_CMDLINE_EVENT_QUEUE_SIZE]; // pending completion events
+    uint8_t     event_head;           // index of first pending event
+    uint8_t     event_count;          // count of pending events
+    bool        event_loop;           // events are being handled
+    cmd_capture_t *capture_ptr;       // output capture of cmd_exe_capture()
+    uint8_t     abandoned_count;      // commands which completion is dropped, see cmd_exe_capture()
+#if MBED_CONF_CMDLINE_ENABLE_BOUNDED_STACK == 1
+    char       *argv[CMD_ARGV_INLINE_COUNT]; // arguments of the running command
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    bool        json;                 // JSON-lines output mode
+#endif
+    uint32_t    exec_start;           // clock value when running command was started
+    uint32_t (*clock_fnc)(void);      // clock cb function
 
     cmd_print_t *out;                  // print cb function
+    cmd_write_t *write;                // raw write cb function, out is used when NULL
+    cmd_fmt_t   fmt;                   // internal formatter output, used while holding output mutex
     void (*ctrl_fnc)(uint8_t c);      // control cb function
     void (*mutex_wait_fnc)(void);         // mutex wait cb function
     void (*mutex_release_fnc)(void);      // mutex release cb function
+    uintptr_t (*thread_id_fnc)(void);     // thread id cb function
+    cmd_allocator_t allocator;            // memory allocator, default when alloc is NULL
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    cmd_mem_stats_t mem_stats[CMDLINE_MEM_TOTAL + 1]; // memory usage per subsystem and total
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+    cmd_trace_record_t trace[MBED_CONF_CMDLINE_TRACE_RING_SIZE]; // latest interpreter events
+    uint32_t trace_count;                 // count of events since cleared, next one goes to count % size
+    bool trace_paused;                    // ring is being exported
+#endif
     input_passthrough_func_t passthrough_fnc; // input passthrough cb function
 } cmd_class_t;
 
@@ -357,7 +661,9 @@ cmd_class_t cmd = {
     .cmd_ptr = NULL,
     .mutex_wait_fnc = NULL,
     .mutex_release_fnc = NULL,
-    .passthrough_fnc = NULL
+    .thread_id_fnc = NULL,
+    .passthrough_fnc = NULL,
+    .clock_fnc = NULL
 };
 
 /* Function prototypes
@@ -365,19 +671,36 @@ cmd_class_t cmd = {
 static void             cmd_init_base_commands(void);
 static void             cmd_replace_alias(char *input) CMDLINE_UNUSED;
 static void             cmd_replace_variables(char *input) CMDLINE_UNUSED;
-static int              cmd_parse_argv(char *string_ptr, char **argv);
+static int              cmd_parse_argv(char *string_ptr, char **argv, char ***spill_ptr);
 static void             cmd_execute(void);
 static void             cmd_line_clear(int from);
 #if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1
-static void             cmd_history_item_delete(cmd_history_t *entry_ptr);
 static void             cmd_history_save(int16_t index);
 static void             cmd_history_get(uint16_t index);
 static void             cmd_history_clean_overflow(void);
 static void             cmd_history_clean(void);
-static cmd_history_t   *cmd_history_find(int16_t index);
+static int16_t          cmd_history_count(void);
+static bool             cmd_history_equals(int16_t index, const char *str);
+static const char      *cmd_history_text(int16_t index, char **tmp_ptr);
+static void             cmd_history_load(void);
+static void             cmd_history_log_append(const char *str);
+static bool             cmd_history_log_compact(void);
+#if CMD_HISTORY_ERASE_DUPS == 1
+static bool             cmd_history_raise(const char *str, bool edited);
+#endif
+#if CMD_HISTORY_EXPANSION == 1
+static bool             cmd_history_expand(void);
+#endif
 static void             cmd_goto_end_of_history(void) CMDLINE_UNUSED;
 static void             cmd_goto_beginning_of_history(void) CMDLINE_UNUSED;
 #endif
+#if CMD_HISTORY_SEARCH == 1
+static int16_t          cmd_history_search(int16_t from, int *pos_ptr);
+static int              cmd_search_match(const char *text, int length);
+static void             cmd_search_start(void);
+static bool             cmd_search_input(int16_t u_data);
+static void             cmd_search_output(void);
+#endif
 static void             cmd_echo(bool on);
 static bool             cmd_tab_lookup(void) CMDLINE_UNUSED;
 static void             cmd_clear_last_word(void) CMDLINE_UNUSED;
@@ -394,8 +717,34 @@ static cmd_command_t   *cmd_find_n(char *name, int nameLength, int n) CMDLINE_UN
 static cmd_alias_t     *alias_find(const char *alias) CMDLINE_UNUSED;
 static cmd_alias_t     *alias_find_n(char *alias, int aliaslength, int n) CMDLINE_UNUSED;
 static cmd_variable_t  *variable_find(char *variable) CMDLINE_UNUSED;
+static cmd_variable_t  *cmd_special_var(cmd_special_var_t id) CMDLINE_UNUSED;
+static char            *cmd_variable_str(cmd_variable_t *variable_ptr) CMDLINE_UNUSED;
 static cmd_variable_t  *variable_find_n(char *variable, int length, int n) CMDLINE_UNUSED;
 static void             cmd_print_man(cmd_command_t *command_ptr);
+static void             cmd_schema_print(const cmd_command_t *command_ptr);
+static int              cmd_schema_parse(const cmd_schema_t *schema, int argc, char *argv[]);
+static size_t           cmd_options_name_len(const char *str);
+// completion candidate visitor, returns true to stop
+typedef bool (cmd_tab_visit_f)(void *ctx, const char *str);
+static uint32_t         cmd_str_sig(const char *str) CMDLINE_UNUSED;
+static uint32_t         cmd_str_hash(const char *str, size_t len);
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+static void             cmd_trace_event(cmd_trace_event_t event, uint16_t arg);
+#define CMD_TRACE(event, arg) cmd_trace_event(event, arg)
+#else
+#define CMD_TRACE(event, arg)
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+static void             cmd_stats_busy(cmd_command_t *cmd_ptr);
+static void             cmd_stats_start(cmd_command_t *cmd_ptr);
+static void             cmd_stats_done(cmd_command_t *cmd_ptr, int retcode);
+#endif
+static cmd_command_t   *cmd_find_input(void);
+static const char      *cmd_schema_lookup(const char *word, int wordlength, int *n_ptr);
+static const char      *cmd_complete_lookup(int wordpos, int wordlength, int n) CMDLINE_UNUSED;
+#if MBED_CONF_CMDLINE_ENABLE_TAB_LISTING == 1 && MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+static void             cmd_tab_complete(void);
+#endif
 static void             cmd_set_input(const char *str, int cur);
 static char            *next_command(char *string_ptr, operator_t *mode);
 static void             replace_variable(char *str, cmd_variable_t *variable_ptr) CMDLINE_UNUSED;
@@ -405,6 +754,11 @@ static void             cmd_variable_print_all(void) CMDLINE_UNUSED;
  * \ret  command return code (CMDLINE_RETCODE_*)
  */
 static int              cmd_run(char *string_ptr);
+static void             cmd_next_step(int retcode);
+static void             cmd_ready_step(int retcode);
+static void             cmd_event_post(cmd_event_type_t type, int retcode);
+static bool             cmd_abandoned_ready(int retcode);
+static void             cmd_event_run(void);
 static cmd_exe_t       *cmd_next_ptr(int retcode);
 static void             cmd_split(char *string_ptr);
 static void             cmd_push(char *cmd_str, operator_t oper);
@@ -420,6 +774,9 @@ int alias_command(int argc, char *argv[]);
 int unset_command(int argc, char *argv[]);
 int clear_command(int argc, char *argv[]);
 int history_command(int argc, char *argv[]);
+int meminfo_command(int argc, char *argv[]);
+int stats_command(int argc, char *argv[]);
+int trace_command(int argc, char *argv[]);
 /** Internal helper functions
  */
 static const char *find_last_space(const char *from, const char *to);
@@ -427,6 +784,21 @@ static int replace_string(
     char *str, int str_len,
     const char *old_str, const char *new_str);
 
+static void cmd_print_retcode(const char *retfmt, int retcode);
+static void cmd_capture_vprintf(cmd_capture_t *capture_ptr, const char *fmt, va_list ap);
+static void cmd_capture_write(cmd_capture_t *capture_ptr, const char *str, int len);
+static void cmd_write(const char *str, int len);
+static void cmd_fmt_flush(void);
+static bool cmd_capture_owner(void);
+typedef enum cmd_mem_kind_s {
+    CMD_MEM_OBJECT,       // list entry
+    CMD_MEM_BUFFER        // string or other buffer
+} cmd_mem_kind_t;
+static void *cmd_mem_alloc(cmd_mem_subsystem_t subsystem, cmd_mem_kind_t kind, size_t size);
+static void cmd_mem_free(void *ptr);
+static int cmd_itoa(int value, char *str);
+static int cmd_utoa(uint32_t value, char *str);
+
 void default_cmd_response_out(const char *fmt, va_list ap)
 {
     vprintf(fmt, ap);
@@ -444,222 +816,1313 @@ void cmd_vprintf(const char *fmt, va_list ap)
     if (cmd.mutex_wait_fnc) {
         cmd.mutex_wait_fnc();
     }
-    cmd.out(fmt, ap);
+    // formatted output of this thread which is not yet written goes first
+    cmd_fmt_flush();
+    bool captured = cmd_capture_owner();
+    CMD_TRACE(CMDLINE_TRACE_OUTPUT, captured);
+    if (captured) {
+        cmd_capture_vprintf(cmd.capture_ptr, fmt, ap);
+    } else {
+        cmd.out(fmt, ap);
+    }
     if (cmd.mutex_release_fnc) {
         cmd.mutex_release_fnc();
     }
 }
-/* Function definitions
- */
-void cmd_init(cmd_print_t *outf)
+
+static void cmd_out_printf(const char *fmt, ...)
 {
-    if (!cmd.init) {
-#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
-        ns_list_init(&cmd.alias_list);
-#endif
-#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1
-        ns_list_init(&cmd.history_list);
-#endif
-        ns_list_init(&cmd.command_list);
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
-        ns_list_init(&cmd.variable_list);
-#endif
-        ns_list_init(&cmd.cmd_buffer);
-        cmd.init = true;
-    }
-    cmd.out = outf ? outf : default_cmd_response_out;
-    cmd.ctrl_fnc = NULL;
-    cmd.echo = MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE == 0;
-    cmd.insert = true;
-    cmd.cursor = 0;
-    cmd.prev_cr = false;
-#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
-    cmd.escaping = false;
-    cmd.vt100_on = MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE == 0;
-#endif
-#if MBED_CONF_CMDLINE_ENABLE_HISTORY
-    cmd.history_max_count = MBED_CONF_CMDLINE_HISTORY_MAX_COUNT;
-#endif
-    cmd.tab_lookup = 0;
-    cmd.tab_lookup_cmd_n = 0;
-    cmd.tab_lookup_n = 0;
-    cmd.cmd_buffer_ptr = 0;
-    cmd.idle = true;
-    cmd.ready_cb = cmd_next;
-    cmd.passthrough_fnc = NULL;
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 1
-    cmd_variable_add(VAR_PROMPT, DEFAULT_PROMPT);
-    cmd_variable_add_int("?", 0);
-    //cmd_alias_add("auto-on", "set PS1=\r\nretcode=$?\r\n&&echo off");
-    //cmd_alias_add("auto-off", "set PS1="DEFAULT_PROMPT"&&echo on");
-#endif
-#if MBED_CONF_CMDLINE_ENABLE_HISTORY
-    cmd_history_save(0);          // the current line is the 0 item
-#endif
-    cmd_line_clear(0);            // clear line
-    cmd_init_base_commands();
-    cmd_init_screen();
-    return;
+    va_list ap;
+    va_start(ap, fmt);
+    cmd.out(fmt, ap);
+    va_end(ap);
 }
-void cmd_request_screen_size(void)
+
+// writes str without printf engine when raw write function is configured
+static void cmd_write(const char *str, int len)
 {
-    cmd_printf(REQUEST_SCREEN_SIZE);
+    cmd_mutex_lock();
+    bool captured = cmd_capture_owner();
+    CMD_TRACE(CMDLINE_TRACE_OUTPUT, captured);
+    if (captured) {
+        cmd_capture_write(cmd.capture_ptr, str, len);
+    } else if (cmd.write) {
+        cmd.write(str, len);
+    } else {
+        cmd_out_printf("%.*s", len, str);
+    }
+    cmd_mutex_unlock();
 }
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 0
-#define cmdline_get_prompt() DEFAULT_PROMPT
-#else
-const char *cmdline_get_prompt(void)
+
+static void cmd_capture_write(cmd_capture_t *capture_ptr, const char *str, int len)
 {
-    cmd_variable_t *var_ptr = variable_find(VAR_PROMPT);
-    return var_ptr && var_ptr->type == VALUE_TYPE_STR ? var_ptr->value.ptr : "";
+    if (capture_ptr->len + 1 < capture_ptr->cap) {
+        size_t n = capture_ptr->cap - capture_ptr->len - 1;
+        if (n > (size_t)len) {
+            n = len;
+        }
+        memcpy(capture_ptr->buf + capture_ptr->len, str, n);
+        capture_ptr->buf[capture_ptr->len + n] = 0;
+    }
+    capture_ptr->len += len;
 }
-#endif
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 0
-#define cmd_get_retfmt() MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE ? DEFAULT_RETFMT : 0
-#else
-const char *cmd_get_retfmt(void)
+
+static void cmd_capture_vprintf(cmd_capture_t *capture_ptr, const char *fmt, va_list ap)
 {
-    cmd_variable_t *var_ptr = variable_find(VAR_RETFMT);
-    return var_ptr && var_ptr->type == VALUE_TYPE_STR ? var_ptr->value.ptr : 0;
+    size_t room = capture_ptr->len < capture_ptr->cap ? capture_ptr->cap - capture_ptr->len : 0;
+    int len = vsnprintf(room ? capture_ptr->buf + capture_ptr->len : NULL, room, fmt, ap);
+    if (len > 0) {
+        capture_ptr->len += len;
+    }
 }
-#endif
 
-#if MBED_CONF_CMDLINE_INCLUDE_MAN == 1
-#define MAN_ECHO    "Displays messages, or turns command echoing on or off\r\n"\
-                    "echo <data_to_be_print>\r\n"\
-                    "some special parameters:\r\n"\
-                    "<bool>                 On/Off echo input characters\r\n"
-#define MAN_ALIAS   "alias <theAlias> <command (parameters)>\r\n"
-#define MAN_UNSET   "unset <var_name>\r\n"
-#define MAN_SET     "set <var_name> <value>\r\n"\
-                    "some special parameters\r\n"\
-                    "--vt100 <bool>         On/Off vt100 controls\r\n"\
-                    "--retcode <bool>       On/Off retcode print after execution\r\n"\
-                    "--retfmt <format>      Return print format. Default: \"retcode: %i\\n\"\r\n"
+// output and completions of other threads are not captured, without thread id
+// function there is only one thread, see cmd_exe_capture()
+static bool cmd_capture_owner(void)
+{
+    if (cmd.capture_ptr == NULL) {
+        return false;
+    }
+    return cmd.thread_id_fnc == NULL || cmd.thread_id_fnc() == cmd.capture_ptr->thread_id;
+}
 
-#define MAN_CLEAR   "Clears the display"
-#define MAN_HISTORY "Show commands history\r\n"\
-                    "history (<optio>)\r\n"\
-                    "clear                  Clear history\r\n"
+/* Memory allocation.
+ * All library allocations go through cmd_mem_alloc()/cmd_mem_free(), which use
+ * the allocator configured with cmd_set_allocator() or MEM_ALLOC/MEM_FREE.
+ */
+typedef union cmd_mem_align_u {
+    void     *ptr;
+    long long ll;
+    double    d;
+} cmd_mem_align_t;
+#define CMD_MEM_ALIGN(x) (((x) + sizeof(cmd_mem_align_t) - 1) / sizeof(cmd_mem_align_t) * sizeof(cmd_mem_align_t))
+#define CMD_MAX(x, y) ((x) > (y) ? (x) : (y))
+
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+/* Each allocation is prefixed with a header, which tells size and subsystem
+ * of the allocation when it is freed.
+ */
+typedef union cmd_mem_header_u {
+    struct {
+        size_t  size;
+        uint8_t subsystem;
+    } info;
+    cmd_mem_align_t align;
+} cmd_mem_header_t;
+#define CMD_MEM_HEADER_SIZE sizeof(cmd_mem_header_t)
 #else
-#define MAN_ECHO    NULL
-#define MAN_ALIAS   NULL
-#define MAN_SET     NULL
-#define MAN_UNSET   NULL
-#define MAN_CLEAR   NULL
-#define MAN_HISTORY NULL
+#define CMD_MEM_HEADER_SIZE 0
 #endif
+// pool block fits any of the internal objects
+#define CMD_POOL_BLOCK_SIZE (CMD_MEM_HEADER_SIZE + \
+                             CMD_MEM_ALIGN(CMD_MAX(CMD_MAX(sizeof(cmd_command_t), sizeof(cmd_variable_t)), \
+                                           CMD_MAX(CMD_MAX(sizeof(cmd_alias_t), sizeof(cmd_exe_t)), sizeof(cmd_history_t)))))
 
-static void cmd_init_base_commands(void)
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+static void *cmd_static_alloc(cmd_mem_subsystem_t subsystem, cmd_mem_kind_t kind, size_t size);
+static void cmd_static_free(void *ptr);
+
+static void *cmd_mem_alloc_raw(cmd_mem_subsystem_t subsystem, cmd_mem_kind_t kind, size_t size)
 {
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 1
-    cmd_add("set",      set_command,      "print or set variables", MAN_SET);
-    cmd_add("unset",    unset_command,    "unset variables",      MAN_UNSET);
-#endif
-    cmd_add("help",     help_command,     "This help",            NULL);
-    cmd_add("echo",     echo_command,     "Echo controlling",     MAN_ECHO);
-#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
-    cmd_add("alias",    alias_command,    "Handle aliases",       MAN_ALIAS);
-#endif
-    cmd_add("clear",    clear_command,    "Clears the display",   MAN_CLEAR);
-#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1
-    cmd_add("history",  history_command,  "View your command Line History", MAN_HISTORY);
-#endif
-    cmd_add("true",     true_command, 0, 0);
-    cmd_add("false",    false_command, 0, 0);
-#elif MBED_CONF_CMDLINE_USE_DUMMY_SET_ECHO_COMMANDS == 1
-    cmd_add("set", set_command, 0, 0);
-    cmd_add("echo", echo_command, 0, 0);
-#endif
+    return cmd_static_alloc(subsystem, kind, size);
 }
 
-void cmd_reset(void)
+static void cmd_mem_free_raw(void *ptr)
 {
-    cmd_free();
-    cmd_init_base_commands();
+    cmd_static_free(ptr);
 }
-
-void cmd_free(void)
+#else
+static void *cmd_mem_alloc_raw(cmd_mem_subsystem_t subsystem, cmd_mem_kind_t kind, size_t size)
 {
-    if (!cmd.init) {
-        tr_warn("cmd_free() called without init");
-        return;
-    }
-    ns_list_foreach_safe(cmd_command_t, cur_ptr, &cmd.command_list) {
-        cmd_delete(cur_ptr->name_ptr);
+    (void)subsystem;
+    (void)kind;
+    if (cmd.allocator.alloc) {
+        return cmd.allocator.alloc(cmd.allocator.ctx, size);
     }
-#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
-    ns_list_foreach_safe(cmd_alias_t, cur_ptr, &cmd.alias_list) {
-        cmd_alias_add(cur_ptr->name_ptr, NULL);
+    return MEM_ALLOC(size);
+}
+
+static void cmd_mem_free_raw(void *ptr)
+{
+    if (cmd.allocator.free) {
+        cmd.allocator.free(cmd.allocator.ctx, ptr);
+    } else {
+        MEM_FREE(ptr);
     }
+}
 #endif
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
-    ns_list_foreach_safe(cmd_variable_t, cur_ptr, &cmd.variable_list) {
-        if (cur_ptr->type == VALUE_TYPE_STR) {
-            cmd_variable_add(cur_ptr->value.ptr, NULL);
+
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+static void cmd_mem_account(cmd_mem_subsystem_t subsystem, size_t size, bool alloc)
+{
+    cmd_mem_stats_t *stats_ptr = &cmd.mem_stats[subsystem];
+    for (int i = 0; i < 2; i++) {
+        if (alloc) {
+            stats_ptr->current += size;
+            stats_ptr->allocs++;
+            if (stats_ptr->current > stats_ptr->peak) {
+                stats_ptr->peak = stats_ptr->current;
+            }
+        } else {
+            stats_ptr->current -= size;
         }
+        stats_ptr = &cmd.mem_stats[CMDLINE_MEM_TOTAL];
     }
-#endif
-#if MBED_CONF_CMDLINE_ENABLE_HISTORY
-    ns_list_foreach_safe(cmd_history_t, cur_ptr, &cmd.history_list) {
-        MEM_FREE(cur_ptr->command_ptr);
-        ns_list_remove(&cmd.history_list, cur_ptr);
-        MEM_FREE(cur_ptr);
-    }
-#endif
-    cmd.mutex_wait_fnc = NULL;
-    cmd.mutex_release_fnc = NULL;
-    cmd.init = false;
 }
 
-void cmd_input_passthrough_func(input_passthrough_func_t passthrough_fnc)
+static void *cmd_mem_alloc(cmd_mem_subsystem_t subsystem, cmd_mem_kind_t kind, size_t size)
 {
-    cmd.passthrough_fnc = passthrough_fnc;
+    cmd_mem_header_t *header_ptr = cmd_mem_alloc_raw(subsystem, kind, CMD_MEM_HEADER_SIZE + size);
+    if (header_ptr == NULL) {
+        cmd.mem_stats[subsystem].failures++;
+        cmd.mem_stats[CMDLINE_MEM_TOTAL].failures++;
+        return NULL;
+    }
+    header_ptr->info.size = size;
+    header_ptr->info.subsystem = subsystem;
+    cmd_mem_account(subsystem, size, true);
+    return header_ptr + 1;
 }
 
-void cmd_exe(char *str)
+static void cmd_mem_free(void *ptr)
 {
-    tr_deep("cmd_exe(): %s", str);
-    if (!cmd.init) {
-        tr_warn("cmd_exe() called without init");
+    if (ptr == NULL) {
         return;
     }
-    cmd_split(str);
-    if (str == cmd.input) {
-        cmd_line_clear(0);
-    }
-
-    if (cmd.cmd_buffer_ptr == 0) {
-        //execution buffer is empty
-        cmd.idle = false; //not really, but fake it
-        cmd_ready(CMDLINE_RETCODE_SUCCESS);
-    } else {
-        tr_debug("previous cmd is still in progress");
-    }
+    cmd_mem_header_t *header_ptr = (cmd_mem_header_t *)ptr - 1;
+    cmd_mem_account((cmd_mem_subsystem_t)header_ptr->info.subsystem, header_ptr->info.size, false);
+    cmd_mem_free_raw(header_ptr);
 }
-
-void cmd_set_ready_cb(cmd_ready_cb_f *cb)
+#else
+static void *cmd_mem_alloc(cmd_mem_subsystem_t subsystem, cmd_mem_kind_t kind, size_t size)
 {
-    cmd.ready_cb = cb;
+    return cmd_mem_alloc_raw(subsystem, kind, size);
 }
 
-void cmd_ready(int retcode)
+static void cmd_mem_free(void *ptr)
 {
-    tr_deep("cmd_ready(): %d", retcode);
-    if (!cmd.init) {
-        tr_warn("cmd_ready() called without init");
+    if (ptr == NULL) {
         return;
     }
-    if (cmd.cmd_ptr && cmd.cmd_ptr->busy) {
-        //execution finished
-        cmd.cmd_ptr->busy = false;
-    }
-    if (!cmd.idle) {
+    cmd_mem_free_raw(ptr);
+}
+#endif
+
+bool cmd_mem_stats(cmd_mem_subsystem_t subsystem, cmd_mem_stats_t *stats)
+{
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    if ((unsigned int)subsystem > CMDLINE_MEM_TOTAL || stats == NULL) {
+        return false;
+    }
+    *stats = cmd.mem_stats[subsystem];
+    return true;
+#else
+    (void)subsystem;
+    (void)stats;
+    return false;
+#endif
+}
+
+void cmd_set_allocator(const cmd_allocator_t *allocator)
+{
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+    (void)allocator;
+    tr_warn("cmd_set_allocator() not supported with static memory");
+#else
+    if (cmd.init) {
+        tr_warn("cmd_set_allocator() called after init");
+        return;
+    }
+    if (allocator && (allocator->alloc == NULL || allocator->free == NULL)) {
+        tr_warn("cmd_set_allocator invalid parameters");
+        return;
+    }
+    if (allocator) {
+        cmd.allocator = *allocator;
+    } else {
+        memset(&cmd.allocator, 0, sizeof(cmd.allocator));
+    }
+#endif
+}
+
+// returns offset of first aligned address in memory region
+static size_t cmd_mem_align_offset(void *mem)
+{
+    uintptr_t addr = (uintptr_t)mem;
+    return CMD_MEM_ALIGN(addr) - addr;
+}
+
+void cmd_arena_init(cmd_arena_t *arena, void *mem, size_t size)
+{
+    size_t offset = cmd_mem_align_offset(mem);
+    arena->mem = (uint8_t *)mem + offset;
+    arena->size = size > offset ? size - offset : 0;
+    cmd_arena_reset(arena);
+}
+
+void cmd_arena_reset(cmd_arena_t *arena)
+{
+    arena->used = 0;
+    arena->last = 0;
+    arena->count = 0;
+}
+
+void *cmd_arena_alloc(void *ctx, size_t size)
+{
+    cmd_arena_t *arena = (cmd_arena_t *)ctx;
+    size_t start = CMD_MEM_ALIGN(arena->used);
+    if (start > arena->size || size > arena->size - start) {
+        tr_warn("arena exhausted, %u bytes requested", (unsigned int)size);
+        return NULL;
+    }
+    arena->last = start;
+    arena->used = start + size;
+    arena->count++;
+    return arena->mem + start;
+}
+
+void cmd_arena_free(void *ctx, void *ptr)
+{
+    cmd_arena_t *arena = (cmd_arena_t *)ctx;
+    if (arena->count == 0) {
+        return;
+    }
+    if (--arena->count == 0) {
+        arena->used = 0;
+    } else if ((uint8_t *)ptr == arena->mem + arena->last) {
+        // latest allocation can be given back
+        arena->used = arena->last;
+    }
+}
+
+static void cmd_pool_setup(cmd_pool_t *pool, void *mem, size_t size, size_t block_size)
+{
+    size_t offset = cmd_mem_align_offset(mem);
+    size_t count = size > offset && block_size ? (size - offset) / block_size : 0;
+    pool->mem = (uint8_t *)mem + offset;
+    pool->size = count * block_size;
+    pool->block_size = block_size;
+    pool->free_count = count;
+    pool->free_list = NULL;
+    // link blocks in address order
+    while (count > 0) {
+        void **block = (void **)(pool->mem + --count * block_size);
+        *block = pool->free_list;
+        pool->free_list = block;
+    }
+}
+
+void cmd_pool_init(cmd_pool_t *pool, void *mem, size_t size, const cmd_allocator_t *fallback)
+{
+    cmd_pool_setup(pool, mem, size, CMD_POOL_BLOCK_SIZE);
+    if (fallback) {
+        pool->fallback = *fallback;
+    } else {
+        memset(&pool->fallback, 0, sizeof(pool->fallback));
+    }
+}
+
+void *cmd_pool_alloc(void *ctx, size_t size)
+{
+    cmd_pool_t *pool = (cmd_pool_t *)ctx;
+    if (size <= pool->block_size && pool->free_list) {
+        void **block = (void **)pool->free_list;
+        pool->free_list = *block;
+        pool->free_count--;
+        return block;
+    }
+    if (pool->fallback.alloc) {
+        return pool->fallback.alloc(pool->fallback.ctx, size);
+    }
+    tr_warn("pool exhausted, %u bytes requested", (unsigned int)size);
+    return NULL;
+}
+
+void cmd_pool_free(void *ctx, void *ptr)
+{
+    cmd_pool_t *pool = (cmd_pool_t *)ctx;
+    uint8_t *block = (uint8_t *)ptr;
+    if (block >= pool->mem && block < pool->mem + pool->size) {
+        *(void **)block = pool->free_list;
+        pool->free_list = block;
+        pool->free_count++;
+    } else if (pool->fallback.free) {
+        pool->fallback.free(pool->fallback.ctx, ptr);
+    }
+}
+
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+/* Static memory profile.
+ * Every subsystem has own pools for list entries and for buffers, which are
+ * carved from one static array. Capacities are fixed at compile time and
+ * running out of them is reported, heap is never used.
+ */
+#define CMD_STATIC_BLOCK(size) (CMD_MEM_HEADER_SIZE + CMD_MEM_ALIGN(size))
+#define CMD_STATIC_VALUE_SIZE  (MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH + 1)
+#define CMD_STATIC_NAME_SIZE   (MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH + 2) // "$name" when replacing variables
+#define CMD_STATIC_LINE_SIZE   CMD_MAX(MBED_CONF_CMDLINE_MAX_LINE_LENGTH, sizeof(char *) * MBED_CONF_CMDLINE_ARGS_MAX_COUNT)
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 1
+// compressed history has own arena, only history command needs a buffer
+#define CMD_STATIC_HISTORY_COUNT 0
+#define CMD_STATIC_HISTORY_BUFFERS 1
+#else
+// history keeps one extra entry for the line being edited, which is allocated before overflow is cleaned
+#define CMD_STATIC_HISTORY_COUNT (MBED_CONF_CMDLINE_HISTORY_MAX_COUNT + 1)
+#define CMD_STATIC_HISTORY_BUFFERS CMD_STATIC_HISTORY_COUNT
+#endif
+// queued commands, parsing, argv and schema argument buffers of running command,
+// and cmd_exe_capture() copy, parsing, argv and schema argument buffers
+#define CMD_STATIC_LINE_COUNT  (MBED_CONF_CMDLINE_STATIC_EXEC_MAX + 7)
+// statistics of commands, which are allocated when command is executed first time
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+#define CMD_STATIC_STATS_COUNT MBED_CONF_CMDLINE_STATIC_COMMANDS_MAX
+#else
+#define CMD_STATIC_STATS_COUNT 0
+#endif
+
+typedef struct cmd_static_pool_cfg_s {
+    size_t size;        // largest allowed allocation
+    size_t count;
+} cmd_static_pool_cfg_t;
+
+static const cmd_static_pool_cfg_t cmd_static_pool_cfg[CMDLINE_MEM_TOTAL][2] = {
+    // CMDLINE_MEM_COMMANDS: descriptor and statistics
+    {{sizeof(cmd_command_t), MBED_CONF_CMDLINE_STATIC_COMMANDS_MAX}, {sizeof(cmd_stats_t), CMD_STATIC_STATS_COUNT}},
+    // CMDLINE_MEM_ALIASES: name and value, "_" alias has own line sized buffer
+    {   {sizeof(cmd_alias_t), MBED_CONF_CMDLINE_STATIC_ALIASES_MAX},
+        {CMD_STATIC_VALUE_SIZE, 2 * MBED_CONF_CMDLINE_STATIC_ALIASES_MAX}
+    },
+    // CMDLINE_MEM_VARIABLES: name, value and one for variable replacing
+    {   {sizeof(cmd_variable_t), MBED_CONF_CMDLINE_STATIC_VARIABLES_MAX},
+        {CMD_STATIC_NAME_SIZE, 2 * MBED_CONF_CMDLINE_STATIC_VARIABLES_MAX + 1}
+    },
+    // CMDLINE_MEM_HISTORY
+    {   {sizeof(cmd_history_t), CMD_STATIC_HISTORY_COUNT},
+        {MBED_CONF_CMDLINE_MAX_LINE_LENGTH, CMD_STATIC_HISTORY_BUFFERS}
+    },
+    // CMDLINE_MEM_EXEC
+    {   {sizeof(cmd_exe_t), MBED_CONF_CMDLINE_STATIC_EXEC_MAX},
+        {CMD_STATIC_LINE_SIZE, CMD_STATIC_LINE_COUNT}
+    }
+};
+
+#define CMD_STATIC_MEM_SIZE ( \
+    CMD_STATIC_BLOCK(sizeof(cmd_command_t)) * MBED_CONF_CMDLINE_STATIC_COMMANDS_MAX + \
+    CMD_STATIC_BLOCK(sizeof(cmd_stats_t)) * CMD_STATIC_STATS_COUNT + \
+    CMD_STATIC_BLOCK(sizeof(cmd_alias_t)) * MBED_CONF_CMDLINE_STATIC_ALIASES_MAX + \
+    CMD_STATIC_BLOCK(CMD_STATIC_VALUE_SIZE) * (2 * MBED_CONF_CMDLINE_STATIC_ALIASES_MAX) + \
+    CMD_STATIC_BLOCK(sizeof(cmd_variable_t)) * MBED_CONF_CMDLINE_STATIC_VARIABLES_MAX + \
+    CMD_STATIC_BLOCK(CMD_STATIC_NAME_SIZE) * (2 * MBED_CONF_CMDLINE_STATIC_VARIABLES_MAX + 1) + \
+    CMD_STATIC_BLOCK(sizeof(cmd_history_t)) * CMD_STATIC_HISTORY_COUNT + \
+    CMD_STATIC_BLOCK(MBED_CONF_CMDLINE_MAX_LINE_LENGTH) * CMD_STATIC_HISTORY_BUFFERS + \
+    CMD_STATIC_BLOCK(sizeof(cmd_exe_t)) * MBED_CONF_CMDLINE_STATIC_EXEC_MAX + \
+    CMD_STATIC_BLOCK(CMD_STATIC_LINE_SIZE) * CMD_STATIC_LINE_COUNT)
+
+static cmd_mem_align_t cmd_static_mem[CMD_STATIC_MEM_SIZE / sizeof(cmd_mem_align_t)];
+static cmd_pool_t cmd_static_pools[CMDLINE_MEM_TOTAL][2];
+static bool cmd_static_ready = false;
+
+static void cmd_static_init(void)
+{
+    uint8_t *mem = (uint8_t *)cmd_static_mem;
+    for (int i = 0; i < CMDLINE_MEM_TOTAL; i++) {
+        for (int kind = CMD_MEM_OBJECT; kind <= CMD_MEM_BUFFER; kind++) {
+            const cmd_static_pool_cfg_t *cfg_ptr = &cmd_static_pool_cfg[i][kind];
+            size_t block_size = cfg_ptr->count ? CMD_STATIC_BLOCK(cfg_ptr->size) : 0;
+            size_t size = block_size * cfg_ptr->count;
+            cmd_pool_setup(&cmd_static_pools[i][kind], mem, size, block_size);
+            memset(&cmd_static_pools[i][kind].fallback, 0, sizeof(cmd_allocator_t));
+            mem += size;
+        }
+    }
+    cmd_static_ready = true;
+}
+
+static void *cmd_static_alloc(cmd_mem_subsystem_t subsystem, cmd_mem_kind_t kind, size_t size)
+{
+    static const char *const names[CMDLINE_MEM_TOTAL] CMDLINE_UNUSED = {
+        "commands", "aliases", "variables", "history", "exec"
+    };
+    if (!cmd_static_ready) {
+        cmd_static_init();
+    }
+    cmd_pool_t *pool = &cmd_static_pools[subsystem][kind];
+    if (size > CMD_MEM_HEADER_SIZE + cmd_static_pool_cfg[subsystem][kind].size) {
+        tr_error("%s: %u bytes exceeds static capacity", names[subsystem], (unsigned int)size);
+        return NULL;
+    }
+    if (pool->free_list == NULL) {
+        tr_error("%s: static storage exhausted", names[subsystem]);
+        return NULL;
+    }
+    return cmd_pool_alloc(pool, size);
+}
+
+static void cmd_static_free(void *ptr)
+{
+    for (int i = 0; i < CMDLINE_MEM_TOTAL; i++) {
+        for (int kind = CMD_MEM_OBJECT; kind <= CMD_MEM_BUFFER; kind++) {
+            cmd_pool_t *pool = &cmd_static_pools[i][kind];
+            if ((uint8_t *)ptr >= pool->mem && (uint8_t *)ptr < pool->mem + pool->size) {
+                cmd_pool_free(pool, ptr);
+                return;
+            }
+        }
+    }
+    tr_error("cmd_static_free: unknown pointer");
+}
+#endif
+
+/* Minimal output formatter used for library's own hot-path output.
+ * Integers, strings and escape sequences are collected to the output buffer
+ * which is written out with cmd_write(), so that printf engine is not needed
+ * to format retcodes, prompt or cursor movements. Buffer is shared and used
+ * only while holding the output mutex, nested use appends to the same output.
+ */
+static void cmd_fmt_flush(void)
+{
+    if (cmd.fmt.len > 0) {
+        int len = cmd.fmt.len;
+        cmd.fmt.len = 0;
+        cmd_write(cmd.fmt.buf, len);
+    }
+}
+
+static void cmd_fmt_putc(char c)
+{
+    if (cmd.fmt.len >= MBED_CMDLINE_FMT_BUFFER_SIZE) {
+        cmd_fmt_flush();
+    }
+    cmd.fmt.buf[cmd.fmt.len++] = c;
+}
+
+static void cmd_fmt_putn(const char *str, int len)
+{
+    if (len > MBED_CMDLINE_FMT_BUFFER_SIZE - cmd.fmt.len) {
+        cmd_fmt_flush();
+        if (len > MBED_CMDLINE_FMT_BUFFER_SIZE) {
+            // too long to be buffered, write it as it is
+            cmd_write(str, len);
+            return;
+        }
+    }
+    memcpy(cmd.fmt.buf + cmd.fmt.len, str, len);
+    cmd.fmt.len += len;
+}
+
+static void cmd_fmt_puts(const char *str)
+{
+    cmd_fmt_putn(str, strlen(str));
+}
+
+static void cmd_fmt_int(int value)
+{
+    char str[MBED_CMDLINE_INT_STR_SIZE];
+    cmd_itoa(value, str);
+    cmd_fmt_puts(str);
+}
+
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+static void cmd_fmt_uint(uint32_t value)
+{
+    char str[MBED_CMDLINE_INT_STR_SIZE];
+    cmd_utoa(value, str);
+    cmd_fmt_puts(str);
+}
+
+/* Streaming JSON-lines writer.
+ * Each record is one JSON object on its own line. Fields are written out
+ * through the output formatter as they are given, nothing is collected in
+ * memory. Whole record is written while holding the output mutex, so records
+ * are never mixed with output from other threads.
+ */
+static void cmd_json_escape(const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run = str;
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        // write characters which doesn't need escaping at once
+        cmd_fmt_putn(run, str - run);
+        run = str + 1;
+        cmd_fmt_putc('\\');
+        switch (c) {
+            case ('"'):
+            case ('\\'):
+                cmd_fmt_putc(c);
+                break;
+            case ('\r'):
+                cmd_fmt_putc('r');
+                break;
+            case ('\n'):
+                cmd_fmt_putc('n');
+                break;
+            case ('\t'):
+                cmd_fmt_putc('t');
+                break;
+            default:
+                cmd_fmt_puts("u00");
+                cmd_fmt_putc(hex[c >> 4]);
+                cmd_fmt_putc(hex[c & 0x0f]);
+                break;
+        }
+    }
+    cmd_fmt_putn(run, str - run);
+}
+
+static void cmd_json_begin(const char *type)
+{
+    cmd_mutex_lock();
+    cmd_fmt_puts("{\"type\":\"");
+    cmd_fmt_puts(type);
+    cmd_fmt_putc('"');
+}
+
+static void cmd_json_key(const char *key)
+{
+    cmd_fmt_puts(",\"");
+    cmd_json_escape(key);
+    cmd_fmt_puts("\":");
+}
+
+static void cmd_json_str(const char *key, const char *value)
+{
+    cmd_json_key(key);
+    if (value == NULL) {
+        cmd_fmt_puts("null");
+        return;
+    }
+    cmd_fmt_putc('"');
+    cmd_json_escape(value);
+    cmd_fmt_putc('"');
+}
+
+static void cmd_json_int(const char *key, int value)
+{
+    cmd_json_key(key);
+    cmd_fmt_int(value);
+}
+
+static void cmd_json_uint(const char *key, uint32_t value)
+{
+    cmd_json_key(key);
+    cmd_fmt_uint(value);
+}
+
+static void cmd_json_end(void)
+{
+    cmd_fmt_puts("}\r\n");
+    cmd_fmt_flush();
+    cmd_mutex_unlock();
+}
+
+static void cmd_json_error(const char *message, const char *name)
+{
+    cmd_json_begin("error");
+    cmd_json_str("message", message);
+    cmd_json_str("cmd", name);
+    cmd_json_end();
+}
+
+static void cmd_json_command(const cmd_command_t *command_ptr, bool man)
+{
+    cmd_json_begin("command");
+    cmd_json_str("name", command_ptr->name_ptr);
+    cmd_json_str("info", command_ptr->info_ptr);
+    if (man) {
+        cmd_json_str("man", command_ptr->man_ptr);
+    }
+    cmd_json_end();
+}
+
+static void cmd_json_result(const char *line, int retcode)
+{
+    cmd_json_begin("result");
+    cmd_json_str("line", line);
+    cmd_json_int("retcode", retcode);
+    if (cmd.clock_fnc) {
+        cmd_json_uint("elapsed", cmd.clock_fnc() - cmd.exec_start);
+    }
+    cmd_json_end();
+}
+#define cmd_json_mode() cmd.json
+#else
+#define cmd_json_mode() false
+#endif
+
+void cmd_set_output_mode(cmd_output_mode_t mode)
+{
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    cmd.json = mode == CMDLINE_OUTPUT_JSON;
+#else
+    if (mode != CMDLINE_OUTPUT_HUMAN) {
+        tr_warn("JSON output not enabled");
+    }
+#endif
+}
+
+cmd_output_mode_t cmd_get_output_mode(void)
+{
+    return cmd_json_mode() ? CMDLINE_OUTPUT_JSON : CMDLINE_OUTPUT_HUMAN;
+}
+
+void cmd_set_clock_func(uint32_t (*clock_f)(void))
+{
+    cmd.clock_fnc = clock_f;
+}
+
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+/* Command statistics.
+ * Statistics are allocated when command is executed first time, so commands
+ * which are never executed cost only the pointer in descriptor. Execution time
+ * is measured from cmd.exec_start, which is taken before cmd_run().
+ */
+static void cmd_stats_clear(cmd_stats_t *stats_ptr)
+{
+    memset(stats_ptr, 0, sizeof(cmd_stats_t));
+    stats_ptr->min_time = UINT32_MAX;
+}
+
+static cmd_stats_t *cmd_stats_get(cmd_command_t *cmd_ptr)
+{
+    cmd_command_internal_t *internal_ptr = CMD_INTERNAL(cmd_ptr);
+    if (internal_ptr->stats_ptr == NULL) {
+        internal_ptr->stats_ptr = (cmd_stats_t *)cmd_mem_alloc(CMDLINE_MEM_COMMANDS, CMD_MEM_BUFFER, sizeof(cmd_stats_t));
+        if (internal_ptr->stats_ptr == NULL) {
+            tr_warn("no memory for statistics of %s", cmd_ptr->name_ptr);
+            return NULL;
+        }
+        cmd_stats_clear(internal_ptr->stats_ptr);
+    }
+    return internal_ptr->stats_ptr;
+}
+
+static void cmd_stats_busy(cmd_command_t *cmd_ptr)
+{
+    cmd_stats_t *stats_ptr = cmd_stats_get(cmd_ptr);
+    if (stats_ptr) {
+        stats_ptr->busy++;
+    }
+}
+
+static void cmd_stats_start(cmd_command_t *cmd_ptr)
+{
+    cmd_stats_t *stats_ptr = cmd_stats_get(cmd_ptr);
+    if (stats_ptr) {
+        stats_ptr->calls++;
+    }
+}
+
+static void cmd_stats_done(cmd_command_t *cmd_ptr, int retcode)
+{
+    cmd_stats_t *stats_ptr = CMD_INTERNAL(cmd_ptr)->stats_ptr;
+    if (stats_ptr == NULL) {
+        return;
+    }
+    if (retcode < 0) {
+        stats_ptr->failures++;
+    }
+    if (cmd.clock_fnc) {
+        uint32_t elapsed = cmd.clock_fnc() - cmd.exec_start;
+        stats_ptr->last_time = elapsed;
+        stats_ptr->total_time += elapsed;
+        if (elapsed < stats_ptr->min_time) {
+            stats_ptr->min_time = elapsed;
+        }
+        if (elapsed > stats_ptr->max_time) {
+            stats_ptr->max_time = elapsed;
+        }
+    }
+}
+#endif
+
+bool cmd_stats(const char *name, cmd_stats_t *stats)
+{
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+    cmd_command_t *cmd_ptr = name ? cmd_find(name) : NULL;
+    if (cmd_ptr == NULL || stats == NULL) {
+        return false;
+    }
+    if (CMD_INTERNAL(cmd_ptr)->stats_ptr) {
+        *stats = *CMD_INTERNAL(cmd_ptr)->stats_ptr;
+        if (stats->min_time == UINT32_MAX) {
+            stats->min_time = 0;
+        }
+    } else {
+        memset(stats, 0, sizeof(cmd_stats_t));
+    }
+    return true;
+#else
+    (void)name;
+    (void)stats;
+    return false;
+#endif
+}
+
+void cmd_stats_reset(const char *name)
+{
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+    ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
+        if (CMD_INTERNAL(cur_ptr)->stats_ptr && (name == NULL || strcmp(name, cur_ptr->name_ptr) == 0)) {
+            cmd_stats_clear(CMD_INTERNAL(cur_ptr)->stats_ptr);
+        }
+    }
+#else
+    (void)name;
+#endif
+}
+
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+/* Trace ring.
+ * Events are written to a power of two ring with a few stores, without
+ * formatting anything, so the ring can be enabled while profiling.
+ */
+static void cmd_trace_event(cmd_trace_event_t event, uint16_t arg)
+{
+    if (cmd.trace_paused) {
+        return;
+    }
+    cmd_trace_record_t *record_ptr = &cmd.trace[cmd.trace_count++ & (MBED_CONF_CMDLINE_TRACE_RING_SIZE - 1)];
+    record_ptr->time = cmd.clock_fnc ? cmd.clock_fnc() : 0;
+    record_ptr->event = event;
+    record_ptr->arg = arg;
+}
+#endif
+
+size_t cmd_trace_read(cmd_trace_record_t *records, size_t count, uint32_t *dropped)
+{
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+    uint32_t total = cmd.trace_count;
+    uint32_t first = total > MBED_CONF_CMDLINE_TRACE_RING_SIZE ? total - MBED_CONF_CMDLINE_TRACE_RING_SIZE : 0;
+    size_t n = 0;
+    if (dropped) {
+        *dropped = first;
+    }
+    for (uint32_t i = first; i != total && n < count; i++) {
+        records[n++] = cmd.trace[i & (MBED_CONF_CMDLINE_TRACE_RING_SIZE - 1)];
+    }
+    return n;
+#else
+    (void)records;
+    (void)count;
+    if (dropped) {
+        *dropped = 0;
+    }
+    return 0;
+#endif
+}
+
+void cmd_trace_clear(void)
+{
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+    cmd.trace_count = 0;
+#endif
+}
+
+void cmd_emit_kv(const char *key, const char *value)
+{
+    if (key == NULL) {
+        tr_warn("cmd_emit_kv invalid parameters");
+        return;
+    }
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    if (cmd.json) {
+        cmd_json_begin("kv");
+        if (!cmd.idle && cmd.cmd_ptr) {
+            cmd_json_str("cmd", cmd.cmd_ptr->name_ptr);
+        }
+        cmd_json_str("key", key);
+        cmd_json_str("value", value);
+        cmd_json_end();
+        return;
+    }
+#endif
+    cmd_mutex_lock();
+    cmd_fmt_puts(key);
+    cmd_fmt_puts(": ");
+    cmd_fmt_puts(value ? value : "");
+    cmd_fmt_puts("\r\n");
+    cmd_fmt_flush();
+    cmd_mutex_unlock();
+}
+
+void cmd_emit_kv_int(const char *key, int32_t value)
+{
+    if (key == NULL) {
+        tr_warn("cmd_emit_kv_int invalid parameters");
+        return;
+    }
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    if (cmd.json) {
+        cmd_json_begin("kv");
+        if (!cmd.idle && cmd.cmd_ptr) {
+            cmd_json_str("cmd", cmd.cmd_ptr->name_ptr);
+        }
+        cmd_json_str("key", key);
+        cmd_json_int("value", value);
+        cmd_json_end();
+        return;
+    }
+#endif
+    cmd_mutex_lock();
+    cmd_fmt_puts(key);
+    cmd_fmt_puts(": ");
+    cmd_fmt_int(value);
+    cmd_fmt_puts("\r\n");
+    cmd_fmt_flush();
+    cmd_mutex_unlock();
+}
+/* Function definitions
+ */
+void cmd_init(cmd_print_t *outf)
+{
+    if (!cmd.init) {
+#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
+        ns_list_init(&cmd.alias_list);
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1 && MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 0
+        ns_list_init(&cmd.history_list);
+#endif
+#if CMD_HISTORY_ERASE_DUPS == 1
+        memset(cmd.history_hash, 0, sizeof(cmd.history_hash));
+#endif
+        ns_list_init(&cmd.command_list);
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+        ns_list_init(&cmd.variable_list);
+#endif
+        ns_list_init(&cmd.cmd_buffer);
+        cmd.init = true;
+    }
+    cmd.out = outf ? outf : default_cmd_response_out;
+    cmd.write = NULL;
+    cmd.ctrl_fnc = NULL;
+    cmd.echo = MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE == 0;
+    cmd.insert = true;
+    cmd.cursor = 0;
+    cmd.prev_cr = false;
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+    cmd.escaping = false;
+    cmd.vt100_on = MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE == 0;
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY
+    cmd.history_max_count = MBED_CONF_CMDLINE_HISTORY_MAX_COUNT;
+    cmd.history_loaded = false;
+    cmd.history_log_count = 0;
+    cmd.history_compact = -1;
+#endif
+#if CMD_HISTORY_SEARCH == 1
+    cmd.search.active = false;
+    cmd.search.pattern[0] = 0;
+#endif
+    cmd.tab_lookup = 0;
+    cmd.tab_lookup_cmd_n = 0;
+    cmd.tab_lookup_n = 0;
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+    cmd.complete_n = -1;
+#endif
+    cmd.cmd_buffer_ptr = 0;
+    cmd.idle = true;
+    cmd_mutex_lock();
+    cmd.event_head = 0;
+    cmd.event_count = 0;
+    cmd.event_loop = false;
+    cmd.capture_ptr = NULL;
+    cmd.abandoned_count = 0;
+    cmd_mutex_unlock();
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+    cmd.trace_count = 0;
+    cmd.trace_paused = false;
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    cmd.json = false;
+#endif
+    cmd.ready_cb = cmd_next;
+    cmd.passthrough_fnc = NULL;
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 1
+    cmd_variable_add(VAR_PROMPT, DEFAULT_PROMPT);
+    cmd_variable_add_int(VAR_RETCODE, 0);
+    //cmd_alias_add("auto-on", "set PS1=\r\nretcode=$?\r\n&&echo off");
+    //cmd_alias_add("auto-off", "set PS1="DEFAULT_PROMPT"&&echo on");
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY
+    cmd_history_save(0);          // the current line is the 0 item
+#endif
+    cmd_line_clear(0);            // clear line
+    cmd_init_base_commands();
+    cmd_init_screen();
+    return;
+}
+void cmd_request_screen_size(void)
+{
+    cmd_printf(REQUEST_SCREEN_SIZE);
+}
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 0
+#define cmdline_get_prompt() DEFAULT_PROMPT
+#else
+const char *cmdline_get_prompt(void)
+{
+    cmd_variable_t *var_ptr = cmd_special_var(CMD_VAR_PROMPT);
+    const char *str = var_ptr ? cmd_variable_str(var_ptr) : NULL;
+    return str ? str : "";
+}
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 0
+#define cmd_get_retfmt() MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE ? DEFAULT_RETFMT : 0
+#else
+const char *cmd_get_retfmt(void)
+{
+    cmd_variable_t *var_ptr = cmd_special_var(CMD_VAR_RETFMT);
+    return var_ptr ? cmd_variable_str(var_ptr) : 0;
+}
+#endif
+
+#if MBED_CONF_CMDLINE_INCLUDE_MAN == 1
+#define MAN_ECHO    "Displays messages, or turns command echoing on or off\r\n"\
+                    "echo <data_to_be_print>\r\n"\
+                    "some special parameters:\r\n"\
+                    "<bool>                 On/Off echo input characters\r\n"
+#define MAN_ALIAS   "alias <theAlias> <command (parameters)>\r\n"
+#define MAN_UNSET   "unset <var_name>\r\n"
+#define MAN_SET     "set <var_name> <value>\r\n"\
+                    "some special parameters\r\n"\
+                    "--vt100 <bool>         On/Off vt100 controls\r\n"\
+                    "--retcode <bool>       On/Off retcode print after execution\r\n"\
+                    "--retfmt <format>      Return print format. Default: \"retcode: %i\\n\"\r\n"
+
+#define MAN_CLEAR   "Clears the display"
+#define MAN_HISTORY "Show commands history\r\n"\
+                    "history (<optio>)\r\n"\
+                    "clear                  Clear history\r\n"
+#define MAN_MEMINFO "Show memory usage of command line\r\n"\
+                    "current and peak bytes, allocation and failure counts per subsystem\r\n"
+#define MAN_STATS   "Show execution statistics of commands\r\n"\
+                    "stats (<option>)\r\n"\
+                    "reset (<command>)      Reset statistics of all or one command\r\n"
+#define MAN_TRACE   "Export interpreter trace ring, decode with tools/cli_trace.py\r\n"\
+                    "trace (<option>)\r\n"\
+                    "clear                  Clear trace ring\r\n"
+#else
+#define MAN_ECHO    NULL
+#define MAN_ALIAS   NULL
+#define MAN_SET     NULL
+#define MAN_UNSET   NULL
+#define MAN_CLEAR   NULL
+#define MAN_HISTORY NULL
+#define MAN_MEMINFO NULL
+#define MAN_STATS   NULL
+#define MAN_TRACE   NULL
+#endif
+
+static void cmd_init_base_commands(void)
+{
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 1
+    cmd_add("set",      set_command,      "print or set variables", MAN_SET);
+    cmd_add("unset",    unset_command,    "unset variables",      MAN_UNSET);
+#endif
+    cmd_add("help",     help_command,     "This help",            NULL);
+    cmd_add("echo",     echo_command,     "Echo controlling",     MAN_ECHO);
+#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
+    cmd_add("alias",    alias_command,    "Handle aliases",       MAN_ALIAS);
+#endif
+    cmd_add("clear",    clear_command,    "Clears the display",   MAN_CLEAR);
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1
+    cmd_add("history",  history_command,  "View your command Line History", MAN_HISTORY);
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    cmd_add("meminfo",  meminfo_command,  "Show memory usage",    MAN_MEMINFO);
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+    cmd_add("stats",    stats_command,    "Show command statistics", MAN_STATS);
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+    cmd_add("trace",    trace_command,    "Export trace ring",    MAN_TRACE);
+#endif
+    cmd_add("true",     true_command, 0, 0);
+    cmd_add("false",    false_command, 0, 0);
+#elif MBED_CONF_CMDLINE_USE_DUMMY_SET_ECHO_COMMANDS == 1
+    cmd_add("set", set_command, 0, 0);
+    cmd_add("echo", echo_command, 0, 0);
+#endif
+}
+
+void cmd_reset(void)
+{
+    cmd_free();
+    cmd_init_base_commands();
+}
+
+void cmd_free(void)
+{
+    if (!cmd.init) {
+        tr_warn("cmd_free() called without init");
+        return;
+    }
+    ns_list_foreach_safe(cmd_command_t, cur_ptr, &cmd.command_list) {
+        cmd_delete(cur_ptr->name_ptr);
+    }
+#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
+    ns_list_foreach_safe(cmd_alias_t, cur_ptr, &cmd.alias_list) {
+        cmd_alias_add(cur_ptr->name_ptr, NULL);
+    }
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+    ns_list_foreach_safe(cmd_variable_t, cur_ptr, &cmd.variable_list) {
+        cmd_variable_add(cur_ptr->name_ptr, NULL);
+    }
+#endif
+    ns_list_foreach_safe(cmd_exe_t, cur_ptr, &cmd.cmd_buffer) {
+        ns_list_remove(&cmd.cmd_buffer, cur_ptr);
+        cmd_mem_free(cur_ptr->cmd_s);
+        cmd_mem_free(cur_ptr);
+    }
+    cmd.cmd_buffer_ptr = NULL;
+    cmd.cmd_ptr = NULL;
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY
+    cmd_history_clean();
+#endif
+    // pending completions belong to the freed commands
+    cmd_mutex_lock();
+    cmd.event_head = 0;
+    cmd.event_count = 0;
+    cmd_mutex_unlock();
+    cmd.mutex_wait_fnc = NULL;
+    cmd.mutex_release_fnc = NULL;
+    cmd.thread_id_fnc = NULL;
+    cmd.init = false;
+}
+
+void cmd_input_passthrough_func(input_passthrough_func_t passthrough_fnc)
+{
+    cmd.passthrough_fnc = passthrough_fnc;
+}
+
+void cmd_exe(char *str)
+{
+    tr_deep("cmd_exe(): %s", str);
+    if (!cmd.init) {
+        tr_warn("cmd_exe() called without init");
+        return;
+    }
+    cmd_split(str);
+    if (str == cmd.input) {
+        cmd_line_clear(0);
+    }
+
+    if (cmd.cmd_buffer_ptr == 0) {
+        //execution buffer is empty
+        cmd.idle = false; //not really, but fake it
+        cmd_event_post(CMD_EVENT_READY, CMDLINE_RETCODE_SUCCESS);
+    } else {
+        tr_debug("previous cmd is still in progress");
+    }
+}
+
+int cmd_exe_capture(const char *line, char *buf, size_t cap, int *retcode)
+{
+    cmd_capture_t capture;
+    int ret = CMDLINE_RETCODE_SUCCESS;
+    if (!cmd.init) {
+        tr_warn("cmd_exe_capture() called without init");
+        return -1;
+    }
+    if (line == NULL || (buf == NULL && cap > 0) ||
+            strlen(line) >= MBED_CONF_CMDLINE_MAX_LINE_LENGTH) {
+        tr_warn("cmd_exe_capture invalid parameters");
+        return -1;
+    }
+    if (cmd.mutex_wait_fnc && cmd.thread_id_fnc == NULL) {
+        // output and completions of other threads could not be told apart
+        tr_warn("cmd_exe_capture() needs cmd_thread_id_func() with output mutex");
+        return -1;
+    }
+    // aliases are replaced in place, reserve room for whole line
+    char *str = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, MBED_CONF_CMDLINE_MAX_LINE_LENGTH);
+    if (str == NULL) {
+        tr_error("mem alloc failed in cmd_exe_capture");
+        return -1;
+    }
+    strcpy(str, line);
+#if MBED_CONF_CMDLINE_ENABLE_BOUNDED_STACK == 1
+    // running command might still use its arguments after this returns
+    char **argv = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, sizeof(cmd.argv));
+    if (argv == NULL) {
+        cmd_mem_free(str);
+        tr_error("mem alloc failed in cmd_exe_capture argv");
+        return -1;
+    }
+    memcpy(argv, cmd.argv, sizeof(cmd.argv));
+#endif
+    capture.buf = buf;
+    capture.cap = cap;
+    capture.len = 0;
+    capture.retcode = CMDLINE_RETCODE_SUCCESS;
+    capture.running = false;
+    capture.thread_id = cmd.thread_id_fnc ? cmd.thread_id_fnc() : 0;
+    if (cap > 0) {
+        buf[0] = 0;
+    }
+
+    // mutex is held only while interpreter state is switched, a command
+    // callback may wait for another thread which prints
+    cmd_mutex_lock();
+    cmd_capture_t *capture_ptr = cmd.capture_ptr;
+    cmd_list_t cmd_buffer = cmd.cmd_buffer;
+    cmd_exe_t *cmd_buffer_ptr = cmd.cmd_buffer_ptr;
+    cmd_command_t *cmd_ptr = cmd.cmd_ptr;
+    cmd_options_t options = cmd.options;
+    uint32_t exec_start = cmd.exec_start;
+    cmd.capture_ptr = &capture;
+    ns_list_init(&cmd.cmd_buffer);
+    cmd.cmd_buffer_ptr = NULL;
+    cmd_mutex_unlock();
+
+    cmd_split(str);
+    cmd_mem_free(str);
+    while ((cmd.cmd_buffer_ptr = cmd_next_ptr(ret)) != NULL) {
+        capture.done = false;
+        capture.started = false;
+        cmd.cmd_ptr = NULL;
+        cmd.exec_start = cmd.clock_fnc ? cmd.clock_fnc() : 0;
+        capture.running = true;
+        ret = cmd_run(cmd.cmd_buffer_ptr->cmd_s);
+        capture.running = false;
+        if (capture.done && ret != CMDLINE_RETCODE_EXCUTING_CONTINUE) {
+            // command completed synchronously, so the completion belongs to
+            // someone else and is queued until capture is ready
+            capture.done = false;
+            cmd_event_post(CMD_EVENT_READY, capture.retcode);
+        }
+        if (!capture.started) {
+            // not executed, e.g. busy or help, busy flag belongs to the running command
+            continue;
+        }
+        if (ret == CMDLINE_RETCODE_EXCUTING_CONTINUE && !capture.done) {
+            // completes after capture, command stays busy and its cmd_ready() is dropped
+            cmd_mutex_lock();
+            CMD_INTERNAL(cmd.cmd_ptr)->abandoned = true;
+            cmd.abandoned_count++;
+            cmd_mutex_unlock();
+            if (cmd.cmd_buffer_ptr->operator != OPERATOR_BACKGROUND) {
+                // cannot wait for completion, rest of the line is not executed
+                break;
+            }
+            ret = CMDLINE_RETCODE_SUCCESS;
+        } else {
+            if (ret == CMDLINE_RETCODE_EXCUTING_CONTINUE) {
+                ret = capture.retcode;
+            }
+            CMD_INTERNAL(cmd.cmd_ptr)->busy = false;
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+            cmd_stats_done(cmd.cmd_ptr, ret);
+#endif
+        }
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd.json) {
+            cmd_json_result(cmd.cmd_buffer_ptr->cmd_s, ret);
+        }
+#endif
+    }
+    ns_list_foreach_safe(cmd_exe_t, cur_ptr, &cmd.cmd_buffer) {
+        ns_list_remove(&cmd.cmd_buffer, cur_ptr);
+        cmd_mem_free(cur_ptr->cmd_s);
+        cmd_mem_free(cur_ptr);
+    }
+
+    // list head is restored to its original address, so links stay valid
+    cmd_mutex_lock();
+    cmd.cmd_buffer = cmd_buffer;
+    cmd.cmd_buffer_ptr = cmd_buffer_ptr;
+    cmd.cmd_ptr = cmd_ptr;
+    cmd.options = options;
+    cmd.exec_start = exec_start;
+    cmd.capture_ptr = capture_ptr;
+    cmd_mutex_unlock();
+    // completions of other contexts posted during capture
+    cmd_event_run();
+#if MBED_CONF_CMDLINE_ENABLE_BOUNDED_STACK == 1
+    memcpy(cmd.argv, argv, sizeof(cmd.argv));
+    cmd_mem_free(argv);
+#endif
+    if (retcode) {
+        *retcode = ret;
+    }
+    return (int)capture.len;
+}
+
+void cmd_set_ready_cb(cmd_ready_cb_f *cb)
+{
+    cmd.ready_cb = cb;
+}
+
+void cmd_ready(int retcode)
+{
+    tr_deep("cmd_ready(): %d", retcode);
+    if (!cmd.init) {
+        tr_warn("cmd_ready() called without init");
+        return;
+    }
+    if (cmd_abandoned_ready(retcode)) {
+        return;
+    }
+    cmd_event_post(CMD_EVENT_READY, retcode);
+}
+
+/* Commands which were still running when cmd_exe_capture() returned stay busy,
+ * and the next cmd_ready() given outside of captured execution is taken as
+ * their completion. It would otherwise complete the command which was
+ * running when cmd_exe_capture() was called.
+ */
+static bool cmd_abandoned_ready(int retcode)
+{
+    (void)retcode;
+    cmd_mutex_lock();
+    if (cmd.abandoned_count == 0 ||
+            (cmd_capture_owner() && cmd.capture_ptr->running && !cmd.capture_ptr->done)) {
+        cmd_mutex_unlock();
+        return false;
+    }
+    cmd.abandoned_count--;
+    ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
+        if (CMD_INTERNAL(cur_ptr)->abandoned) {
+            CMD_INTERNAL(cur_ptr)->abandoned = false;
+            CMD_INTERNAL(cur_ptr)->busy = false;
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+            cmd_stats_done(cur_ptr, retcode);
+#endif
+            tr_debug("cmd '%s' completed after capture with retcode: %i", cur_ptr->name_ptr, retcode);
+            break;
+        }
+    }
+    cmd_mutex_unlock();
+    return true;
+}
+
+static void cmd_ready_step(int retcode)
+{
+    if (cmd.cmd_ptr && CMD_INTERNAL(cmd.cmd_ptr)->busy) {
+        //execution finished
+        CMD_INTERNAL(cmd.cmd_ptr)->busy = false;
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+        if (retcode != CMDLINE_RETCODE_COMMAND_BUSY) {
+            cmd_stats_done(cmd.cmd_ptr, retcode);
+        }
+#endif
+    }
+    if (!cmd.idle) {
         if (cmd.cmd_buffer_ptr == NULL) {
             tr_debug("goto next command");
         } else {
             tr_debug("cmd '%s' executed with retcode: %i", cmd.cmd_buffer_ptr->cmd_s, retcode);
+            CMD_TRACE(CMDLINE_TRACE_READY, retcode);
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+            if (cmd.json) {
+                cmd_json_result(cmd.cmd_buffer_ptr->cmd_s, retcode);
+            }
+#endif
         }
         if (cmd.ready_cb == NULL) {
             tr_warn("Missing ready_cb! use cmd_set_ready_cb()");
@@ -681,30 +2144,133 @@ void cmd_next(int retcode)
         return;
     }
     tr_deep("cmd_next()");
+    cmd_event_post(CMD_EVENT_NEXT, retcode);
+}
+
+/* Completion events.
+ * cmd_ready() and cmd_next() only queue an event. Whoever posts the first event
+ * runs the loop, which drains events until the queue is empty. Completions of
+ * synchronously executed commands (cmd_next -> cmd_run -> cmd_ready -> ready_cb
+ * -> cmd_next) are thus handled iteratively, and completions posted from other
+ * contexts while the loop runs are handled by the loop instead of re-entering.
+ * Queue is protected with the output mutex functions when those are configured.
+ * Last slot is reserved for cmd_ready(), because a lost completion would leave
+ * the interpreter busy for good. When queue is full there is thus always a
+ * pending READY event, and a further cmd_ready() updates its retcode.
+ * When queue is empty and interpreter is idle, the loop runs idle steps, which
+ * do background work like history log compaction in small pieces.
+ */
+static void cmd_event_post(cmd_event_type_t type, int retcode)
+{
+    cmd_mutex_lock();
+    if (type == CMD_EVENT_READY && cmd_capture_owner() &&
+            cmd.capture_ptr->running && !cmd.capture_ptr->done) {
+        // command under cmd_exe_capture() completed during its execution
+        cmd.capture_ptr->retcode = retcode;
+        cmd.capture_ptr->done = true;
+        cmd_mutex_unlock();
+        return;
+    }
+    if (type == CMD_EVENT_NEXT && cmd.event_count >= MBED_CMDLINE_EVENT_QUEUE_SIZE - 1) {
+        cmd_mutex_unlock();
+        tr_error("event queue full, cmd_next(%d) dropped", retcode);
+        return;
+    }
+    if (cmd.event_count == MBED_CMDLINE_EVENT_QUEUE_SIZE) {
+        // coalesce to the latest pending READY
+        for (int i = MBED_CMDLINE_EVENT_QUEUE_SIZE - 1; i >= 0; i--) {
+            cmd_event_t *event_ptr = &cmd.events[(cmd.event_head + i) % MBED_CMDLINE_EVENT_QUEUE_SIZE];
+            if (event_ptr->type == CMD_EVENT_READY) {
+                event_ptr->retcode = retcode;
+                break;
+            }
+        }
+        cmd_mutex_unlock();
+        tr_warn("event queue full, cmd_ready(%d) coalesced", retcode);
+        return;
+    }
+    cmd_event_t *event_ptr = &cmd.events[(cmd.event_head + cmd.event_count) % MBED_CMDLINE_EVENT_QUEUE_SIZE];
+    event_ptr->type = type;
+    event_ptr->retcode = retcode;
+    cmd.event_count++;
+    cmd_mutex_unlock();
+    cmd_event_run();
+}
+
+static void cmd_event_run(void)
+{
+    cmd_mutex_lock();
+    if (cmd.event_loop || cmd.capture_ptr || cmd.event_count == 0) {
+        // running loop or cmd_exe_capture() handles events when it is ready
+        cmd_mutex_unlock();
+        return;
+    }
+    cmd.event_loop = true;
+    cmd_mutex_unlock();
+
+    cmd_event_t event;
+    for (;;) {
+        cmd_mutex_lock();
+        if (cmd.event_count == 0) {
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY
+            if (cmd.idle) {
+                // idle step, loop continues while there is work and no events
+                cmd_mutex_unlock();
+                if (cmd_history_log_compact()) {
+                    continue;
+                }
+                cmd_mutex_lock();
+                if (cmd.event_count) {
+                    cmd_mutex_unlock();
+                    continue;
+                }
+            }
+#endif
+            cmd.event_loop = false;
+            cmd_mutex_unlock();
+            break;
+        }
+        event = cmd.events[cmd.event_head];
+        cmd.event_head = (cmd.event_head + 1) % MBED_CMDLINE_EVENT_QUEUE_SIZE;
+        cmd.event_count--;
+        cmd_mutex_unlock();
+
+        if (event.type == CMD_EVENT_READY) {
+            cmd_ready_step(event.retcode);
+        } else {
+            cmd_next_step(event.retcode);
+        }
+    }
+}
+
+static void cmd_next_step(int retcode)
+{
     cmd.idle = true;
     //figure out next command
     cmd.cmd_buffer_ptr = cmd_next_ptr(retcode);
     if (cmd.cmd_buffer_ptr) {
         cmd.idle = false;
+        cmd.exec_start = cmd.clock_fnc ? cmd.clock_fnc() : 0;
         //yep there was some -> lets execute it
         retcode = cmd_run(cmd.cmd_buffer_ptr->cmd_s);
         //check if execution goes to the backend or not
         if (retcode == CMDLINE_RETCODE_EXCUTING_CONTINUE) {
             if ((NULL != cmd.cmd_buffer_ptr) && cmd.cmd_buffer_ptr->operator == OPERATOR_BACKGROUND) {
                 //execution continue in background, but operator say that it's "ready"
-                cmd_ready(CMDLINE_RETCODE_SUCCESS);
+                cmd_event_post(CMD_EVENT_READY, CMDLINE_RETCODE_SUCCESS);
             } else {
                 //command execution phase continuous in background
                 tr_debug("Command execution continuous in background..");
             }
         } else {
             //execution finished -> call ready function with retcode
-            cmd_ready(retcode);
+            cmd_event_post(CMD_EVENT_READY, retcode);
         }
     } else {
-        const char *retfmt = cmd_get_retfmt();
+        // in JSON mode retcode is part of the result record
+        const char *retfmt = cmd_json_mode() ? NULL : cmd_get_retfmt();
         if (retfmt) {
-            cmd_printf(retfmt, retcode);
+            cmd_print_retcode(retfmt, retcode);
         }
         if (cmd.echo) {
             cmd_output();    //ready
@@ -721,9 +2287,9 @@ static cmd_exe_t *cmd_pop(void)
         //was first in bool
         next_cmd = ns_list_get_first(&cmd.cmd_buffer);
     } else {
-        MEM_FREE(cmd_ptr->cmd_s);
+        cmd_mem_free(cmd_ptr->cmd_s);
         ns_list_remove(&cmd.cmd_buffer, cmd_ptr);
-        MEM_FREE(cmd_ptr);
+        cmd_mem_free(cmd_ptr);
     }
     return next_cmd;
 }
@@ -781,29 +2347,39 @@ static void cmd_split(char *string_ptr)
 {
     char *ptr = string_ptr, *next;
     operator_t oper = OPERATOR_SEMI_COLON;
+    uint16_t count = 0;
     do {
         cmd_replace_alias(ptr);
         next = next_command(ptr, &oper);
         cmd_push(ptr, oper);
+        count++;
         ptr = next;
         if (next && !*next) {
             break;
         }
     } while (ptr != 0);
+    CMD_TRACE(CMDLINE_TRACE_SPLIT, count);
+    (void)count;
 }
 
 static void cmd_push(char *cmd_str, operator_t oper)
 {
     //store this command to the stack
-    cmd_exe_t *cmd_ptr = MEM_ALLOC(sizeof(cmd_exe_t));
+    cmd_exe_t *cmd_ptr = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_OBJECT, sizeof(cmd_exe_t));
     if (cmd_ptr == NULL) {
         tr_error("mem alloc failed in cmd_push");
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+        cmd_printf("Command queue full, dropped: %s\r\n", cmd_str);
+#endif
         return;
     }
-    cmd_ptr->cmd_s = MEM_ALLOC(strlen(cmd_str) + 1);
+    cmd_ptr->cmd_s = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, strlen(cmd_str) + 1);
     if (cmd_ptr->cmd_s == NULL) {
-        MEM_FREE(cmd_ptr);
+        cmd_mem_free(cmd_ptr);
         tr_error("mem alloc failed in cmd_push cmd_s");
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+        cmd_printf("Command queue full, dropped: %s\r\n", cmd_str);
+#endif
         return;
     }
     strcpy(cmd_ptr->cmd_s, cmd_str);
@@ -817,6 +2393,11 @@ void cmd_out_func(cmd_print_t *outf)
     cmd.out = outf;
 }
 
+void cmd_out_write_func(cmd_write_t *writef)
+{
+    cmd.write = writef;
+}
+
 void cmd_ctrl_func(void (*sohf)(uint8_t c))
 {
     cmd.ctrl_fnc = sohf;
@@ -832,6 +2413,11 @@ void cmd_mutex_release_func(void (*mutex_release_f)(void))
     cmd.mutex_release_fnc = mutex_release_f;
 }
 
+void cmd_thread_id_func(uintptr_t (*thread_id_f)(void))
+{
+    cmd.thread_id_fnc = thread_id_f;
+}
+
 void cmd_mutex_lock(void)
 {
     if (cmd.mutex_wait_fnc) {
@@ -862,6 +2448,13 @@ uint8_t cmd_history_size(uint8_t max)
 {
 #if MBED_CONF_CMDLINE_ENABLE_HISTORY
     if (max > 0) {
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1 && MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 0
+        // compressed history is limited only by its arena
+        if (max > MBED_CONF_CMDLINE_HISTORY_MAX_COUNT) {
+            tr_warn("history size limited to %u", (unsigned int)MBED_CONF_CMDLINE_HISTORY_MAX_COUNT);
+            max = MBED_CONF_CMDLINE_HISTORY_MAX_COUNT;
+        }
+#endif
         cmd.history_max_count = max;
         cmd_history_clean_overflow();
     }
@@ -872,6 +2465,22 @@ uint8_t cmd_history_size(uint8_t max)
 #endif
 }
 
+void cmd_history_set_store(const cmd_history_store_t *store)
+{
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY
+    if (store) {
+        cmd.history_store = *store;
+    } else {
+        memset(&cmd.history_store, 0, sizeof(cmd_history_store_t));
+    }
+    cmd.history_loaded = false;
+    cmd.history_log_count = 0;
+    cmd.history_compact = -1;
+#else
+    (void)store;
+#endif
+}
+
 static void cmd_echo(bool on)
 {
     cmd.echo = on;
@@ -882,6 +2491,107 @@ bool cmd_echo_state(void)
     return cmd.echo;
 }
 
+#if MBED_CONF_CMDLINE_ENABLE_SUGGESTIONS == 1
+/* Suggestions.
+ * Commands within a small Damerau-Levenshtein (optimal string alignment) distance
+ * are suggested. Most commands are skipped by length difference and by character
+ * classes of the name, which are indexed when command is added. Distance is
+ * computed only after common prefix and suffix, and stops when the limit is exceeded.
+ */
+static int cmd_suggest_distance(const char *a, int alen, const char *b, int blen, int max)
+{
+    while (alen > 0 && blen > 0 && *a == *b) {
+        a++;
+        b++;
+        alen--;
+        blen--;
+    }
+    while (alen > 0 && blen > 0 && a[alen - 1] == b[blen - 1]) {
+        alen--;
+        blen--;
+    }
+    if (alen == 0 || blen == 0) {
+        return alen + blen;
+    }
+    // rows of previous two and current characters of a
+    uint8_t rows[3][MBED_CMDLINE_SUGGEST_MAX_LENGTH + 3];
+    uint8_t *prev2 = rows[0], *prev = rows[1], *cur = rows[2];
+    for (int j = 0; j <= blen; j++) {
+        prev[j] = j;
+    }
+    for (int i = 1; i <= alen; i++) {
+        int row_min = cur[0] = i;
+        for (int j = 1; j <= blen; j++) {
+            int value = prev[j - 1] + (a[i - 1] != b[j - 1]);
+            if (prev[j] + 1 < value) {
+                value = prev[j] + 1;
+            }
+            if (cur[j - 1] + 1 < value) {
+                value = cur[j - 1] + 1;
+            }
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] && prev2[j - 2] + 1 < value) {
+                value = prev2[j - 2] + 1;
+            }
+            cur[j] = value;
+            if (value < row_min) {
+                row_min = value;
+            }
+        }
+        if (row_min > max) {
+            return max + 1;
+        }
+        uint8_t *tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    return prev[blen];
+}
+
+static void cmd_suggest(const char *name)
+{
+    const char *found[MBED_CMDLINE_SUGGEST_COUNT];
+    int count = 0;
+    int len = strlen(name);
+    if (len == 0 || len > MBED_CMDLINE_SUGGEST_MAX_LENGTH) {
+        return;
+    }
+    int max = len <= 4 ? 1 : 2;
+    uint32_t sig = cmd_str_sig(name);
+    ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
+        int diff = len - CMD_INTERNAL(cur_ptr)->name_len;
+        if (diff > max || diff < -max) {
+            continue;
+        }
+        int classes = 0;
+        for (uint32_t bits = sig ^ CMD_INTERNAL(cur_ptr)->name_sig; bits; bits &= bits - 1) {
+            classes++;
+        }
+        if ((classes + 1) / 2 > max) {
+            continue;
+        }
+        int distance = cmd_suggest_distance(name, len, cur_ptr->name_ptr, CMD_INTERNAL(cur_ptr)->name_len, max);
+        if (distance > max) {
+            continue;
+        }
+        if (distance < max) {
+            // only the closest ones are suggested
+            max = distance;
+            count = 0;
+        }
+        if (count < MBED_CMDLINE_SUGGEST_COUNT) {
+            found[count++] = cur_ptr->name_ptr;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        cmd_printf("%s%s", i ? ", " : "Did you mean: ", found[i]);
+    }
+    if (count > 0) {
+        cmd_printf("?\r\n");
+    }
+}
+#endif
+
 static cmd_command_t *cmd_find_n(char *name, int nameLength, int n)
 {
     cmd_command_t *cmd_ptr = NULL;
@@ -930,6 +2640,25 @@ static char *cmd_input_lookup_var(char *name, int namelength, int n)
     return str;
 }
 
+// set of (c & 31) character classes in str, one edit changes at most two of them
+static uint32_t cmd_str_sig(const char *str)
+{
+    uint32_t sig = 0;
+    while (*str) {
+        sig |= 1UL << (*str++ & 31);
+    }
+    return sig;
+}
+
+static uint32_t cmd_str_hash(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
 static cmd_command_t *cmd_find(const char *name)
 {
     cmd_command_t *cmd_ptr = NULL;
@@ -955,25 +2684,39 @@ void cmd_add(const char *name, cmd_run_cb *callback, const char *info, const cha
         tr_warn("cmd_add invalid parameters");
         return;
     }
-    cmd_ptr = (cmd_command_t *)MEM_ALLOC(sizeof(cmd_command_t));
+    cmd_ptr = (cmd_command_t *)cmd_mem_alloc(CMDLINE_MEM_COMMANDS, CMD_MEM_OBJECT, sizeof(cmd_command_t));
     if (cmd_ptr == NULL) {
         tr_error("mem alloc failed in cmd_add");
         return;
     }
     cmd_ptr->name_ptr = name;
     cmd_ptr->info_ptr = info;
-#if MBED_CONF_CMDLINE_INCLUDE_MAN == 1
     cmd_ptr->man_ptr = man;
-#else
-    (void)man;
-    cmd_ptr->man_ptr = 0;
-#endif
+    cmd_ptr->schema_ptr = NULL;
+    cmd_ptr->complete_cb = NULL;
     cmd_ptr->run_cb = callback;
-    cmd_ptr->busy = false;
-    ns_list_add_to_end(&cmd.command_list, cmd_ptr);
+    cmd_add_static(cmd_ptr);
+    CMD_INTERNAL(cmd_ptr)->allocated = true;
     return;
 }
 
+void cmd_add_static(cmd_descriptor_t *desc)
+{
+    if (desc == NULL || desc->name_ptr == NULL || desc->run_cb == NULL || strlen(desc->name_ptr) == 0) {
+        tr_warn("cmd_add_static invalid parameters");
+        return;
+    }
+#if MBED_CONF_CMDLINE_INCLUDE_MAN == 0
+    desc->man_ptr = 0;
+#endif
+    cmd_command_internal_t *internal_ptr = CMD_INTERNAL(desc);
+    memset(internal_ptr, 0, sizeof(cmd_command_internal_t));
+    size_t name_len = strlen(desc->name_ptr);
+    internal_ptr->name_len = name_len < UINT8_MAX ? name_len : UINT8_MAX;
+    internal_ptr->name_sig = cmd_str_sig(desc->name_ptr);
+    ns_list_add_to_end(&cmd.command_list, desc);
+}
+
 void cmd_delete(const char *name)
 {
     cmd_command_t *cmd_ptr;
@@ -982,10 +2725,282 @@ void cmd_delete(const char *name)
         return;
     }
     ns_list_remove(&cmd.command_list, cmd_ptr);
-    MEM_FREE(cmd_ptr);
+    cmd_mutex_lock();
+    if (CMD_INTERNAL(cmd_ptr)->abandoned) {
+        cmd.abandoned_count--;
+    }
+    cmd_mutex_unlock();
+    cmd_mem_free(CMD_INTERNAL(cmd_ptr)->stats_ptr);
+    CMD_INTERNAL(cmd_ptr)->stats_ptr = NULL;
+    if (CMD_INTERNAL(cmd_ptr)->allocated) {
+        cmd_mem_free(cmd_ptr);
+    }
     return;
 }
 
+void cmd_set_schema(const char *name, const cmd_schema_t *schema)
+{
+    cmd_command_t *cmd_ptr = cmd_find(name);
+    if (cmd_ptr == NULL) {
+        tr_warn("cmd_set_schema() command not found");
+        return;
+    }
+    cmd_ptr->schema_ptr = schema;
+}
+
+void cmd_set_completion(const char *name, cmd_complete_cb_f *complete_cb)
+{
+    cmd_command_t *cmd_ptr = cmd_find(name);
+    if (cmd_ptr == NULL) {
+        tr_warn("cmd_set_completion() command not found");
+        return;
+    }
+    cmd_ptr->complete_cb = complete_cb;
+}
+
+const void *cmd_args(void)
+{
+    return cmd.args_ptr;
+}
+
+/* Argument schemas.
+ * Options are looked up from the option index of the running command, and
+ * values are written to a zero initialized struct, which is freed when the
+ * callback returns.
+ */
+static const cmd_arg_t *cmd_schema_find(const cmd_schema_t *schema, const char *option, size_t len)
+{
+    for (int i = 0; i < schema->count; i++) {
+        if (strlen(schema->args[i].name) == len && strncmp(schema->args[i].name, option, len) == 0) {
+            return &schema->args[i];
+        }
+    }
+    return NULL;
+}
+
+static int cmd_schema_error(const char *message, const char *option)
+{
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    if (cmd.json) {
+        cmd_json_begin("error");
+        cmd_json_str("message", message);
+        cmd_json_str("cmd", cmd.cmd_ptr->name_ptr);
+        cmd_json_str("option", option);
+        cmd_json_end();
+    } else
+#endif
+        cmd_printf("%s: %s\r\n", message, option);
+    return CMDLINE_RETCODE_INVALID_PARAMETERS;
+}
+
+static int cmd_schema_value(const cmd_arg_t *arg, const char *str, uint8_t *args)
+{
+    void *field_ptr = args + arg->offset;
+    bool check = arg->min != 0 || arg->max != 0;
+    if (arg->type == CMD_ARG_INT) {
+        char *tail_ptr;
+        errno = 0;
+        long value = strtol(str, &tail_ptr, 10);
+        if (*str == 0 || *tail_ptr != 0 || errno == ERANGE || (int32_t)value != value ||
+                (check && (value < arg->min || value > arg->max))) {
+            return cmd_schema_error("Invalid value", arg->name);
+        }
+        *(int32_t *)field_ptr = value;
+    } else if (arg->type == CMD_ARG_BOOL) {
+        *(bool *)field_ptr = strcmp(str, "on") == 0 || strcmp(str, "1") == 0 || strcmp(str, "true") == 0 ||
+                             strcmp(str, "enable") == 0 || strcmp(str, "allow") == 0;
+    } else {
+        size_t len = strlen(str);
+        if (check && (len < (size_t)arg->min || len > (size_t)arg->max)) {
+            return cmd_schema_error("Invalid value", arg->name);
+        }
+        *(const char **)field_ptr = str;
+    }
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+static int cmd_schema_parse(const cmd_schema_t *schema, int argc, char *argv[])
+{
+    if (schema == NULL) {
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+    // every option needs to be known, e.g. "-5" is a value instead
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || isdigit((unsigned char)argv[i][1])) {
+            continue;
+        }
+        size_t len = cmd_options_name_len(argv[i]);
+        const cmd_arg_t *arg = cmd_schema_find(schema, argv[i], len);
+        if (arg == NULL) {
+            return cmd_schema_error("Unknown option", argv[i]);
+        }
+        if (arg->type == CMD_ARG_FLAG && argv[i][len] == '=') {
+            return cmd_schema_error("Invalid value", arg->name);
+        }
+        if (arg->type != CMD_ARG_FLAG && argv[i][len] != '=') {
+            i++; // value
+        }
+    }
+    uint8_t *args = NULL;
+    if (schema->size) {
+        args = (uint8_t *)cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, schema->size);
+        if (args == NULL) {
+            tr_error("mem alloc failed in cmd_schema_parse");
+            return CMDLINE_RETCODE_FAIL;
+        }
+        memset(args, 0, schema->size);
+    }
+    cmd.args_ptr = args;
+    for (int i = 0; i < schema->count; i++) {
+        const cmd_arg_t *arg = &schema->args[i];
+        int ret = CMDLINE_RETCODE_SUCCESS;
+        if (arg->type == CMD_ARG_FLAG) {
+            bool found = cmd_options_index(&cmd.options, arg->name) > 0;
+            if (found && args) {
+                *(bool *)(args + arg->offset) = true;
+            } else if (!found && arg->required) {
+                ret = cmd_schema_error("Missing option", arg->name);
+            }
+        } else {
+            char *str = cmd_options_value(&cmd.options, arg->name);
+            if (str) {
+                ret = args ? cmd_schema_value(arg, str, args) : CMDLINE_RETCODE_SUCCESS;
+            } else if (cmd_options_index(&cmd.options, arg->name) > 0) {
+                ret = cmd_schema_error("Missing value", arg->name);
+            } else if (arg->required) {
+                ret = cmd_schema_error("Missing option", arg->name);
+            }
+        }
+        if (ret != CMDLINE_RETCODE_SUCCESS) {
+            return ret;
+        }
+    }
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+static void cmd_schema_print(const cmd_command_t *command_ptr)
+{
+#if MBED_CONF_CMDLINE_INCLUDE_MAN == 1
+    static const char *const types[] = { "", " <bool>", " <int>", " <str>" };
+    const cmd_schema_t *schema = command_ptr->schema_ptr;
+    cmd_printf("Usage: %s [options]\r\n", command_ptr->name_ptr);
+    for (int i = 0; i < schema->count; i++) {
+        const cmd_arg_t *arg = &schema->args[i];
+        int len = strlen(arg->name) + strlen(types[arg->type]);
+        cmd_printf("  %s%s%*s%s", arg->name, types[arg->type], len < 22 ? 22 - len : 1, "",
+                   arg->help ? arg->help : "");
+        if (arg->type != CMD_ARG_FLAG && arg->type != CMD_ARG_BOOL && (arg->min != 0 || arg->max != 0)) {
+            cmd_printf(" [%ld..%ld]", (long)arg->min, (long)arg->max);
+        }
+        cmd_printf("%s\r\n", arg->required ? " (required)" : "");
+    }
+#else
+    (void)command_ptr;
+#endif
+}
+
+// command named by the first word of cmd.input
+static cmd_command_t *cmd_find_input(void)
+{
+    int namelength = strcspn(cmd.input, " ");
+    ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
+        if (strncmp(cur_ptr->name_ptr, cmd.input, namelength) == 0 &&
+                cur_ptr->name_ptr[namelength] == 0) {
+            return cur_ptr;
+        }
+    }
+    return NULL;
+}
+
+// n:th option of the command in cmd.input, which starts with word.
+// When not found, *n_ptr is decremented by count of matching options
+static const char *cmd_schema_lookup(const char *word, int wordlength, int *n_ptr)
+{
+    cmd_command_t *cmd_ptr = cmd_find_input();
+    if (cmd_ptr && cmd_ptr->schema_ptr) {
+        for (int i = 0; i < cmd_ptr->schema_ptr->count; i++) {
+            const char *name = cmd_ptr->schema_ptr->args[i].name;
+            if (strncmp(name, word, wordlength) == 0 && (*n_ptr)-- == 0) {
+                return name;
+            }
+        }
+    }
+    return NULL;
+}
+
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+/* Runs completion callback of a command for the word at wordpos, until visit returns true
+ * for a candidate starting with the word. Returns that candidate, or NULL when callback
+ * ran out of them.
+ */
+static const char *cmd_complete_iterate(cmd_command_t *cmd_ptr, cmd_complete_t *it, int wordpos, int wordlength,
+                                        cmd_tab_visit_f *visit, void *ctx)
+{
+    // arguments are parsed from a copy, only the iteration state is kept between calls
+    char *line = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, wordpos + 1);
+    if (line == NULL) {
+        tr_error("mem alloc failed in cmd_complete_iterate");
+        return NULL;
+    }
+    memcpy(line, cmd.input, wordpos);
+    line[wordpos] = 0;
+    char *argv[CMD_ARGV_INLINE_COUNT];
+    char **argv_spill = NULL;
+    int argc = cmd_parse_argv(line, argv, &argv_spill);
+    const char *str = NULL;
+    if (argc > 0) {
+        it->argc = argc;
+        it->argv = argv_spill ? argv_spill : argv;
+        it->prefix = cmd.input + wordpos;
+        it->prefix_len = wordlength;
+        while ((str = cmd_ptr->complete_cb(it)) != NULL) {
+            it->index++;
+            if (strncmp(str, cmd.input + wordpos, wordlength) == 0 && visit(ctx, str)) {
+                break;
+            }
+        }
+        it->argv = NULL;
+        it->prefix = NULL;
+    }
+    cmd_mem_free(argv_spill);
+    cmd_mem_free(line);
+    return str;
+}
+
+static bool cmd_complete_nth(void *ctx, const char *str)
+{
+    (void)str;
+    return cmd.complete_n++ == *(int *)ctx;
+}
+#endif
+
+// n:th candidate of completion callback of the command in cmd.input, which starts with the word at wordpos
+static const char *cmd_complete_lookup(int wordpos, int wordlength, int n)
+{
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+    cmd_command_t *cmd_ptr = cmd_find_input();
+    if (cmd_ptr == NULL || cmd_ptr->complete_cb == NULL) {
+        return NULL;
+    }
+    if (cmd.complete_n < 0 || cmd.complete_n > n || cmd.complete_cmd != cmd_ptr) {
+        memset(&cmd.complete, 0, sizeof(cmd.complete));
+        cmd.complete_cmd = cmd_ptr;
+        cmd.complete_n = 0;
+    }
+    const char *str = cmd_complete_iterate(cmd_ptr, &cmd.complete, wordpos, wordlength, cmd_complete_nth, &n);
+    if (str == NULL) {
+        // exhausted, next lookup starts over
+        cmd.complete_n = -1;
+    }
+    return str;
+#else
+    (void)wordpos;
+    (void)wordlength;
+    (void)n;
+    return NULL;
+#endif
+}
+
 static void replace_escapes(char *string_ptr)
 {
     while ((string_ptr = strchr(string_ptr, '\\')) != NULL) {
@@ -994,10 +3009,15 @@ static void replace_escapes(char *string_ptr)
     }
 }
 
-static int cmd_parse_argv(char *string_ptr, char **argv)
+/* Split line to arguments. First CMD_ARGV_INLINE_COUNT arguments are stored to argv,
+ * when line has more of them an array sized by the rest of the line is allocated to
+ * *spill_ptr, caller frees it. Returns count of arguments or CMD_ARGV_TOO_MANY/NO_MEMORY.
+ */
+static int cmd_parse_argv(char *string_ptr, char **argv, char ***spill_ptr)
 {
     tr_deep("cmd_parse_argv(%s, ..)\r\n", string_ptr);
     int argc = 0;
+    int size = CMD_ARGV_INLINE_COUNT;
     char *str_ptr, *end_quote_ptr = NULL;
 
     if (string_ptr == NULL || strlen(string_ptr) == 0) {
@@ -1006,6 +3026,23 @@ static int cmd_parse_argv(char *string_ptr, char **argv)
     }
     str_ptr = string_ptr;
     do {
+        if (argc == size) {
+            if (size >= MBED_CONF_CMDLINE_ARGS_MAX_COUNT) {
+                tr_warn("Maximum arguments (%d) reached", MBED_CONF_CMDLINE_ARGS_MAX_COUNT);
+                return CMD_ARGV_TOO_MANY;
+            }
+            // every argument takes at least one character and a separator
+            size_t rest = (strlen(str_ptr) + 1) / 2;
+            size = (rest < (size_t)(MBED_CONF_CMDLINE_ARGS_MAX_COUNT - argc)) ?
+                   argc + (int)rest : MBED_CONF_CMDLINE_ARGS_MAX_COUNT;
+            char **spill = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, size * sizeof(char *));
+            if (spill == NULL) {
+                tr_error("mem alloc failed in cmd_parse_argv");
+                return CMD_ARGV_NO_MEMORY;
+            }
+            memcpy(spill, argv, argc * sizeof(char *));
+            *spill_ptr = argv = spill;
+        }
         argv[argc] = str_ptr;
         // tr_deep("parsing.. argv[%d]: %s\r\n", argc, str_ptr);
         if (*str_ptr != '\\') {
@@ -1035,10 +3072,6 @@ static int cmd_parse_argv(char *string_ptr, char **argv)
         if (str_ptr == NULL) {
             break;
         }
-        if (argc > MBED_CONF_CMDLINE_ARGS_MAX_COUNT) {
-            tr_warn("Maximum arguments (%d) reached", MBED_CONF_CMDLINE_ARGS_MAX_COUNT);
-            break;
-        }
         *str_ptr++ = 0;
         replace_escapes(argv[argc - 1]);
         // tr_deep("parsed argv[%d]: %s\r\n", argc-1, argv[argc-1]);
@@ -1051,8 +3084,16 @@ static int cmd_parse_argv(char *string_ptr, char **argv)
 
 static void cmd_print_man(cmd_command_t *command_ptr)
 {
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    if (cmd.json) {
+        cmd_json_command(command_ptr, true);
+        return;
+    }
+#endif
     if (command_ptr->man_ptr) {
         cmd_printf("%s\r\n", command_ptr->man_ptr);
+    } else if (command_ptr->schema_ptr) {
+        cmd_schema_print(command_ptr);
     }
 }
 
@@ -1135,7 +3176,13 @@ static char *next_command(char *string_ptr, operator_t *oper)
 
 static int cmd_run(char *string_ptr)
 {
-    char *argv[MBED_CONF_CMDLINE_ARGS_MAX_COUNT];
+#if MBED_CONF_CMDLINE_ENABLE_BOUNDED_STACK == 1
+    char **argv = cmd.argv;
+#else
+    char *argv_inline[CMD_ARGV_INLINE_COUNT];
+    char **argv = argv_inline;
+#endif
+    char **argv_spill = NULL;
     int argc, ret;
 
     tr_info("Executing cmd: '%s'", string_ptr);
@@ -1144,7 +3191,7 @@ static int cmd_run(char *string_ptr)
     // getting only whitespace(s) as command string.
     argv[0] = "";
 
-    char *command_str = MEM_ALLOC(MBED_CONF_CMDLINE_MAX_LINE_LENGTH);
+    char *command_str = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, MBED_CONF_CMDLINE_MAX_LINE_LENGTH);
     if (command_str == NULL) {
         tr_error("mem alloc failed in cmd_run");
         return CMDLINE_RETCODE_FAIL;
@@ -1162,55 +3209,111 @@ static int cmd_run(char *string_ptr)
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
     cmd_replace_variables(command_str);
 #endif
+    CMD_TRACE(CMDLINE_TRACE_EXPAND, strlen(command_str));
     tr_debug("Parsed cmd: '%s'", command_str);
 
-    argc = cmd_parse_argv(command_str, argv);
+    argc = cmd_parse_argv(command_str, argv, &argv_spill);
+    if (argc == CMD_ARGV_TOO_MANY) {
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd.json) {
+            cmd_json_error("Too many arguments", argv[0]);
+        } else
+#endif
+            cmd_printf("Too many arguments, maximum is %d.\r\n", MBED_CONF_CMDLINE_ARGS_MAX_COUNT);
+    }
+    if (argc < 0) {
+        cmd_mem_free(argv_spill);
+        cmd_mem_free(command_str);
+        return CMDLINE_RETCODE_FAIL;
+    }
+    if (argv_spill) {
+        argv = argv_spill;
+    }
 
     cmd.cmd_ptr = cmd_find(argv[0]);
 
     if (cmd.cmd_ptr == NULL) {
-        cmd_printf("Command '%s' not found.\r\n", argv[0]);
-        MEM_FREE(command_str);
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd.json) {
+            cmd_json_error("Command not found", argv[0]);
+        } else
+#endif
+        {
+            cmd_printf("Command '%s' not found.\r\n", argv[0]);
+#if MBED_CONF_CMDLINE_ENABLE_SUGGESTIONS == 1
+            cmd_suggest(argv[0]);
+#endif
+        }
+        cmd_mem_free(argv_spill);
+        cmd_mem_free(command_str);
         ret = CMDLINE_RETCODE_COMMAND_NOT_FOUND;
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 1
-        cmd_variable_add_int("?", ret);
-        cmd_alias_add("_", string_ptr); // last executed command
+        cmd_variable_add_int(VAR_RETCODE, ret);
+        cmd_alias_add(ALIAS_LAST, string_ptr); // last executed command
 #endif
         return ret;
     }
     if (cmd.cmd_ptr->run_cb == NULL) {
         tr_error("Command callback missing");
-        MEM_FREE(command_str);
+        cmd_mem_free(argv_spill);
+        cmd_mem_free(command_str);
         return CMDLINE_RETCODE_COMMAND_CB_MISSING;
     }
 
     if (argc == 2 &&
             (cmd_has_option(argc, argv, "h") || cmd_parameter_index(argc, argv, "--help") > 0)) {
-        MEM_FREE(command_str);
+        cmd_mem_free(argv_spill);
+        cmd_mem_free(command_str);
         cmd_print_man(cmd.cmd_ptr);
         return CMDLINE_RETCODE_SUCCESS;
     }
 
-    if (cmd.cmd_ptr->busy) {
-        MEM_FREE(command_str);
+    if (CMD_INTERNAL(cmd.cmd_ptr)->busy) {
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+        cmd_stats_busy(cmd.cmd_ptr);
+#endif
+        cmd_mem_free(argv_spill);
+        cmd_mem_free(command_str);
         return CMDLINE_RETCODE_COMMAND_BUSY;
     }
 
     // Run the actual callback
-    cmd.cmd_ptr->busy = true;
-    ret = cmd.cmd_ptr->run_cb(argc, argv);
+    CMD_INTERNAL(cmd.cmd_ptr)->busy = true;
+    if (cmd.capture_ptr) {
+        cmd.capture_ptr->started = true;
+    }
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+    cmd_stats_start(cmd.cmd_ptr);
+#endif
+    cmd_options_init(&cmd.options, argc, argv);
+    void *prev_args_ptr = cmd.args_ptr; // cmd_exe_capture() runs commands inside a command
+    cmd.args_ptr = NULL;
+    ret = cmd_schema_parse(cmd.cmd_ptr->schema_ptr, argc, argv);
+    if (ret == CMDLINE_RETCODE_SUCCESS) {
+        CMD_TRACE(CMDLINE_TRACE_DISPATCH, argc);
+        ret = cmd.cmd_ptr->run_cb(argc, argv);
+    }
+    cmd.options.argv = NULL;
+    cmd_mem_free(cmd.args_ptr);
+    cmd.args_ptr = prev_args_ptr;
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES == 1
-    cmd_variable_add_int("?", ret);
-    cmd_alias_add("_", string_ptr); // last executed command
+    cmd_variable_add_int(VAR_RETCODE, ret);
+    cmd_alias_add(ALIAS_LAST, string_ptr); // last executed command
 #endif
-    MEM_FREE(command_str);
+    cmd_mem_free(argv_spill);
+    cmd_mem_free(command_str);
     switch (ret) {
         case (CMDLINE_RETCODE_COMMAND_NOT_IMPLEMENTED):
             tr_warn("Command not implemented");
             break;
         case (CMDLINE_RETCODE_INVALID_PARAMETERS):
             tr_warn("Command parameter was incorrect");
-            cmd_printf("Invalid parameters!\r\n");
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+            if (cmd.json) {
+                cmd_json_error("Invalid parameters", cmd.cmd_ptr->name_ptr);
+            } else
+#endif
+                cmd_printf("Invalid parameters!\r\n");
             cmd_print_man(cmd.cmd_ptr);
             break;
         default:
@@ -1274,8 +3377,9 @@ static void cmd_arrow_left(void)
 static void cmd_arrow_up(void)
 {
 #if MBED_CONF_CMDLINE_ENABLE_HISTORY
+    cmd_history_load();
     int16_t old_entry = cmd.history++;
-    if (NULL == cmd_history_find(cmd.history)) {
+    if (cmd.history >= cmd_history_count()) {
         cmd.history = old_entry;
     }
     if (old_entry != cmd.history) {
@@ -1405,36 +3509,36 @@ void cmd_escape_read(int16_t u_data)
 static void cmd_goto_end_of_history(void)
 {
     // handle new input if any and verify that
+    cmd_history_load();
     // it is not already in beginning of history or current position
     bool allowStore = strlen(cmd.input) != 0; //avoid store empty lines to history
-    cmd_history_t *entry_ptr;
     if (cmd.history > 0 && allowStore) {
-        entry_ptr = cmd_history_find(cmd.history);
-        if (entry_ptr) {
-            if (strcmp(entry_ptr->command_ptr, cmd.input) == 0) {
-                // current history contains contains same text as input
-                allowStore = false;
-            }
-        }
-    } else if (allowStore && (entry_ptr = cmd_history_find(0)) != NULL) {
-        if (strcmp(entry_ptr->command_ptr, cmd.input) == 0) {
-            //beginning of history was same text as input
+        if (cmd_history_equals(cmd.history, cmd.input)) {
+            // current history contains contains same text as input
             allowStore = false;
         }
+    } else if (allowStore && cmd_history_equals(0, cmd.input)) {
+        //beginning of history was same text as input
+        allowStore = false;
     }
     if (allowStore) {
-        cmd_history_save(0);  // new is saved to place 0
-        cmd_history_save(-1); // new is created to the current one
+#if CMD_HISTORY_ERASE_DUPS == 1
+        if (cmd_history_raise(cmd.input, true)) {
+            cmd_history_save(0);  // older one was moved after place 0
+        } else
+#endif
+        {
+            cmd_history_save(0);  // new is saved to place 0
+            cmd_history_save(-1); // new is created to the current one
+        }
     }
-    cmd_history_t *cmd_ptr = ns_list_get_last(&cmd.history_list);
-    cmd_set_input(cmd_ptr->command_ptr, 0);
-    cmd.history =  ns_list_count(&cmd.history_list) - 1;
+    cmd.history = cmd_history_count() - 1;
+    cmd_history_get(cmd.history);
 }
 
 static void cmd_goto_beginning_of_history(void)
 {
-    cmd_history_t *cmd_ptr = ns_list_get_first(&cmd.history_list);
-    cmd_set_input(cmd_ptr->command_ptr, 0);
+    cmd_history_get(0);
     cmd.history = 0;
 }
 #endif
@@ -1444,10 +3548,14 @@ static void cmd_reset_tab(void)
     cmd.tab_lookup = 0;
     cmd.tab_lookup_cmd_n = 0;
     cmd.tab_lookup_n = 0;
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+    cmd.complete_n = -1;
+#endif
 }
 
 void cmd_char_input(int16_t u_data)
 {
+    CMD_TRACE(CMDLINE_TRACE_INPUT, u_data);
     if (cmd.prev_cr && u_data == '\n') {
         // ignore \n if previous character was \r ->
         // that triggers execute so \n does not need to anymore
@@ -1467,6 +3575,12 @@ void cmd_char_input(int16_t u_data)
     }
 #endif
 
+#if CMD_HISTORY_SEARCH == 1
+    if (cmd.search.active && cmd_search_input(u_data)) {
+        return;
+    }
+#endif
+
     tr_debug("input char:      %02x '%c', cursor: %i, input: \"%s\"", u_data, (isprint(u_data) ? u_data : ' '), cmd.cursor,  cmd.input);
 
     /*Normal character input*/
@@ -1475,12 +3589,12 @@ void cmd_char_input(int16_t u_data)
         cmd_reset_tab();
         if (strlen(cmd.input) == 0) {
             if (cmd.echo) {
-                cmd_printf("\r\n");
+                cmd_write("\r\n", 2);
                 cmd_output();
             }
         } else {
             if (cmd.echo) {
-                cmd_printf("\r\n");
+                cmd_write("\r\n", 2);
             }
             cmd_execute();
         }
@@ -1489,7 +3603,7 @@ void cmd_char_input(int16_t u_data)
         cmd_reset_tab();
         cmd_line_clear(0);
         if (!cmd.idle) {
-            cmd_ready(CMDLINE_RETCODE_FAIL);
+            cmd_event_post(CMD_EVENT_READY, CMDLINE_RETCODE_FAIL);
         }
         if (cmd.echo) {
             cmd_output();
@@ -1516,6 +3630,13 @@ void cmd_char_input(int16_t u_data)
             cmd_output();
         }
     } else if (u_data == TAB) {
+#if MBED_CONF_CMDLINE_ENABLE_TAB_LISTING == 1
+        cmd_tab_complete();
+        if (cmd.echo) {
+            cmd_output();
+        }
+        return;
+#endif
         bool inc = false;
         if (cmd.tab_lookup > 0) {
             cmd.cursor = cmd.tab_lookup;
@@ -1536,6 +3657,12 @@ void cmd_char_input(int16_t u_data)
             cmd_output();
         }
 
+#if CMD_HISTORY_SEARCH == 1
+    } else if (u_data == DC2 && cmd.vt100_on && cmd.echo) {
+        //ctrl+r (reverse incremental history search), other modes give it to ctrl_fnc
+        cmd_reset_tab();
+        cmd_search_start();
+#endif
     } else if (iscntrl(u_data)) {
         if (cmd.ctrl_fnc) {
             cmd.ctrl_fnc(u_data);
@@ -1602,16 +3729,205 @@ bool cmd_tab_lookup(void)
             cmd_set_input(str, varpos + 1);
             return true;
         }
-    } else {
+    } else if (strchr(cmd.input, ' ') == NULL) {
         str = cmd_input_lookup(cmd.input, len, cmd.tab_lookup_cmd_n);
         if (str != NULL) {
             cmd_set_input(str, 0);
             return true;
         }
+    } else {
+        // option of command with schema, or candidate of its completion callback
+        int wordpos = strrchr(cmd.input, ' ') - cmd.input + 1;
+        int n = cmd.tab_lookup_cmd_n;
+        str = cmd_schema_lookup(cmd.input + wordpos, len - wordpos, &n);
+        if (str == NULL) {
+            str = cmd_complete_lookup(wordpos, len - wordpos, n);
+        }
+        if (str != NULL) {
+            cmd_set_input(str, wordpos);
+            return true;
+        }
+    }
+    return false;
+}
+
+#if MBED_CONF_CMDLINE_ENABLE_TAB_LISTING == 1 && MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
+/* Completion with listing.
+ * First TAB inserts the longest common prefix of candidates, and TAB right after it
+ * lists them in columns. Candidates are enumerated in one pass without storing them,
+ * common prefix is collected to input after the typed word.
+ */
+typedef struct cmd_tab_list_s {
+    int wordpos;                      // position of completed word
+    int wordlength;                   // typed length of completed word
+    int count;                        // count of candidates
+    int common;                       // length of common prefix
+    int width;                        // length of longest candidate
+    int columns;
+    int column;
+    int index;
+    char *buf;                        // listing, written at once
+    int size;                         // allocated size of buf
+    int len;
+} cmd_tab_list_t;
+
+// calls visit for all candidates of the word which ends to the end of input
+static void cmd_tab_candidates(cmd_tab_list_t *list, cmd_tab_visit_f *visit)
+{
+    int len = strlen(cmd.input);
+    char *key;
+    int keysize;
+    cmd.tab_lookup = len;
+    int varpos = check_variable_keylookup_size(&key, &keysize);
+    if (varpos) {
+        list->wordpos = varpos + 1;
+        list->wordlength = keysize;
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+        ns_list_foreach(cmd_variable_t, cur_ptr, &cmd.variable_list) {
+            if (strncmp(key + 1, cur_ptr->name_ptr, keysize) == 0) {
+                visit(list, cur_ptr->name_ptr);
+            }
+        }
+#endif
+    } else if (strchr(cmd.input, ' ') == NULL) {
+        list->wordpos = 0;
+        list->wordlength = len;
+        ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
+            if (strncmp(cmd.input, cur_ptr->name_ptr, len) == 0) {
+                visit(list, cur_ptr->name_ptr);
+            }
+        }
+#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
+        ns_list_foreach(cmd_alias_t, cur_ptr, &cmd.alias_list) {
+            if (strncmp(cmd.input, cur_ptr->name_ptr, len) == 0) {
+                visit(list, cur_ptr->name_ptr);
+            }
+        }
+#endif
+    } else {
+        list->wordpos = strrchr(cmd.input, ' ') - cmd.input + 1;
+        list->wordlength = len - list->wordpos;
+        cmd_command_t *cmd_ptr = cmd_find_input();
+        if (cmd_ptr && cmd_ptr->schema_ptr) {
+            for (int i = 0; i < cmd_ptr->schema_ptr->count; i++) {
+                const char *name = cmd_ptr->schema_ptr->args[i].name;
+                if (strncmp(name, cmd.input + list->wordpos, list->wordlength) == 0) {
+                    visit(list, name);
+                }
+            }
+        }
+        if (cmd_ptr && cmd_ptr->complete_cb) {
+            cmd_complete_t it;
+            memset(&it, 0, sizeof(it));
+            cmd_complete_iterate(cmd_ptr, &it, list->wordpos, list->wordlength, visit, list);
+        }
+    }
+}
+
+static bool cmd_tab_common(void *ctx, const char *str)
+{
+    cmd_tab_list_t *list = (cmd_tab_list_t *)ctx;
+    char *word = cmd.input + list->wordpos;
+    int len = strlen(str);
+    if (list->count++ == 0) {
+        // rest of the first candidate after typed word
+        list->common = len < MBED_CONF_CMDLINE_MAX_LINE_LENGTH - 1 - list->wordpos ?
+                       len : MBED_CONF_CMDLINE_MAX_LINE_LENGTH - 1 - list->wordpos;
+        memcpy(word + list->wordlength, str + list->wordlength, list->common - list->wordlength);
+    } else {
+        int i = list->wordlength;
+        while (i < list->common && word[i] == str[i]) {
+            i++;
+        }
+        list->common = i;
+    }
+    if (len > list->width) {
+        list->width = len;
+    }
+    return false;
+}
+
+static void cmd_tab_put(cmd_tab_list_t *list, const char *str, int len)
+{
+    if (list->buf && list->len + len >= list->size) {
+        // completion callback gave more candidates than when buffer was sized, rest is not buffered
+        cmd_fmt_putn(list->buf, list->len);
+        cmd_mem_free(list->buf);
+        list->buf = NULL;
+    }
+    if (list->buf) {
+        memcpy(list->buf + list->len, str, len);
+        list->len += len;
+    } else {
+        cmd_fmt_putn(str, len);
+    }
+}
+
+static bool cmd_tab_print(void *ctx, const char *str)
+{
+    cmd_tab_list_t *list = (cmd_tab_list_t *)ctx;
+    int len = strlen(str);
+    cmd_tab_put(list, str, len);
+    list->index++;
+    if (++list->column == list->columns || list->index == list->count) {
+        cmd_tab_put(list, "\r\n", 2);
+        list->column = 0;
+    } else {
+        for (; len < list->width + 2; len++) {
+            cmd_tab_put(list, " ", 1);
+        }
     }
     return false;
 }
 
+// terminal width, as given by cmd_request_screen_size() response or "set COLUMNS"
+static int cmd_columns(void)
+{
+    cmd_variable_t *var = variable_find((char *)"COLUMNS");
+    if (var && var->type == VALUE_TYPE_INT) {
+        return var->value.i;
+    }
+    const char *str = var ? cmd_variable_str(var) : NULL;
+    return str ? atoi(str) : 80;
+}
+
+static void cmd_tab_complete(void)
+{
+    cmd_tab_list_t list;
+    memset(&list, 0, sizeof(list));
+    bool again = cmd.tab_lookup > 0;
+    if (strlen(cmd.input) == 0) {
+        return;
+    }
+    cmd_tab_candidates(&list, cmd_tab_common);
+    if (list.count == 0) {
+        return;
+    }
+    cmd_line_clear(list.wordpos + list.common);
+    if (!again || list.count == 1 || !cmd.echo) {
+        return;
+    }
+    list.columns = cmd_columns() / (list.width + 2);
+    if (list.columns < 1) {
+        list.columns = 1;
+    }
+    int rows = (list.count + list.columns - 1) / list.columns;
+    list.size = 2 + list.count * (list.width + 2) + rows * 2 + 1;
+    list.buf = cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, list.size);
+    cmd_mutex_lock();
+    cmd_tab_put(&list, "\r\n", 2);
+    // same candidates again, now word is their common prefix
+    cmd_tab_candidates(&list, cmd_tab_print);
+    if (list.buf) {
+        cmd_write(list.buf, list.len);
+        cmd_mem_free(list.buf);
+    } else {
+        cmd_fmt_flush();
+    }
+    cmd_mutex_unlock();
+}
+#endif
+
 static void cmd_move_cursor_to_last_space(void)
 {
     if (cmd.cursor) {
@@ -1661,11 +3977,27 @@ static void cmd_clear_last_word(void)
 
 void cmd_output(void)
 {
+#if CMD_HISTORY_SEARCH == 1
+    if (cmd.search.active) {
+        cmd.search.drawn = false;
+        cmd_search_output();
+        return;
+    }
+#endif
 #if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING == 1
-    if (cmd.vt100_on && cmd.idle) {
+    // prompt would break one object per line in JSON mode
+    if (cmd.vt100_on && cmd.idle && !cmd_json_mode()) {
         int curpos = (int)strlen(cmd.input) - cmd.cursor + 1;
-        cmd_printf(CR_S CLEAR_ENTIRE_LINE "%s%s " MOVE_CURSOR_LEFT_N_CHAR,
-                   cmdline_get_prompt(), cmd.input, curpos);
+        // keep line refresh in one piece even when it is written in several parts
+        cmd_mutex_lock();
+        cmd_fmt_puts(CR_S CLEAR_ENTIRE_LINE);
+        cmd_fmt_puts(cmdline_get_prompt());
+        cmd_fmt_puts(cmd.input);
+        cmd_fmt_puts(" " MOVE_CURSOR_LEFT);
+        cmd_fmt_int(curpos);
+        cmd_fmt_putc('D');
+        cmd_fmt_flush();
+        cmd_mutex_unlock();
     }
 #endif
 }
@@ -1718,42 +4050,406 @@ static void replace_variable(char *str, cmd_variable_t *variable_ptr)
     const char *name = variable_ptr->name_ptr;
     int name_len = strlen(variable_ptr->name_ptr);
     char *value;
-    char valueLocal[11];
-    if (variable_ptr->type == VALUE_TYPE_STR) {
-        value = variable_ptr->value.ptr;
-    } else {
+    char valueLocal[MBED_CMDLINE_INT_STR_SIZE];
+    if (variable_ptr->type == VALUE_TYPE_INT) {
         value = valueLocal;
-        snprintf(value, 11, "%d", variable_ptr->value.i);
+        cmd_itoa(variable_ptr->value.i, value);
+    } else {
+        value = cmd_variable_str(variable_ptr);
+    }
+    // short names, like special variables, are handled without allocation
+    char nameLocal[MBED_CMDLINE_VALUE_INLINE_SIZE];
+    char *tmp = nameLocal;
+    if (name_len + 2 > (int)sizeof(nameLocal)) {
+        tmp = cmd_mem_alloc(CMDLINE_MEM_VARIABLES, CMD_MEM_BUFFER, name_len + 2);
+        if (tmp == NULL) {
+            tr_error("mem alloc failed in replace_variable");
+            return;
+        }
+    }
+    tmp[0] = '$';
+    strcpy(tmp + 1, name);
+    replace_string(str, MBED_CONF_CMDLINE_MAX_LINE_LENGTH, tmp, value);
+    if (tmp != nameLocal) {
+        cmd_mem_free(tmp);
+    }
+}
+
+static void cmd_replace_variables(char *input)
+{
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 0
+    (void)input;
+#else
+    ns_list_foreach(cmd_variable_t, cur_ptr, &cmd.variable_list) {
+        replace_variable(input, cur_ptr);
+    }
+#endif
+}
+
+//history
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 1
+/* Compressed history.
+ * Entries are kept newest first in cmd.history_arena. Each record has a header
+ * with count of leading characters shared with the next newer entry and
+ * length of the rest, which follows the header. Newest entry and every
+ * MBED_CMDLINE_HISTORY_MAX_DEPTH:th entry in a row are stored in full, so an
+ * entry is decoded from a few neighbouring records only.
+ */
+#define CMD_HISTORY_HEADER_SIZE 4
+#define CMD_HISTORY_PREFIX(rec) cmd_history_u16(rec)
+#define CMD_HISTORY_LEN(rec)    cmd_history_u16((rec) + 2)
+#define CMD_HISTORY_SUFFIX(rec) ((char *)(rec) + CMD_HISTORY_HEADER_SIZE)
+#define CMD_HISTORY_NEXT(rec)   ((rec) + CMD_HISTORY_HEADER_SIZE + CMD_HISTORY_LEN(rec))
+#define CMD_HISTORY_LENGTH(rec) (CMD_HISTORY_PREFIX(rec) + CMD_HISTORY_LEN(rec))
+
+static uint16_t cmd_history_u16(const uint8_t *ptr)
+{
+    return ptr[0] | (ptr[1] << 8);
+}
+
+static void cmd_history_set_header(uint8_t *rec, uint16_t prefix, uint16_t len)
+{
+    rec[0] = prefix & 0xff;
+    rec[1] = prefix >> 8;
+    rec[2] = len & 0xff;
+    rec[3] = len >> 8;
+}
+
+static uint8_t *cmd_history_record(int16_t index)
+{
+    if (index < 0 || index >= cmd.history_count) {
+        return NULL;
+    }
+    uint8_t *rec = cmd.history_arena;
+    while (index-- > 0) {
+        rec = CMD_HISTORY_NEXT(rec);
+    }
+    return rec;
+}
+
+// collects records needed to decode an entry, returns count of them
+static int cmd_history_chain(int16_t index, uint8_t *chain[MBED_CMDLINE_HISTORY_MAX_DEPTH])
+{
+    uint8_t *rec = cmd.history_arena;
+    int depth = 0;
+    for (int16_t i = 0; i <= index; i++) {
+        if (CMD_HISTORY_PREFIX(rec) == 0) {
+            depth = 0;
+        }
+        chain[depth++] = rec;
+        rec = CMD_HISTORY_NEXT(rec);
+    }
+    return depth;
+}
+
+// count of front coded entries following an entry
+static int cmd_history_run(int16_t index)
+{
+    int run = 0;
+    uint8_t *rec = cmd_history_record(index + 1);
+    for (int16_t i = index + 1; i < cmd.history_count && CMD_HISTORY_PREFIX(rec) > 0; i++) {
+        run++;
+        rec = CMD_HISTORY_NEXT(rec);
+    }
+    return run;
+}
+
+// copies characters [from, to) of an entry
+static void cmd_history_read(uint8_t **chain, int depth, int from, int to, char *dst)
+{
+    for (int i = depth - 1; i >= 0 && to > from; i--) {
+        int prefix = CMD_HISTORY_PREFIX(chain[i]);
+        if (to > prefix) {
+            int start = prefix > from ? prefix : from;
+            memcpy(dst + start - from, CMD_HISTORY_SUFFIX(chain[i]) + start - prefix, to - start);
+            to = start;
+        }
+    }
+}
+
+// returns count of leading characters which are same in an entry and str
+static int cmd_history_common(uint8_t **chain, int depth, const char *str)
+{
+    int to = CMD_HISTORY_LENGTH(chain[depth - 1]);
+    int common = (int)strlen(str);
+    if (common > to) {
+        common = to;
+    }
+    for (int i = depth - 1; i >= 0 && to > 0; i--) {
+        int prefix = CMD_HISTORY_PREFIX(chain[i]);
+        if (to > prefix) {
+            const char *suffix = CMD_HISTORY_SUFFIX(chain[i]);
+            for (int pos = prefix; pos < to && pos < common; pos++) {
+                if (str[pos] != suffix[pos - prefix]) {
+                    common = pos;
+                    break;
+                }
+            }
+            to = prefix;
+        }
+    }
+    return common;
+}
+
+// removes and inserts bytes at given position of arena
+static void cmd_history_splice(uint8_t *pos, int remove, int insert)
+{
+    size_t tail = cmd.history_used - (pos - cmd.history_arena) - remove;
+    memmove(pos + insert, pos + remove, tail);
+    cmd.history_used += insert - remove;
+}
+
+static void cmd_history_drop_last(void)
+{
+    uint8_t *rec = cmd_history_record(cmd.history_count - 1);
+    cmd.history_used = rec - cmd.history_arena;
+    cmd.history_count--;
+}
+
+static int16_t cmd_history_count(void)
+{
+    return cmd.history_count;
+}
+
+static bool cmd_history_equals(int16_t index, const char *str)
+{
+    uint8_t *chain[MBED_CMDLINE_HISTORY_MAX_DEPTH];
+    if (index < 0 || index >= cmd.history_count) {
+        return false;
+    }
+    int depth = cmd_history_chain(index, chain);
+    int length = CMD_HISTORY_LENGTH(chain[depth - 1]);
+    return (int)strlen(str) == length && cmd_history_common(chain, depth, str) == length;
+}
+
+static void cmd_history_copy(int16_t index, char *dst)
+{
+    uint8_t *chain[MBED_CMDLINE_HISTORY_MAX_DEPTH];
+    int depth = cmd_history_chain(index, chain);
+    int length = CMD_HISTORY_LENGTH(chain[depth - 1]);
+    cmd_history_read(chain, depth, 0, length, dst);
+    dst[length] = 0;
+}
+
+static const char *cmd_history_text(int16_t index, char **tmp_ptr)
+{
+    uint8_t *chain[MBED_CMDLINE_HISTORY_MAX_DEPTH];
+    int depth = cmd_history_chain(index, chain);
+    *tmp_ptr = cmd_mem_alloc(CMDLINE_MEM_HISTORY, CMD_MEM_BUFFER, CMD_HISTORY_LENGTH(chain[depth - 1]) + 1);
+    if (*tmp_ptr == NULL) {
+        tr_error("mem alloc failed in cmd_history_text");
+        return "";
+    }
+    cmd_history_copy(index, *tmp_ptr);
+    return *tmp_ptr;
+}
+
+static void cmd_history_clean_overflow(void)
+{
+    while (cmd.history_count > cmd.history_max_count) {
+        tr_debug("removing older history");
+        cmd_history_drop_last();
+    }
+}
+
+static void cmd_history_clean(void)
+{
+    cmd.history_count = 0;
+    cmd.history_used = 0;
+}
+
+static void cmd_history_insert(const char *str)
+{
+    int len = strlen(str);
+    while (cmd.history_used + CMD_HISTORY_HEADER_SIZE + len > MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE &&
+            cmd.history_count > 0) {
+        cmd_history_drop_last();
     }
-    char *tmp = MEM_ALLOC(name_len + 2);
-    if (tmp == NULL) {
-        tr_error("mem alloc failed in replace_variable");
+    if (cmd.history_used + CMD_HISTORY_HEADER_SIZE + len > MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE) {
+        tr_error("history arena too small for entry");
         return;
     }
-    tmp[0] = '$';
-    strcpy(tmp + 1, name);
-    replace_string(str, MBED_CONF_CMDLINE_MAX_LINE_LENGTH, tmp, value);
-    MEM_FREE(tmp);
+    cmd_history_splice(cmd.history_arena, 0, CMD_HISTORY_HEADER_SIZE + len);
+    cmd_history_set_header(cmd.history_arena, 0, len);
+    memcpy(CMD_HISTORY_SUFFIX(cmd.history_arena), str, len);
+    cmd.history_count++;
+    // previous newest entry is front coded against the new one
+    if (cmd.history_count > 1 && 2 + cmd_history_run(1) <= MBED_CMDLINE_HISTORY_MAX_DEPTH) {
+        uint8_t *rec = cmd_history_record(1);
+        int rec_len = CMD_HISTORY_LEN(rec);
+        int common = 0;
+        while (common < len && common < rec_len && CMD_HISTORY_SUFFIX(rec)[common] == str[common]) {
+            common++;
+        }
+        if (common > 0) {
+            cmd_history_splice(rec + CMD_HISTORY_HEADER_SIZE, common, 0);
+            cmd_history_set_header(rec, common, rec_len - common);
+        }
+    }
+}
+
+static void cmd_history_replace(int16_t index, const char *str)
+{
+    uint8_t *chain[MBED_CMDLINE_HISTORY_MAX_DEPTH];
+    int len = strlen(str);
+    int depth = cmd_history_chain(index, chain);
+    int common = cmd_history_common(chain, depth, str);
+    int old_size = CMD_HISTORY_HEADER_SIZE + CMD_HISTORY_LEN(chain[depth - 1]);
+    int prefix = 0;
+    if (index > 0) {
+        depth = cmd_history_chain(index - 1, chain);
+        if (depth + 1 + cmd_history_run(index) <= MBED_CMDLINE_HISTORY_MAX_DEPTH) {
+            prefix = cmd_history_common(chain, depth, str);
+        }
+    }
+    // older entry cannot share characters which are changed, those are moved to it.
+    // Older entry is expanded before this entry shrinks, so both steps need to fit.
+    int expand;
+    for (;;) {
+        uint8_t *older = cmd_history_record(index + 1);
+        expand = older && CMD_HISTORY_PREFIX(older) > common ? CMD_HISTORY_PREFIX(older) - common : 0;
+        int size = cmd.history_used + expand + CMD_HISTORY_HEADER_SIZE + len - prefix - old_size;
+        if (size <= MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE &&
+                cmd.history_used + expand <= MBED_CONF_CMDLINE_HISTORY_ARENA_SIZE) {
+            break;
+        }
+        if (older == NULL) {
+            tr_error("history arena too small for entry");
+            return;
+        }
+        cmd_history_drop_last();
+    }
+    if (expand > 0) {
+        uint8_t *older = cmd_history_record(index + 1);
+        int older_prefix = CMD_HISTORY_PREFIX(older);
+        int older_len = CMD_HISTORY_LEN(older);
+        cmd_history_splice(older + CMD_HISTORY_HEADER_SIZE, 0, expand);
+        depth = cmd_history_chain(index, chain);
+        cmd_history_read(chain, depth, common, older_prefix, CMD_HISTORY_SUFFIX(older));
+        cmd_history_set_header(older, common, older_len + expand);
+    }
+    uint8_t *rec = cmd_history_record(index);
+    cmd_history_splice(rec, old_size, CMD_HISTORY_HEADER_SIZE + len - prefix);
+    cmd_history_set_header(rec, prefix, len - prefix);
+    memcpy(CMD_HISTORY_SUFFIX(rec), str + prefix, len - prefix);
+}
+
+static void cmd_history_save(int16_t index)
+{
+    tr_debug("saving history item %d", index);
+    if (index < 0 || index >= cmd.history_count) {
+        cmd_history_insert(cmd.input);
+    } else {
+        cmd_history_replace(index, cmd.input);
+    }
+    cmd_history_clean_overflow();
+}
+
+static void cmd_history_get(uint16_t index)
+{
+    uint8_t *chain[MBED_CMDLINE_HISTORY_MAX_DEPTH];
+
+    tr_debug("getting history item %d", index);
+
+    if (index < cmd.history_count) {
+        int depth = cmd_history_chain(index, chain);
+        int length = CMD_HISTORY_LENGTH(chain[depth - 1]);
+        cmd_line_clear(0);
+        cmd_history_read(chain, depth, 0, length, cmd.input);
+        cmd.cursor = length;
+    }
+}
+
+#if CMD_HISTORY_SEARCH == 1
+// older entries are decoded on top of the previous one to input, which is left undefined when not found
+static int16_t cmd_history_search(int16_t from, int *pos_ptr)
+{
+    if (from >= cmd.history_count) {
+        return -1;
+    }
+    cmd_history_get(from);
+    uint8_t *rec = cmd_history_record(from);
+    for (int16_t index = from;;) {
+        int pos = cmd_search_match(cmd.input, CMD_HISTORY_LENGTH(rec));
+        if (pos >= 0) {
+            *pos_ptr = pos;
+            return index;
+        }
+        if (++index >= cmd.history_count) {
+            return -1;
+        }
+        rec = CMD_HISTORY_NEXT(rec);
+        memcpy(cmd.input + CMD_HISTORY_PREFIX(rec), CMD_HISTORY_SUFFIX(rec), CMD_HISTORY_LEN(rec));
+        cmd.input[CMD_HISTORY_LENGTH(rec)] = 0;
+    }
+}
+#endif
+#else
+#if CMD_HISTORY_ERASE_DUPS == 1
+/* Erase dups.
+ * Entries are chained to hash buckets by their command, so an entry equal to
+ * the executed command is found without comparing the whole history, and it is
+ * moved in the list instead of storing the command again.
+ */
+static cmd_history_t **cmd_history_bucket(uint32_t hash)
+{
+    return &cmd.history_hash[hash & (MBED_CMDLINE_HISTORY_HASH_BUCKETS - 1)];
+}
+
+static void cmd_history_hash_add(cmd_history_t *entry_ptr)
+{
+    cmd_history_t **bucket_ptr;
+    entry_ptr->hash = cmd_str_hash(entry_ptr->command_ptr, strlen(entry_ptr->command_ptr));
+    bucket_ptr = cmd_history_bucket(entry_ptr->hash);
+    entry_ptr->hash_next = *bucket_ptr;
+    *bucket_ptr = entry_ptr;
+}
+
+static void cmd_history_hash_remove(cmd_history_t *entry_ptr)
+{
+    cmd_history_t **next_ptr = cmd_history_bucket(entry_ptr->hash);
+    while (*next_ptr) {
+        if (*next_ptr == entry_ptr) {
+            *next_ptr = entry_ptr->hash_next;
+            return;
+        }
+        next_ptr = &(*next_ptr)->hash_next;
+    }
 }
 
-static void cmd_replace_variables(char *input)
+// moves entry equal to str to the start, or after the line being edited when edited is set
+static bool cmd_history_raise(const char *str, bool edited)
 {
-#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 0
-    (void)input;
-#else
-    ns_list_foreach(cmd_variable_t, cur_ptr, &cmd.variable_list) {
-        replace_variable(input, cur_ptr);
+    uint32_t hash = cmd_str_hash(str, strlen(str));
+    cmd_history_t *first_ptr = edited ? ns_list_get_first(&cmd.history_list) : NULL;
+    for (cmd_history_t *cur_ptr = *cmd_history_bucket(hash); cur_ptr; cur_ptr = cur_ptr->hash_next) {
+        if (cur_ptr == first_ptr || cur_ptr->hash != hash || strcmp(cur_ptr->command_ptr, str) != 0) {
+            continue;
+        }
+        tr_debug("raising history item (%s)", str);
+        ns_list_remove(&cmd.history_list, cur_ptr);
+        if (first_ptr) {
+            ns_list_add_after(&cmd.history_list, first_ptr, cur_ptr);
+        } else {
+            ns_list_add_to_start(&cmd.history_list, cur_ptr);
+        }
+        return true;
     }
-#endif
+    return false;
 }
+#endif
 
-//history
-#if MBED_CONF_CMDLINE_ENABLE_HISTORY == 1
 static void cmd_history_item_delete(cmd_history_t *entry_ptr)
 {
+#if CMD_HISTORY_ERASE_DUPS == 1
+    if (entry_ptr->command_ptr) {
+        cmd_history_hash_remove(entry_ptr);
+    }
+#endif
     ns_list_remove(&cmd.history_list, entry_ptr);
-    MEM_FREE(entry_ptr->command_ptr);
-    MEM_FREE(entry_ptr);
+    cmd_mem_free(entry_ptr->command_ptr);
+    cmd_mem_free(entry_ptr);
 }
 
 static cmd_history_t *cmd_history_find(int16_t index)
@@ -1770,6 +4466,23 @@ static cmd_history_t *cmd_history_find(int16_t index)
     return entry_ptr;
 }
 
+static int16_t cmd_history_count(void)
+{
+    return ns_list_count(&cmd.history_list);
+}
+
+static bool cmd_history_equals(int16_t index, const char *str)
+{
+    cmd_history_t *entry_ptr = cmd_history_find(index);
+    return entry_ptr && strcmp(entry_ptr->command_ptr, str) == 0;
+}
+
+static const char *cmd_history_text(int16_t index, char **tmp_ptr)
+{
+    *tmp_ptr = NULL;
+    return cmd_history_find(index)->command_ptr;
+}
+
 static void cmd_history_clean_overflow(void)
 {
     while (ns_list_count(&cmd.history_list) > cmd.history_max_count) {
@@ -1800,7 +4513,7 @@ static void cmd_history_save(int16_t index)
 
     if (entry_ptr == NULL) {
         /*new entry*/
-        entry_ptr = (cmd_history_t *)MEM_ALLOC(sizeof(cmd_history_t));
+        entry_ptr = (cmd_history_t *)cmd_mem_alloc(CMDLINE_MEM_HISTORY, CMD_MEM_OBJECT, sizeof(cmd_history_t));
         if (entry_ptr == NULL) {
             tr_error("mem alloc failed in cmd_history_save");
             return;
@@ -1810,15 +4523,24 @@ static void cmd_history_save(int16_t index)
     }
 
     if (entry_ptr->command_ptr != NULL) {
-        MEM_FREE(entry_ptr->command_ptr);
+#if CMD_HISTORY_ERASE_DUPS == 1
+        cmd_history_hash_remove(entry_ptr);
+#endif
+        cmd_mem_free(entry_ptr->command_ptr);
     }
-    entry_ptr->command_ptr = (char *)MEM_ALLOC(len + 1);
+    entry_ptr->command_ptr = (char *)cmd_mem_alloc(CMDLINE_MEM_HISTORY, CMD_MEM_BUFFER, len + 1);
     if (entry_ptr->command_ptr == NULL) {
         tr_error("mem alloc failed in cmd_history_save command_ptr");
         cmd_history_item_delete(entry_ptr);
         return;
     }
     strcpy(entry_ptr->command_ptr, cmd.input);
+#if CMD_HISTORY_SEARCH == 1
+    entry_ptr->sig = cmd_str_sig(cmd.input);
+#endif
+#if CMD_HISTORY_ERASE_DUPS == 1
+    cmd_history_hash_add(entry_ptr);
+#endif
 
     cmd_history_clean_overflow();
 }
@@ -1836,6 +4558,345 @@ static void cmd_history_get(uint16_t index)
         cmd_set_input(entry_ptr->command_ptr, 0);
     }
 }
+
+#if CMD_HISTORY_SEARCH == 1
+// signatures of entries are checked before matching, so most of them are skipped cheaply
+static int16_t cmd_history_search(int16_t from, int *pos_ptr)
+{
+    int16_t index = 0;
+    ns_list_foreach(cmd_history_t, cur_ptr, &cmd.history_list) {
+        if (index >= from && (cur_ptr->sig & cmd.search.sig) == cmd.search.sig) {
+            int pos = cmd_search_match(cur_ptr->command_ptr, strlen(cur_ptr->command_ptr));
+            if (pos >= 0) {
+                cmd_history_get(index);
+                *pos_ptr = pos;
+                return index;
+            }
+        }
+        index++;
+    }
+    return -1;
+}
+#endif
+#endif
+
+/* Persistent history.
+ * Executed commands are appended to the configured store as zero terminated
+ * records. Log is read when history is first browsed, every record is replayed
+ * to history which keeps the newest of them. When log has grown to twice the
+ * history size, history is written to the spare log one record per idle step of
+ * the event loop, and the spare log replaces the log when it is complete.
+ */
+typedef struct cmd_history_reader_s {
+    uint32_t offset;                  // log offset of buf
+    uint8_t buf[32];
+    uint8_t length;
+    uint8_t pos;
+} cmd_history_reader_t;
+
+static int cmd_history_log_getc(cmd_history_reader_t *reader)
+{
+    if (reader->pos == reader->length) {
+        reader->offset += reader->length;
+        int length = cmd.history_store.read(cmd.history_store.ctx, reader->offset, reader->buf, sizeof(reader->buf));
+        if (length <= 0) {
+            return -1;
+        }
+        reader->length = (uint8_t)(length > (int)sizeof(reader->buf) ? (int)sizeof(reader->buf) : length);
+        reader->pos = 0;
+    }
+    return reader->buf[reader->pos++];
+}
+
+static void cmd_history_load(void)
+{
+    cmd_history_reader_t reader;
+    uint32_t count = 0;
+    int length = 0;
+    int c;
+
+    if (cmd.history_loaded || cmd.history_store.read == NULL) {
+        return;
+    }
+    cmd.history_loaded = true;
+
+    cmd_history_clean();
+    // line being edited stays the newest entry
+    char *line_ptr = (char *)cmd_mem_alloc(CMDLINE_MEM_HISTORY, CMD_MEM_BUFFER, strlen(cmd.input) + 1);
+    if (line_ptr) {
+        strcpy(line_ptr, cmd.input);
+    } else {
+        tr_error("mem alloc failed in cmd_history_load");
+    }
+
+    memset(&reader, 0, sizeof(reader));
+    while ((c = cmd_history_log_getc(&reader)) >= 0) {
+        if (c != 0) {
+            if (length < MBED_CONF_CMDLINE_MAX_LINE_LENGTH - 1) {
+                cmd.input[length++] = c;
+            } else {
+                length = MBED_CONF_CMDLINE_MAX_LINE_LENGTH; // too long, ignored
+            }
+            continue;
+        }
+        count++;
+        if (length > 0 && length < MBED_CONF_CMDLINE_MAX_LINE_LENGTH) {
+            cmd.input[length] = 0;
+#if CMD_HISTORY_ERASE_DUPS == 1
+            if (!cmd_history_raise(cmd.input, false))
+#endif
+            {
+                cmd_history_save(-1);
+            }
+        }
+        length = 0;
+    }
+    tr_debug("loaded history log, %u records", (unsigned int)count);
+    // log contains also the commands executed before loading
+    cmd.history_log_count = count;
+
+    memset(cmd.input, 0, MBED_CONF_CMDLINE_MAX_LINE_LENGTH);
+    if (line_ptr) {
+        strcpy(cmd.input, line_ptr);
+        cmd_mem_free(line_ptr);
+    }
+    cmd_history_save(-1);
+    cmd.history = 0;
+}
+
+static void cmd_history_log_append(const char *str)
+{
+    if (cmd.history_store.append == NULL) {
+        return;
+    }
+    if (cmd.history_store.append(cmd.history_store.ctx, str, strlen(str) + 1) == 0) {
+        cmd.history_log_count++;
+    } else {
+        tr_warn("history log append failed");
+    }
+    // history entries moved, compaction starts over
+    cmd.history_compact = -1;
+}
+
+/* One step of log compaction, returns true when there is more to do.
+ * Entries are written from the oldest to the newest, entry 0 is the line being edited.
+ */
+static bool cmd_history_log_compact(void)
+{
+    const cmd_history_store_t *store = &cmd.history_store;
+    if (cmd.history_compact < 0) {
+        if (store->spare_write == NULL || store->spare_commit == NULL ||
+                cmd.history_log_count <= 2 * (uint32_t)cmd.history_max_count) {
+            return false;
+        }
+        cmd_history_load();
+        if (cmd.history_log_count <= 2 * (uint32_t)cmd.history_max_count) {
+            return false;
+        }
+        tr_debug("compacting history log");
+        cmd.history_compact = cmd_history_count() - 1;
+        cmd.history_spare_length = 0;
+        return true;
+    }
+    if (cmd.history_compact >= cmd_history_count()) {
+        // history was resized
+        cmd.history_compact = -1;
+        return true;
+    }
+    if (cmd.history_compact > 0) {
+        char *tmp_ptr;
+        const char *str = cmd_history_text(cmd.history_compact, &tmp_ptr);
+        uint16_t length = strlen(str) + 1;
+        int ret = length > 1 ? store->spare_write(store->ctx, cmd.history_spare_length, str, length) : -1;
+        cmd_mem_free(tmp_ptr);
+        if (ret != 0) {
+            // log is untouched, compaction is tried again after next command
+            tr_warn("history spare log write failed");
+            cmd.history_compact = -1;
+            return false;
+        }
+        cmd.history_spare_length += length;
+        cmd.history_compact--;
+        return true;
+    }
+    cmd.history_compact = -1;
+    if (store->spare_commit(store->ctx, cmd.history_spare_length) != 0) {
+        tr_warn("history spare log commit failed");
+        return false;
+    }
+    cmd.history_log_count = cmd_history_count() - 1;
+    return false;
+}
+#endif
+
+#if CMD_HISTORY_SEARCH == 1
+// returns position of pattern in text or -1
+static int cmd_search_match(const char *text, int length)
+{
+    int len = cmd.search.len;
+    for (int pos = 0; pos + len <= length; pos += cmd.search.shift[text[pos + len - 1] & 31]) {
+        if (memcmp(text + pos, cmd.search.pattern, len) == 0) {
+            return pos;
+        }
+    }
+    return -1;
+}
+
+static void cmd_search_compile(void)
+{
+    int len = cmd.search.len;
+    cmd.search.pattern[len] = 0;
+    cmd.search.sig = cmd_str_sig(cmd.search.pattern);
+    memset(cmd.search.shift, len, sizeof(cmd.search.shift));
+    for (int i = 0; i < len - 1; i++) {
+        cmd.search.shift[cmd.search.pattern[i] & 31] = len - 1 - i;
+    }
+}
+
+// shows newest entry matching pattern starting from given history position
+static void cmd_search_find(int16_t from)
+{
+    int pos = cmd.cursor;
+    int16_t index = -1;
+    if (cmd.search.len > 0) {
+        index = cmd_history_search(from, &pos);
+    }
+    cmd.search.failed = cmd.search.len > 0 && index < 0;
+    if (index >= 0) {
+        cmd.search.index = index;
+        cmd.cursor = pos;
+    } else if (cmd.search.failed) {
+        // keep showing the previous entry
+        cmd_history_get(cmd.search.index);
+        cmd.cursor = pos;
+    }
+}
+
+/* Redraws search prompt. Only the part after the first changed character is written,
+ * e.g. typing a character rewrites pattern from that character on, and moving to
+ * older entry with same pattern rewrites only the entry.
+ */
+static void cmd_search_output(void)
+{
+    if (!cmd.vt100_on || !cmd.echo) {
+        return;
+    }
+    const char *head = cmd.search.failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`";
+    int head_len = strlen(head);
+    int text_col = head_len + cmd.search.len + 3;
+    int end_col = text_col + strlen(cmd.input);
+    int from;
+    if (!cmd.search.drawn || cmd.search.drawn_failed != cmd.search.failed) {
+        from = 0;
+    } else if (cmd.search.drawn_len != cmd.search.len) {
+        from = head_len + (cmd.search.drawn_len < cmd.search.len ? cmd.search.drawn_len : cmd.search.len);
+    } else if (cmd.search.drawn_index != cmd.search.index) {
+        from = text_col;
+    } else {
+        from = -1;
+    }
+    cmd_mutex_lock();
+    cmd_fmt_puts(CR_S);
+    if (from == 0) {
+        cmd_fmt_puts(CLEAR_ENTIRE_LINE);
+        cmd_fmt_puts(head);
+    } else if (from > 0) {
+        cmd_fmt_puts(MOVE_CURSOR_RIGHT);
+        cmd_fmt_int(from);
+        cmd_fmt_putc('C');
+    }
+    if (from >= 0) {
+        if (from < text_col) {
+            int pattern_from = from > head_len ? from - head_len : 0;
+            cmd_fmt_putn(cmd.search.pattern + pattern_from, cmd.search.len - pattern_from);
+            cmd_fmt_puts("': ");
+        }
+        cmd_fmt_puts(cmd.input);
+        if (from > 0) {
+            cmd_fmt_puts(CLEAR_TO_END_OF_LINE);
+        }
+        if (end_col > text_col + cmd.cursor) {
+            cmd_fmt_puts(MOVE_CURSOR_LEFT);
+            cmd_fmt_int(end_col - text_col - cmd.cursor);
+            cmd_fmt_putc('D');
+        }
+    } else if (text_col + cmd.cursor > 0) {
+        cmd_fmt_puts(MOVE_CURSOR_RIGHT);
+        cmd_fmt_int(text_col + cmd.cursor);
+        cmd_fmt_putc('C');
+    }
+    cmd_fmt_flush();
+    cmd_mutex_unlock();
+    cmd.search.drawn = true;
+    cmd.search.drawn_failed = cmd.search.failed;
+    cmd.search.drawn_len = cmd.search.len;
+    cmd.search.drawn_index = cmd.search.index;
+}
+
+static void cmd_search_start(void)
+{
+    cmd_history_load();
+    // edited line is kept, search can be cancelled
+    cmd_history_save(cmd.history);
+    cmd.search.active = true;
+    cmd.search.failed = false;
+    cmd.search.drawn = false;
+    cmd.search.len = 0;
+    cmd.search.origin = cmd.history;
+    cmd.search.index = cmd.history;
+    cmd_search_output();
+}
+
+static void cmd_search_end(bool accept)
+{
+    cmd.search.active = false;
+    if (accept) {
+        cmd.history = cmd.search.index;
+    } else {
+        cmd.history = cmd.search.origin;
+        cmd_history_get(cmd.history);
+    }
+    if (cmd.echo) {
+        cmd_output();
+    }
+}
+
+// returns false when search is ended and character is handled as normal input
+static bool cmd_search_input(int16_t u_data)
+{
+    if (u_data == DC2) {
+        if (cmd.search.len == 0) {
+            // search again with previous pattern
+            cmd.search.len = strlen(cmd.search.pattern);
+            cmd_search_compile();
+            cmd_search_find(cmd.search.index == cmd.search.origin ? cmd.search.origin + 1 : cmd.search.index);
+        } else {
+            cmd_search_find(cmd.search.index + 1);
+        }
+    } else if (u_data == BEL) {
+        // ctrl+g
+        cmd_search_end(false);
+        return true;
+    } else if (u_data == BS || u_data == DEL) {
+        if (cmd.search.len > 0) {
+            cmd.search.len--;
+            cmd_search_compile();
+            cmd_search_find(cmd.search.origin + 1);
+        }
+    } else if (isprint(u_data)) {
+        if (cmd.search.len < MBED_CMDLINE_SEARCH_MAX_LENGTH) {
+            cmd.search.pattern[cmd.search.len++] = u_data;
+            cmd_search_compile();
+            // older entries did not match shorter pattern either
+            cmd_search_find(cmd.search.index == cmd.search.origin ? cmd.search.origin + 1 : cmd.search.index);
+        }
+    } else {
+        cmd_search_end(true);
+        return false;
+    }
+    cmd_search_output();
+    return true;
+}
 #endif
 
 static void cmd_line_clear(int from)
@@ -1845,20 +4906,187 @@ static void cmd_line_clear(int from)
     cmd.cursor = from;
 }
 
+#if CMD_HISTORY_EXPANSION == 1
+/* History expansion.
+ * "!!" is the previous command, "!n" is entry n of the history command listing,
+ * "!-n" is n:th previous command and "!prefix" is the newest command starting
+ * with prefix. "^old^new" at the beginning of line is the previous command with
+ * first old replaced by new. Text in quotes is not expanded. Expanded line
+ * is printed, then executed and stored to history instead of the typed one.
+ */
+// history index of event designated by str or -1, length of designator to *len_ptr
+static int16_t cmd_history_event(const char *str, int *len_ptr)
+{
+    int16_t count = cmd_history_count();
+    int16_t index = -1;
+    int len = 0;
+    if (str[0] == '!') {
+        len = 1;
+        index = 1;
+    } else if (isdigit((int)str[0]) || (str[0] == '-' && isdigit((int)str[1]))) {
+        int n = 0;
+        len = str[0] == '-';
+        for (; isdigit((int)str[len]); len++) {
+            if (n < INT16_MAX / 10) {
+                n = n * 10 + str[len] - '0';
+            }
+        }
+        index = str[0] == '-' ? n : count - 1 - n;
+    } else {
+        len = strcspn(str, " \t;&|\"'=");
+        for (int16_t i = 1; len > 0 && i < count; i++) {
+            char *tmp_ptr;
+            bool found = strncmp(cmd_history_text(i, &tmp_ptr), str, len) == 0;
+            cmd_mem_free(tmp_ptr);
+            if (found) {
+                index = i;
+                break;
+            }
+        }
+    }
+    *len_ptr = len;
+    return index >= 1 && index < count ? index : -1;
+}
+
+static void cmd_history_expand_error(const char *message, const char *str, int len)
+{
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    if (cmd.json) {
+        cmd_json_error(message, cmd.input);
+        return;
+    }
+#endif
+    cmd_printf("%.*s: %s\r\n", len, str, message);
+}
+
+// ^old^new, expanded line to out
+static bool cmd_history_substitute(char *out)
+{
+    const char *old_ptr = cmd.input + 1;
+    const char *new_ptr = strchr(old_ptr, '^');
+    char *tmp_ptr = NULL;
+    bool ok = false;
+    if (new_ptr && new_ptr != old_ptr && cmd_history_count() > 1) {
+        size_t old_len = new_ptr - old_ptr;
+        size_t new_len = strcspn(++new_ptr, "^");
+        const char *text = cmd_history_text(1, &tmp_ptr);
+        for (const char *match = text; *match; match++) {
+            if (strncmp(match, old_ptr, old_len) != 0) {
+                continue;
+            }
+            if (strlen(text) - old_len + new_len < MBED_CONF_CMDLINE_MAX_LINE_LENGTH) {
+                size_t head = match - text;
+                memcpy(out, text, head);
+                memcpy(out + head, new_ptr, new_len);
+                strcpy(out + head + new_len, match + old_len);
+                ok = true;
+            }
+            break;
+        }
+    }
+    cmd_mem_free(tmp_ptr);
+    if (!ok) {
+        cmd_history_expand_error("substitution failed", cmd.input, strlen(cmd.input));
+    }
+    return ok;
+}
+
+// expands cmd.input in place, returns false when line can not be executed
+static bool cmd_history_expand(void)
+{
+    if (cmd.input[0] != '^' && strchr(cmd.input, '!') == NULL) {
+        return true;
+    }
+    char *out = (char *)cmd_mem_alloc(CMDLINE_MEM_EXEC, CMD_MEM_BUFFER, MBED_CONF_CMDLINE_MAX_LINE_LENGTH);
+    if (out == NULL) {
+        tr_error("mem alloc failed in cmd_history_expand");
+        return true; // executed as it is
+    }
+    cmd_history_load();
+    bool expanded = false;
+    bool ok = true;
+    if (cmd.input[0] == '^') {
+        ok = expanded = cmd_history_substitute(out);
+    } else {
+        bool quoted = false;
+        size_t pos = 0;
+        for (const char *in_ptr = cmd.input; *in_ptr && ok;) {
+            int len = 0;
+            int16_t index = -1;
+            if (*in_ptr == '"') {
+                quoted = !quoted;
+            } else if (*in_ptr == '!' && !quoted) {
+                index = cmd_history_event(in_ptr + 1, &len);
+            }
+            if (len == 0) {
+                if (pos + 1 >= MBED_CONF_CMDLINE_MAX_LINE_LENGTH) {
+                    cmd_history_expand_error("expansion too long", cmd.input, strlen(cmd.input));
+                    ok = false;
+                } else {
+                    out[pos++] = *in_ptr++;
+                }
+                continue;
+            }
+            if (index < 0) {
+                cmd_history_expand_error("event not found", in_ptr, len + 1);
+                ok = false;
+                break;
+            }
+            char *tmp_ptr;
+            const char *text = cmd_history_text(index, &tmp_ptr);
+            size_t text_len = strlen(text);
+            if (pos + text_len >= MBED_CONF_CMDLINE_MAX_LINE_LENGTH) {
+                cmd_history_expand_error("expansion too long", cmd.input, strlen(cmd.input));
+                ok = false;
+            } else {
+                memcpy(out + pos, text, text_len);
+                pos += text_len;
+                in_ptr += len + 1;
+                expanded = true;
+            }
+            cmd_mem_free(tmp_ptr);
+        }
+        out[pos] = 0;
+    }
+    if (ok && expanded) {
+        strcpy(cmd.input, out);
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (!cmd.json)
+#endif
+        {
+            cmd_printf("%s\r\n", cmd.input);
+        }
+    }
+    cmd_mem_free(out);
+    return ok;
+}
+#endif
+
 static void cmd_execute(void)
 {
+#if CMD_HISTORY_EXPANSION == 1
+    if (!cmd_history_expand()) {
+        cmd.history = 0;
+        cmd_line_clear(0);
+        if (cmd.echo) {
+            cmd_output();
+        }
+        return;
+    }
+#endif
 #if MBED_CONF_CMDLINE_ENABLE_HISTORY
     if (strlen(cmd.input) != 0) {
-        bool noduplicates = true;
-        cmd_history_t *entry_ptr = cmd_history_find(0);
-        if (entry_ptr) {
-            if (strcmp(entry_ptr->command_ptr, cmd.input) == 0) {
-                noduplicates = false;
+        if (!cmd_history_equals(0, cmd.input)) {
+#if CMD_HISTORY_ERASE_DUPS == 1
+            if (cmd_history_raise(cmd.input, true)) {
+                cmd_history_save(0);  // older one was moved after place 0
+            } else
+#endif
+            {
+                cmd_history_save(0);  // new is saved to place 0
+                cmd_history_save(-1); // new is created to the current one
             }
-        }
-        if (noduplicates) {
-            cmd_history_save(0);  // new is saved to place 0
-            cmd_history_save(-1); // new is created to the current one
+            cmd_history_log_append(cmd.input);
         }
     }
     cmd.history = 0;
@@ -1879,6 +5107,9 @@ static cmd_alias_t *alias_find(const char *alias)
         tr_error("alias_find invalid parameters");
         return NULL;
     }
+    if (strcmp(alias, ALIAS_LAST) == 0) {
+        return cmd.last_alias.name_ptr ? &cmd.last_alias : NULL;
+    }
 
     ns_list_foreach(cmd_alias_t, cur_ptr, &cmd.alias_list) {
         if (strcmp(alias, cur_ptr->name_ptr) == 0) {
@@ -1915,6 +5146,33 @@ static cmd_alias_t *alias_find_n(char *alias, int aliaslength, int n)
     return alias_ptr;
 }
 
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+static const char *const cmd_special_var_names[CMD_VAR_SPECIAL_COUNT] = {
+    VAR_PROMPT, VAR_RETCODE, VAR_RETFMT
+};
+
+// returns fixed slot for special variable name or NULL
+static cmd_variable_t *cmd_variable_slot(const char *variable)
+{
+    for (int i = 0; i < CMD_VAR_SPECIAL_COUNT; i++) {
+        if (strcmp(variable, cmd_special_var_names[i]) == 0) {
+            return &cmd.special_vars[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+static cmd_variable_t *cmd_special_var(cmd_special_var_t id)
+{
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+    return cmd.special_vars[id].name_ptr ? &cmd.special_vars[id] : NULL;
+#else
+    (void)id;
+    return NULL;
+#endif
+}
+
 static cmd_variable_t *variable_find(char *variable)
 {
     cmd_variable_t *variable_ptr = NULL;
@@ -1923,6 +5181,10 @@ static cmd_variable_t *variable_find(char *variable)
         return NULL;
     }
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+    variable_ptr = cmd_variable_slot(variable);
+    if (variable_ptr) {
+        return variable_ptr->name_ptr ? variable_ptr : NULL;
+    }
     ns_list_foreach(cmd_variable_t, cur_ptr, &cmd.variable_list) {
         if (strcmp(variable, cur_ptr->name_ptr) == 0) {
             variable_ptr = cur_ptr;
@@ -1933,6 +5195,14 @@ static cmd_variable_t *variable_find(char *variable)
     return variable_ptr;
 }
 
+static char *cmd_variable_str(cmd_variable_t *variable_ptr)
+{
+    if (variable_ptr->type == VALUE_TYPE_INLINE) {
+        return variable_ptr->value.str;
+    }
+    return variable_ptr->type == VALUE_TYPE_STR ? variable_ptr->value.ptr : NULL;
+}
+
 static cmd_variable_t *variable_find_n(char *variable, int length, int n)
 {
     cmd_variable_t *variable_ptr = NULL;
@@ -1961,6 +5231,15 @@ static void cmd_alias_print_all(void)
 {
 #if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
     ns_list_foreach(cmd_alias_t, cur_ptr, &cmd.alias_list) {
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd.json) {
+            cmd_json_begin("alias");
+            cmd_json_str("name", cur_ptr->name_ptr);
+            cmd_json_str("value", cur_ptr->value_ptr);
+            cmd_json_end();
+            continue;
+        }
+#endif
         if (cur_ptr->name_ptr != NULL) {
             cmd_printf("%-18s'%s'\r\n", cur_ptr->name_ptr, cur_ptr->value_ptr ? cur_ptr->value_ptr : "");
         }
@@ -1973,16 +5252,42 @@ static void cmd_variable_print_all(void)
 {
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
     ns_list_foreach(cmd_variable_t, cur_ptr, &cmd.variable_list) {
-        if (cur_ptr->type == VALUE_TYPE_STR) {
-            cmd_printf("%s='%s'\r\n", cur_ptr->name_ptr, cur_ptr->value.ptr ? cur_ptr->value.ptr : "");
-        } else if (cur_ptr->type == VALUE_TYPE_INT) {
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd.json) {
+            cmd_json_begin("variable");
+            cmd_json_str("name", cur_ptr->name_ptr);
+            if (cur_ptr->type == VALUE_TYPE_INT) {
+                cmd_json_int("value", cur_ptr->value.i);
+            } else {
+                cmd_json_str("value", cmd_variable_str(cur_ptr));
+            }
+            cmd_json_end();
+            continue;
+        }
+#endif
+        if (cur_ptr->type == VALUE_TYPE_INT) {
             cmd_printf("%s=%d\r\n", cur_ptr->name_ptr, cur_ptr->value.i);
+        } else {
+            const char *value = cmd_variable_str(cur_ptr);
+            cmd_printf("%s='%s'\r\n", cur_ptr->name_ptr, value ? value : "");
         }
     }
     return;
 #endif
 }
 
+#if MBED_CONF_CMDLINE_ENABLE_ALIASES == 1
+static void cmd_alias_value_free(cmd_alias_t *alias_ptr)
+{
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+    if (alias_ptr->value_ptr == cmd.last_alias_value) {
+        return;
+    }
+#endif
+    cmd_mem_free(alias_ptr->value_ptr);
+}
+#endif
+
 void cmd_alias_add(const char *alias, const char *value)
 {
 #if MBED_CONF_CMDLINE_ENABLE_ALIASES == 0
@@ -2002,42 +5307,72 @@ void cmd_alias_add(const char *alias, const char *value)
         if (strlen(value) == 0) {
             return;    // no need to add new empty one
         }
-        alias_ptr = (cmd_alias_t *)MEM_ALLOC(sizeof(cmd_alias_t));
-        if (alias_ptr == NULL) {
-            tr_error("Mem alloc fail in cmd_alias_add");
-            return;
-        }
-        alias_ptr->name_ptr = (char *)MEM_ALLOC(strlen(alias) + 1);
-        if (alias_ptr->name_ptr == NULL) {
-            MEM_FREE(alias_ptr);
-            tr_error("Mem alloc fail in cmd_alias_add name_ptr");
-            return;
+        if (strcmp(alias, ALIAS_LAST) == 0) {
+            alias_ptr = &cmd.last_alias;
+            alias_ptr->name_ptr = (char *)ALIAS_LAST;
+        } else {
+            alias_ptr = (cmd_alias_t *)cmd_mem_alloc(CMDLINE_MEM_ALIASES, CMD_MEM_OBJECT, sizeof(cmd_alias_t));
+            if (alias_ptr == NULL) {
+                tr_error("Mem alloc fail in cmd_alias_add");
+                return;
+            }
+            alias_ptr->name_ptr = (char *)cmd_mem_alloc(CMDLINE_MEM_ALIASES, CMD_MEM_BUFFER, strlen(alias) + 1);
+            if (alias_ptr->name_ptr == NULL) {
+                cmd_mem_free(alias_ptr);
+                tr_error("Mem alloc fail in cmd_alias_add name_ptr");
+                return;
+            }
+            strcpy(alias_ptr->name_ptr, alias);
         }
         ns_list_add_to_end(&cmd.alias_list, alias_ptr);
-        strcpy(alias_ptr->name_ptr, alias);
         alias_ptr->value_ptr = NULL;
+        alias_ptr->value_size = 0;
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+        if (alias_ptr == &cmd.last_alias) {
+            // executed lines do not fit to alias value blocks
+            alias_ptr->value_ptr = cmd.last_alias_value;
+            alias_ptr->value_size = sizeof(cmd.last_alias_value);
+        }
+#endif
     }
     if (value == NULL || strlen(value) == 0) {
         // delete this one
         ns_list_remove(&cmd.alias_list, alias_ptr);
-        MEM_FREE(alias_ptr->name_ptr);
-        MEM_FREE(alias_ptr->value_ptr);
-        MEM_FREE(alias_ptr);
+        cmd_alias_value_free(alias_ptr);
+        if (alias_ptr == &cmd.last_alias) {
+            alias_ptr->name_ptr = NULL;
+            alias_ptr->value_ptr = NULL;
+        } else {
+            cmd_mem_free(alias_ptr->name_ptr);
+            cmd_mem_free(alias_ptr);
+        }
     } else {
-        // add new or modify
-        if (alias_ptr->value_ptr != NULL) {
-            MEM_FREE(alias_ptr->value_ptr);
-        }
-        alias_ptr->value_ptr = (char *)MEM_ALLOC(strlen(value) + 1);
-        if (alias_ptr->value_ptr == NULL) {
-            cmd_alias_add(alias, NULL);
-            tr_error("Mem alloc fail in cmd_alias_add value_ptr");
-            return;
+        // add new or modify, buffer is reused when value fits to it
+        size_t size = strlen(value) + 1;
+        if (alias_ptr->value_size < size) {
+            cmd_alias_value_free(alias_ptr);
+            alias_ptr->value_size = 0;
+            alias_ptr->value_ptr = (char *)cmd_mem_alloc(CMDLINE_MEM_ALIASES, CMD_MEM_BUFFER, size);
+            if (alias_ptr->value_ptr == NULL) {
+                cmd_alias_add(alias, NULL);
+                tr_error("Mem alloc fail in cmd_alias_add value_ptr");
+                return;
+            }
+            alias_ptr->value_size = size;
         }
-        strcpy(alias_ptr->value_ptr, value);
+        memmove(alias_ptr->value_ptr, value, size);
+    }
+    return;
+#endif
+}
+
+static void cmd_variable_value_free(cmd_variable_t *variable_ptr)
+{
+    if (variable_ptr->type == VALUE_TYPE_STR) {
+        cmd_mem_free(variable_ptr->value.ptr);
     }
-    return;
-#endif
+    variable_ptr->type = VALUE_TYPE_INT;
+    variable_ptr->value.i = 0;
 }
 
 static cmd_variable_t *cmd_variable_add_prepare(char *variable, char *value)
@@ -2059,31 +5394,38 @@ static cmd_variable_t *cmd_variable_add_prepare(char *variable, char *value)
         if (strlen(value) == 0) {
             return NULL;    // no need to add new empty one
         }
-        variable_ptr = (cmd_variable_t *)MEM_ALLOC(sizeof(cmd_variable_t));
-        if (variable_ptr == NULL) {
-            tr_error("Mem alloc failed cmd_variable_add");
-            return NULL;
-        }
-        variable_ptr->name_ptr = (char *)MEM_ALLOC(strlen(variable) + 1);
-        if (variable_ptr->name_ptr == NULL) {
-            MEM_FREE(variable_ptr);
-            tr_error("Mem alloc failed cmd_variable_add name_ptr");
-            return NULL;
+        variable_ptr = cmd_variable_slot(variable);
+        if (variable_ptr) {
+            variable_ptr->name_ptr = (char *)cmd_special_var_names[variable_ptr - cmd.special_vars];
+        } else {
+            variable_ptr = (cmd_variable_t *)cmd_mem_alloc(CMDLINE_MEM_VARIABLES, CMD_MEM_OBJECT, sizeof(cmd_variable_t));
+            if (variable_ptr == NULL) {
+                tr_error("Mem alloc failed cmd_variable_add");
+                return NULL;
+            }
+            variable_ptr->name_ptr = (char *)cmd_mem_alloc(CMDLINE_MEM_VARIABLES, CMD_MEM_BUFFER, strlen(variable) + 1);
+            if (variable_ptr->name_ptr == NULL) {
+                cmd_mem_free(variable_ptr);
+                tr_error("Mem alloc failed cmd_variable_add name_ptr");
+                return NULL;
+            }
+            strcpy(variable_ptr->name_ptr, variable);
         }
-
         ns_list_add_to_end(&cmd.variable_list, variable_ptr);
-        strcpy(variable_ptr->name_ptr, variable);
-        variable_ptr->value.ptr = NULL;
+        variable_ptr->type = VALUE_TYPE_INT;
+        variable_ptr->value.i = 0;
     }
     if (value == NULL || strlen(value) == 0) {
         // delete this one
         tr_debug("Remove variable: %s", variable);
         ns_list_remove(&cmd.variable_list, variable_ptr);
-        MEM_FREE(variable_ptr->name_ptr);
-        if (variable_ptr->type == VALUE_TYPE_STR) {
-            MEM_FREE(variable_ptr->value.ptr);
+        cmd_variable_value_free(variable_ptr);
+        if (cmd_variable_slot(variable_ptr->name_ptr) == variable_ptr) {
+            variable_ptr->name_ptr = NULL;
+        } else {
+            cmd_mem_free(variable_ptr->name_ptr);
+            cmd_mem_free(variable_ptr);
         }
-        MEM_FREE(variable_ptr);
         return NULL;
     }
     return variable_ptr;
@@ -2096,12 +5438,7 @@ void cmd_variable_add_int(char *variable, int value)
     if (variable_ptr == NULL) {
         return;
     }
-    if (variable_ptr->value.ptr != NULL &&
-            variable_ptr->type == VALUE_TYPE_STR) {
-        // free memory
-        MEM_FREE(variable_ptr->value.ptr);
-    }
-    variable_ptr->type = VALUE_TYPE_INT;
+    cmd_variable_value_free(variable_ptr);
     variable_ptr->value.i = value;
 }
 
@@ -2115,27 +5452,27 @@ void cmd_variable_add(char *variable, char *value)
     replace_string(value, value_len, "\\n", "\n");
     replace_string(value, value_len, "\\r", "\r");
 
-    // add new or modify
-    int new_len = strlen(value) + 1;
-    int old_len = 0;
-    if (variable_ptr->value.ptr != NULL &&
-            variable_ptr->type == VALUE_TYPE_STR) {
-        // free memory if required
-        old_len = strlen(variable_ptr->value.ptr) + 1;
-        if (old_len != new_len) {
-            MEM_FREE(variable_ptr->value.ptr);
-        }
+    // add new or modify, short values are inline and allocated buffer is reused when value fits to it
+    size_t size = strlen(value) + 1;
+    if (size <= MBED_CMDLINE_VALUE_INLINE_SIZE) {
+        cmd_variable_value_free(variable_ptr);
+        variable_ptr->type = VALUE_TYPE_INLINE;
+        memcpy(variable_ptr->value.str, value, size);
+        return;
     }
-    if (old_len != new_len) {
-        variable_ptr->value.ptr = (char *)MEM_ALLOC(new_len);
+    if (variable_ptr->type != VALUE_TYPE_STR || variable_ptr->value_size < size) {
+        cmd_variable_value_free(variable_ptr);
+        variable_ptr->value.ptr = (char *)cmd_mem_alloc(CMDLINE_MEM_VARIABLES, CMD_MEM_BUFFER, size);
         if (variable_ptr->value.ptr == NULL) {
+            variable_ptr->value.i = 0;
             cmd_variable_add(variable, NULL);
             tr_error("Mem alloc failed cmd_variable_add value_ptr");
             return;
         }
+        variable_ptr->type = VALUE_TYPE_STR;
+        variable_ptr->value_size = size;
     }
-    variable_ptr->type = VALUE_TYPE_STR;
-    strcpy(variable_ptr->value.ptr, value);
+    memmove(variable_ptr->value.ptr, value, size);
     return;
 }
 
@@ -2162,7 +5499,9 @@ int alias_command(int argc, char *argv[])
 {
     if (argc == 1) {
         // print all alias
-        cmd_printf("alias:\r\n");
+        if (!cmd_json_mode()) {
+            cmd_printf("alias:\r\n");
+        }
         cmd_alias_print_all();
     } else if (argc == 2) {
         // print alias
@@ -2176,6 +5515,10 @@ int alias_command(int argc, char *argv[])
         // set alias
         tr_debug("Setting alias %s = %s", argv[1], argv[2]);
         cmd_alias_add(argv[1], argv[2]);
+        if (strlen(argv[2]) > 0 && alias_find(argv[1]) == NULL) {
+            cmd_printf("Cannot store alias %s: out of memory\r\n", argv[1]);
+            return CMDLINE_RETCODE_FAIL;
+        }
     }
     return 0;
 }
@@ -2204,11 +5547,24 @@ int set_command(int argc, char *argv[])
     return 0;
 }
 #else
+// set variable and report when it could not be stored
+static int cmd_variable_set(char *variable, char *value)
+{
+    cmd_variable_add(variable, value);
+    if (strlen(value) > 0 && variable_find(variable) == NULL) {
+        cmd_printf("Cannot store variable %s: out of memory\r\n", variable);
+        return CMDLINE_RETCODE_FAIL;
+    }
+    return 0;
+}
+
 int set_command(int argc, char *argv[])
 {
     if (argc == 1) {
-        // print all alias
-        cmd_printf("variables:\r\n");
+        // print all variables
+        if (!cmd_json_mode()) {
+            cmd_printf("variables:\r\n");
+        }
         cmd_variable_print_all();
     } else if (argc == 2) {
         char *separator_ptr = strchr(argv[1], '=');
@@ -2216,7 +5572,7 @@ int set_command(int argc, char *argv[])
             return CMDLINE_RETCODE_INVALID_PARAMETERS;
         }
         *separator_ptr = 0;
-        cmd_variable_add(argv[1], separator_ptr + 1);
+        return cmd_variable_set(argv[1], separator_ptr + 1);
     } else {
         // set alias
         tr_debug("Setting variable %s = %s", argv[1], argv[2]);
@@ -2227,6 +5583,12 @@ int set_command(int argc, char *argv[])
             cmd.vt100_on = state;
             return 0;
         }
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd_parameter_bool(argc, argv, "--json", &state)) {
+            cmd.json = state;
+            return 0;
+        }
 #endif
         if (cmd_parameter_bool(argc, argv, "--retcode", &state)) {
             cmd_variable_add(VAR_RETFMT, state ? DEFAULT_RETFMT : NULL);
@@ -2234,10 +5596,9 @@ int set_command(int argc, char *argv[])
         }
         char *str;
         if (cmd_parameter_val(argc, argv, "--retfmt", &str)) {
-            cmd_variable_add(VAR_RETFMT, str);
-            return 0;
+            return cmd_variable_set(VAR_RETFMT, str);
         }
-        cmd_variable_add(argv[1], argv[2]);
+        return cmd_variable_set(argv[1], argv[2]);
     }
     return 0;
 }
@@ -2280,6 +5641,24 @@ int clear_command(int argc, char *argv[])
 
 int help_command(int argc, char *argv[])
 {
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    if (cmd.json) {
+        if (argc == 1) {
+            ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
+                cmd_json_command(cur_ptr, false);
+            }
+        } else if (argc == 2) {
+            cmd_command_t *cmd_ptr = cmd_find(argv[1]);
+            if (cmd_ptr) {
+                cmd_json_command(cmd_ptr, true);
+            } else {
+                cmd_json_error("Command not found", argv[1]);
+                return CMDLINE_RETCODE_COMMAND_NOT_FOUND;
+            }
+        }
+        return 0;
+    }
+#endif
     cmd_printf("Commands:\r\n");
     if (argc == 1) {
         ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
@@ -2291,8 +5670,13 @@ int help_command(int argc, char *argv[])
             cmd_printf("Command: %s\r\n", cmd_ptr->name_ptr);
             if (cmd_ptr->man_ptr) {
                 cmd_printf("%s\r\n", cmd_ptr->man_ptr);
-            } else if (cmd_ptr->info_ptr) {
-                cmd_printf("%s\r\n", cmd_ptr->info_ptr);
+            } else {
+                if (cmd_ptr->info_ptr) {
+                    cmd_printf("%s\r\n", cmd_ptr->info_ptr);
+                }
+                if (cmd_ptr->schema_ptr) {
+                    cmd_schema_print(cmd_ptr);
+                }
             }
         } else {
             cmd_printf("Command '%s' not found", argv[1]);
@@ -2318,18 +5702,35 @@ int false_command(int argc, char *argv[])
 int history_command(int argc, char *argv[])
 {
 #if MBED_CONF_CMDLINE_ENABLE_HISTORY
+    cmd_history_load();
     if (argc == 1) {
-        int history_size = (int)ns_list_count(&cmd.history_list);
-        cmd_printf("History [%i/%i]:\r\n", history_size - 1, cmd.history_max_count - 1);
-        int i = 0;
-        ns_list_foreach_reverse(cmd_history_t, cur_ptr, &cmd.history_list) {
-            if (i != history_size - 1) {
-                cmd_printf("[%i]: %s\r\n", i++, cur_ptr->command_ptr);
-            }
+        int history_size = cmd_history_count();
+        if (!cmd_json_mode()) {
+            cmd_printf("History [%i/%i]:\r\n", history_size - 1, cmd.history_max_count - 1);
+        }
+        for (int i = 0; i < history_size - 1; i++) {
+            char *tmp_ptr;
+            const char *command = cmd_history_text(history_size - 1 - i, &tmp_ptr);
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+            if (cmd.json) {
+                cmd_json_begin("history");
+                cmd_json_int("index", i);
+                cmd_json_str("command", command);
+                cmd_json_end();
+            } else
+#endif
+                cmd_printf("[%i]: %s\r\n", i, command);
+            cmd_mem_free(tmp_ptr);
         }
     } else if (argc == 2) {
         if (strcmp(argv[1], "clear") == 0) {
             cmd_history_clean();
+            if (cmd.history_store.reset) {
+                cmd.history_store.reset(cmd.history_store.ctx);
+            }
+            cmd.history_log_count = 0;
+            cmd.history_loaded = true;
+            cmd.history_compact = -1;
         } else {
             cmd_history_size(strtoul(argv[1], 0, 10));
         }
@@ -2341,12 +5742,203 @@ int history_command(int argc, char *argv[])
     return 0;
 }
 
-/** Parameter helping functions
+int meminfo_command(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    static const char *const names[CMDLINE_MEM_TOTAL + 1] = {
+        "commands", "aliases", "variables", "history", "exec", "total"
+    };
+    if (!cmd_json_mode()) {
+        cmd_printf("%-12s%10s%10s%10s%10s\r\n", "subsystem", "current", "peak", "allocs", "failures");
+    }
+    for (int i = 0; i <= CMDLINE_MEM_TOTAL; i++) {
+        const cmd_mem_stats_t *stats_ptr = &cmd.mem_stats[i];
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd.json) {
+            cmd_json_begin("meminfo");
+            cmd_json_str("subsystem", names[i]);
+            cmd_json_uint("current", stats_ptr->current);
+            cmd_json_uint("peak", stats_ptr->peak);
+            cmd_json_uint("allocs", stats_ptr->allocs);
+            cmd_json_uint("failures", stats_ptr->failures);
+            cmd_json_end();
+            continue;
+        }
+#endif
+        cmd_printf("%-12s%10lu%10lu%10lu%10lu\r\n", names[i],
+                   (unsigned long)stats_ptr->current, (unsigned long)stats_ptr->peak,
+                   (unsigned long)stats_ptr->allocs, (unsigned long)stats_ptr->failures);
+    }
+#endif
+    return 0;
+}
+
+int stats_command(int argc, char *argv[])
+{
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+    if (argc > 1) {
+        if (strcmp(argv[1], "reset") != 0 || argc > 3) {
+            return CMDLINE_RETCODE_INVALID_PARAMETERS;
+        }
+        if (argc == 3 && cmd_find(argv[2]) == NULL) {
+            cmd_printf("Command '%s' not found.\r\n", argv[2]);
+            return CMDLINE_RETCODE_FAIL;
+        }
+        cmd_stats_reset(argc == 3 ? argv[2] : NULL);
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+    if (!cmd_json_mode()) {
+        cmd_printf("%-16s%8s%8s%8s%10s%10s%10s%10s\r\n",
+                   "command", "calls", "fails", "busy", "total", "min", "max", "last");
+    }
+    ns_list_foreach(cmd_command_t, cur_ptr, &cmd.command_list) {
+        cmd_stats_t stats;
+        // commands which have not been executed are not listed
+        if (CMD_INTERNAL(cur_ptr)->stats_ptr == NULL || !cmd_stats(cur_ptr->name_ptr, &stats) ||
+                (stats.calls == 0 && stats.busy == 0)) {
+            continue;
+        }
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+        if (cmd.json) {
+            cmd_json_begin("stats");
+            cmd_json_str("command", cur_ptr->name_ptr);
+            cmd_json_uint("calls", stats.calls);
+            cmd_json_uint("failures", stats.failures);
+            cmd_json_uint("busy", stats.busy);
+            cmd_json_uint("total", stats.total_time);
+            cmd_json_uint("min", stats.min_time);
+            cmd_json_uint("max", stats.max_time);
+            cmd_json_uint("last", stats.last_time);
+            cmd_json_end();
+            continue;
+        }
+#endif
+        cmd_printf("%-16s%8lu%8lu%8lu%10lu%10lu%10lu%10lu\r\n", cur_ptr->name_ptr,
+                   (unsigned long)stats.calls, (unsigned long)stats.failures, (unsigned long)stats.busy,
+                   (unsigned long)stats.total_time, (unsigned long)stats.min_time,
+                   (unsigned long)stats.max_time, (unsigned long)stats.last_time);
+    }
+#else
+    (void)argc;
+    (void)argv;
+#endif
+    return 0;
+}
+
+/* Trace export.
+ * Records are printed as hex of 8 byte little endian records: time (4 bytes),
+ * event, zero and arg (2 bytes), four records per line:
+ *   trace: version 1, records <n>, dropped <n>
+ *   trace: <hex>
+ *   trace: end
+ * Recording is paused while the ring is printed, so output of the command
+ * does not overwrite records which are not yet printed.
  */
-int cmd_parameter_index(int argc, char *argv[], const char *key)
+#define CMD_TRACE_EXPORT_RECORDS 4
+int trace_command(int argc, char *argv[])
 {
-    int i = 0;
-    for (i = 1; i < argc; i++) {
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+    static const char hex[] = "0123456789abcdef";
+    cmd_trace_record_t records[CMD_TRACE_EXPORT_RECORDS];
+    char line[CMD_TRACE_EXPORT_RECORDS * 16 + 1];
+    if (argc > 1) {
+        if (argc == 2 && strcmp(argv[1], "clear") == 0) {
+            cmd_trace_clear();
+            return CMDLINE_RETCODE_SUCCESS;
+        }
+        return CMDLINE_RETCODE_INVALID_PARAMETERS;
+    }
+    uint32_t total = cmd.trace_count;
+    uint32_t first = total > MBED_CONF_CMDLINE_TRACE_RING_SIZE ? total - MBED_CONF_CMDLINE_TRACE_RING_SIZE : 0;
+    cmd.trace_paused = true;
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+    if (cmd.json) {
+        for (uint32_t i = first; i != total; i++) {
+            cmd_trace_record_t record = cmd.trace[i & (MBED_CONF_CMDLINE_TRACE_RING_SIZE - 1)];
+            cmd_json_begin("trace");
+            cmd_json_uint("index", i);
+            cmd_json_uint("time", record.time);
+            cmd_json_uint("event", record.event);
+            cmd_json_uint("arg", record.arg);
+            cmd_json_end();
+        }
+        cmd.trace_paused = false;
+        return CMDLINE_RETCODE_SUCCESS;
+    }
+#endif
+    cmd_printf("trace: version 1, records %lu, dropped %lu\r\n",
+               (unsigned long)(total - first), (unsigned long)first);
+    for (uint32_t i = first; i != total;) {
+        int n = 0;
+        for (; n < CMD_TRACE_EXPORT_RECORDS && i != total; n++, i++) {
+            records[n] = cmd.trace[i & (MBED_CONF_CMDLINE_TRACE_RING_SIZE - 1)];
+        }
+        char *ptr = line;
+        for (int r = 0; r < n; r++) {
+            uint8_t bytes[8] = {
+                (uint8_t)records[r].time, (uint8_t)(records[r].time >> 8),
+                (uint8_t)(records[r].time >> 16), (uint8_t)(records[r].time >> 24),
+                records[r].event, 0, (uint8_t)records[r].arg, (uint8_t)(records[r].arg >> 8)
+            };
+            for (int b = 0; b < 8; b++) {
+                *ptr++ = hex[bytes[b] >> 4];
+                *ptr++ = hex[bytes[b] & 0x0f];
+            }
+        }
+        *ptr = 0;
+        cmd_printf("trace: %s\r\n", line);
+    }
+    cmd_printf("trace: end\r\n");
+    cmd.trace_paused = false;
+#else
+    (void)argc;
+    (void)argv;
+#endif
+    return 0;
+}
+
+/* Option index.
+ * Arguments are kept in an open addressing hash table keyed by option name,
+ * which is the part before '=' in "--key=value" arguments, so exact and value
+ * lookups probe the same slots. Arguments with equal names are found in argv
+ * order. Short option characters are collected to a bitmap.
+ */
+// slots keep argv index of at most CMDLINE_OPTIONS_SLOTS / 2 in uint8_t
+#if CMDLINE_OPTIONS_SLOTS > 256 || (CMDLINE_OPTIONS_SLOTS & (CMDLINE_OPTIONS_SLOTS - 1)) != 0
+#error "CMDLINE_OPTIONS_SLOTS must be power of two, at most 256"
+#endif
+#define CMD_OPTIONS_MASK (CMDLINE_OPTIONS_SLOTS - 1)
+
+static size_t cmd_options_name_len(const char *str)
+{
+    if (str[0] == '-' && str[1] == '-') {
+        const char *eq_ptr = strchr(str, '=');
+        if (eq_ptr) {
+            return eq_ptr - str;
+        }
+    }
+    return strlen(str);
+}
+
+static bool cmd_options_is_short(const char *arg)
+{
+    return arg[0] == '-' && arg[1] != '-';
+}
+
+// value of option argv[i], which name length is len
+static char *cmd_options_arg_value(int argc, char *argv[], int i, size_t len)
+{
+    if (argv[i][len] == '=') {
+        return argv[i] + len + 1;
+    }
+    return i + 1 < argc ? argv[i + 1] : NULL;
+}
+
+static int cmd_options_scan_index(int argc, char *argv[], int from, const char *key)
+{
+    for (int i = from > 1 ? from : 1; i < argc; i++) {
         if (strcmp(argv[i], key) == 0) {
             return i;
         }
@@ -2354,66 +5946,156 @@ int cmd_parameter_index(int argc, char *argv[], const char *key)
     return -1;
 }
 
-bool cmd_has_option(int argc, char *argv[], const char *key)
+static char *cmd_options_scan_value(int argc, char *argv[], int from, const char *key)
 {
-    int i = 0;
-    for (i = 1; i < argc; i++) {
-        if (argv[i][0] == '-' &&  argv[i][1] != '-') {
-            if (strstr(argv[i], key) != 0) {
-                return true;
-            }
+    size_t len = cmd_options_name_len(key);
+    for (int i = from > 1 ? from : 1; i < argc; i++) {
+        if (cmd_options_name_len(argv[i]) == len && memcmp(argv[i], key, len) == 0) {
+            return cmd_options_arg_value(argc, argv, i, len);
+        }
+    }
+    return NULL;
+}
+
+static bool cmd_options_scan_short(int argc, char *argv[], const char *key)
+{
+    for (int i = 1; i < argc; i++) {
+        if (cmd_options_is_short(argv[i]) && strstr(argv[i], key) != 0) {
+            return true;
         }
     }
     return false;
 }
 
-bool cmd_parameter_bool(int argc, char *argv[], const char *key, bool *value)
+void cmd_options_init(cmd_options_t *opts, int argc, char *argv[])
 {
-    int i = cmd_parameter_index(argc, argv, key);
-    if (i > 0) {
-        if (argc > (i + 1)) {
-            if (strcmp(argv[i + 1], "on") == 0 ||
-                    strcmp(argv[i + 1], "1") == 0 ||
-                    strcmp(argv[i + 1], "true") == 0 ||
-                    strcmp(argv[i + 1], "enable") == 0 ||
-                    strcmp(argv[i + 1], "allow") == 0) {
-                *value = true;
-            } else {
-                *value = false;
+    memset(opts, 0, sizeof(cmd_options_t));
+    opts->argv = argv;
+    opts->argc = argc;
+    opts->indexed = argc < CMDLINE_OPTIONS_SLOTS / 2 + 1 ? argc : CMDLINE_OPTIONS_SLOTS / 2 + 1;
+    for (int i = 1; i < argc; i++) {
+        const uint8_t *arg = (const uint8_t *)argv[i];
+        if (cmd_options_is_short(argv[i])) {
+            for (; *arg; arg++) {
+                opts->short_opts[*arg >> 5] |= 1u << (*arg & 31);
             }
-            return true;
         }
+        if (i >= opts->indexed) {
+            continue;
+        }
+        uint32_t slot = cmd_str_hash(argv[i], cmd_options_name_len(argv[i])) & CMD_OPTIONS_MASK;
+        while (opts->slots[slot] && strcmp(argv[opts->slots[slot]], argv[i]) != 0) {
+            slot = (slot + 1) & CMD_OPTIONS_MASK;
+        }
+        if (opts->slots[slot] == 0) {
+            opts->slots[slot] = i;
+        }
+    }
+}
+
+int cmd_options_index(const cmd_options_t *opts, const char *key)
+{
+    uint32_t slot = cmd_str_hash(key, cmd_options_name_len(key)) & CMD_OPTIONS_MASK;
+    for (; opts->slots[slot]; slot = (slot + 1) & CMD_OPTIONS_MASK) {
+        if (strcmp(opts->argv[opts->slots[slot]], key) == 0) {
+            return opts->slots[slot];
+        }
+    }
+    return cmd_options_scan_index(opts->argc, opts->argv, opts->indexed, key);
+}
+
+bool cmd_options_has(const cmd_options_t *opts, const char *key)
+{
+    if (key[0] != 0 && key[1] == 0) {
+        uint8_t c = key[0];
+        return (opts->short_opts[c >> 5] >> (c & 31)) & 1;
+    }
+    return cmd_options_scan_short(opts->argc, opts->argv, key);
+}
+
+char *cmd_options_value(const cmd_options_t *opts, const char *key)
+{
+    size_t len = cmd_options_name_len(key);
+    uint32_t slot = cmd_str_hash(key, len) & CMD_OPTIONS_MASK;
+    for (; opts->slots[slot]; slot = (slot + 1) & CMD_OPTIONS_MASK) {
+        int i = opts->slots[slot];
+        if (cmd_options_name_len(opts->argv[i]) == len && memcmp(opts->argv[i], key, len) == 0) {
+            return cmd_options_arg_value(opts->argc, opts->argv, i, len);
+        }
+    }
+    return cmd_options_scan_value(opts->argc, opts->argv, opts->indexed, key);
+}
+
+// index of running command, when argc and argv are from it
+static const cmd_options_t *cmd_options_of(int argc, char *argv[])
+{
+    if (argv != NULL && cmd.options.argv == argv && cmd.options.argc == argc) {
+        return &cmd.options;
+    }
+    return NULL;
+}
+
+static char *cmd_parameter_value(int argc, char *argv[], const char *key)
+{
+    const cmd_options_t *opts = cmd_options_of(argc, argv);
+    return opts ? cmd_options_value(opts, key) : cmd_options_scan_value(argc, argv, 1, key);
+}
+
+/** Parameter helping functions
+ */
+int cmd_parameter_index(int argc, char *argv[], const char *key)
+{
+    const cmd_options_t *opts = cmd_options_of(argc, argv);
+    return opts ? cmd_options_index(opts, key) : cmd_options_scan_index(argc, argv, 1, key);
+}
+
+bool cmd_has_option(int argc, char *argv[], const char *key)
+{
+    const cmd_options_t *opts = cmd_options_of(argc, argv);
+    return opts ? cmd_options_has(opts, key) : cmd_options_scan_short(argc, argv, key);
+}
+
+bool cmd_parameter_bool(int argc, char *argv[], const char *key, bool *value)
+{
+    char *str = cmd_parameter_value(argc, argv, key);
+    if (str) {
+        if (strcmp(str, "on") == 0 ||
+                strcmp(str, "1") == 0 ||
+                strcmp(str, "true") == 0 ||
+                strcmp(str, "enable") == 0 ||
+                strcmp(str, "allow") == 0) {
+            *value = true;
+        } else {
+            *value = false;
+        }
+        return true;
     }
     return false;
 }
 
 bool cmd_parameter_val(int argc, char *argv[], const char *key, char **value)
 {
-    int i = cmd_parameter_index(argc, argv, key);
-    if (i > 0) {
-        if (argc > (i + 1)) {
-            *value = argv[i + 1];
-            return true;
-        }
+    char *str = cmd_parameter_value(argc, argv, key);
+    if (str) {
+        *value = str;
+        return true;
     }
     return false;
 }
 
 bool cmd_parameter_int(int argc, char *argv[], const char *key, int32_t *value)
 {
-    int i = cmd_parameter_index(argc, argv, key);
+    char *str = cmd_parameter_value(argc, argv, key);
     char *tailptr;
-    if (i > 0) {
-        if (argc > (i + 1)) {
-            *value = strtol(argv[i + 1], &tailptr, 10);
-            if (0 == *tailptr) {
-                return true;
-            }
-            if (!isspace((unsigned char) *tailptr)) {
-                return false;
-            } else {
-                return true;
-            }
+    if (str) {
+        *value = strtol(str, &tailptr, 10);
+        if (0 == *tailptr) {
+            return true;
+        }
+        if (!isspace((unsigned char) *tailptr)) {
+            return false;
+        } else {
+            return true;
         }
     }
     return false;
@@ -2421,40 +6103,138 @@ bool cmd_parameter_int(int argc, char *argv[], const char *key, int32_t *value)
 
 bool cmd_parameter_float(int argc, char *argv[], const char *key, float *value)
 {
-    int i = cmd_parameter_index(argc, argv, key);
+    char *str = cmd_parameter_value(argc, argv, key);
     char *tailptr;
-    if (i > 0) {
-        if (argc > (i + 1)) {
-            *value = strtof(argv[i + 1], &tailptr);
-            if (0 == *tailptr) {
-                return true;    //Should be correct read always
-            }
-            if (!isspace((unsigned char) *tailptr)) {
-                return false;   //Garbage in tailptr
-            } else {
-                return true;    //Spaces are fine after float
-            }
+    if (str) {
+        *value = strtof(str, &tailptr);
+        if (0 == *tailptr) {
+            return true;    //Should be correct read always
+        }
+        if (!isspace((unsigned char) *tailptr)) {
+            return false;   //Garbage in tailptr
+        } else {
+            return true;    //Spaces are fine after float
         }
     }
     return false;
 }
 
-// convert hex string (eg. "76 ab ff") to binary array
-static int string_to_bytes(const char *str, uint8_t *buf, int bytes)
+/* Bulk parsers.
+ * Hand written single pass conversions, which do not depend on locale and do
+ * not call strtoul() for every value.
+ */
+static int cmd_hex_digit(uint8_t c)
 {
-    int len = strlen(str);
-    if (len <= (3 * bytes - 1)) {
-        int i;
-        for (i = 0; i < bytes; i++) {
-            if (i * 3 < len) {
-                buf[i] = (uint8_t)strtoul(str + i * 3, 0, 16);
-            } else {
-                buf[i] = 0;
+    uint8_t value = c - '0';
+    if (value < 10) {
+        return value;
+    }
+    value = (c | 0x20) - 'a';
+    return value < 6 ? value + 10 : -1;
+}
+
+// convert hex string (eg. "76:ab:ff", "76 ab ff" or "76abff") to binary array
+static int cmd_parse_bytes(const char *str, uint8_t *buf, size_t size)
+{
+    size_t count = 0;
+    bool separated = true; // single digit byte needs separators around it
+    if (str[0] == '0' && (str[1] | 0x20) == 'x') {
+        str += 2;
+    }
+    while (*str) {
+        int high = cmd_hex_digit(str[0]);
+        int low = high < 0 ? -1 : cmd_hex_digit(str[1]);
+        if (high < 0 || count == size) {
+            return -1;
+        }
+        if (low >= 0) {
+            buf[count++] = (uint8_t)(high << 4 | low);
+            str += 2;
+        } else if (separated) {
+            buf[count++] = (uint8_t)high;
+            str++;
+        } else {
+            return -1;
+        }
+        separated = *str == ':' || *str == ' ';
+        if (separated) {
+            if (*++str == 0) {
+                return -1;
             }
+        } else if (low < 0 && *str) {
+            return -1;
         }
-        return 0;
     }
-    return -1;
+    return count;
+}
+
+// convert list of integers (eg. "1,-2,0x30" or "1 2 3") to array
+static int cmd_parse_int_array(const char *str, int32_t *values, size_t size)
+{
+    size_t count = 0;
+    while (*str == ' ') {
+        str++;
+    }
+    while (*str) {
+        bool negative = *str == '-';
+        if (negative || *str == '+') {
+            str++;
+        }
+        uint32_t limit = negative ? 0x80000000u : 0x7fffffffu;
+        uint32_t value = 0;
+        const char *digits = str;
+        if (str[0] == '0' && (str[1] | 0x20) == 'x') {
+            int digit;
+            digits = str += 2;
+            while ((digit = cmd_hex_digit(*str)) >= 0) {
+                if (value > (limit - digit) >> 4) {
+                    return -1;
+                }
+                value = value << 4 | digit;
+                str++;
+            }
+        } else {
+            uint8_t digit;
+            while ((digit = (uint8_t)(*str - '0')) < 10) {
+                if (value > (limit - digit) / 10) {
+                    return -1;
+                }
+                value = value * 10 + digit;
+                str++;
+            }
+        }
+        if (str == digits || count == size) {
+            return -1;
+        }
+        values[count++] = negative ? (int32_t)(0 - value) : (int32_t)value;
+        while (*str == ' ') {
+            str++;
+        }
+        if (*str == ',') {
+            str++;
+            while (*str == ' ') {
+                str++;
+            }
+            if (*str == 0) {
+                return -1;
+            }
+        } else if (*str && str[-1] != ' ') {
+            return -1;
+        }
+    }
+    return count;
+}
+
+int cmd_parameter_bytes(int argc, char *argv[], const char *key, uint8_t *buf, size_t size)
+{
+    char *str = cmd_parameter_value(argc, argv, key);
+    return str ? cmd_parse_bytes(str, buf, size) : -1;
+}
+
+int cmd_parameter_int_array(int argc, char *argv[], const char *key, int32_t *values, size_t count)
+{
+    char *str = cmd_parameter_value(argc, argv, key);
+    return str ? cmd_parse_int_array(str, values, count) : -1;
 }
 
 static uint64_t read_64_bit(const uint8_t data_buf[__static 8])
@@ -2473,37 +6253,35 @@ static uint64_t read_64_bit(const uint8_t data_buf[__static 8])
 
 bool cmd_parameter_timestamp(int argc, char *argv[], const char *key, int64_t *value)
 {
-    int i = cmd_parameter_index(argc, argv, key);
-    if (i > 0) {
-        if (argc > (i + 1)) {
-            if (strchr(argv[i + 1], ',') != 0) {
-                // Format seconds,tics
-                const char splitValue[] = ", ";
-                char *token;
-                token = strtok(argv[i + 1], splitValue);
-                if (token) {
-                    *value = (int64_t)strtoul(token, 0, 10) << 16;
-                }
-                token = strtok(NULL, splitValue);
-                if (token) {
-                    *value |= (0xffff & strtoul(token, 0, 10));
-                }
-            } else if (strchr(argv[i + 1], ':') != 0) {
-                // Format 00:00:00:00:00:00:00:00
-                uint8_t buf[8];
-                if (strlen(argv[i + 1]) == 23 &&
-                        string_to_bytes(argv[i + 1], buf, 8) == 0) {
-                    *value = read_64_bit(buf);
-                } else {
-                    cmd_printf("timestamp should be 8 bytes long\r\n");
-                    return false;
-                }
+    char *str = cmd_parameter_value(argc, argv, key);
+    if (str) {
+        if (strchr(str, ',') != 0) {
+            // Format seconds,tics
+            const char splitValue[] = ", ";
+            char *token;
+            token = strtok(str, splitValue);
+            if (token) {
+                *value = (int64_t)strtoul(token, 0, 10) << 16;
+            }
+            token = strtok(NULL, splitValue);
+            if (token) {
+                *value |= (0xffff & strtoul(token, 0, 10));
+            }
+        } else if (strchr(str, ':') != 0) {
+            // Format 00:00:00:00:00:00:00:00
+            uint8_t buf[8];
+            if (strlen(str) == 23 &&
+                    cmd_parse_bytes(str, buf, 8) == 8) {
+                *value = read_64_bit(buf);
             } else {
-                // Format uint64
-                *value = strtol(argv[i + 1], 0, 10);
+                cmd_printf("timestamp should be 8 bytes long\r\n");
+                return false;
             }
-            return true;
+        } else {
+            // Format uint64
+            *value = strtol(str, 0, 10);
         }
+        return true;
     }
     return false;
 }
@@ -2567,3 +6345,69 @@ static int replace_string(
     }
     return 0;
 }
+
+/**
+ * convert unsigned integer to decimal string without printf engine.
+ * str needs to have room for MBED_CMDLINE_INT_STR_SIZE characters.
+ * \return length of the string
+ */
+static int cmd_utoa(uint32_t value, char *str)
+{
+    char tmp[MBED_CMDLINE_INT_STR_SIZE];
+    int i = 0, len = 0;
+    do {
+        tmp[i++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+    while (i > 0) {
+        str[len++] = tmp[--i];
+    }
+    str[len] = 0;
+    return len;
+}
+
+/**
+ * convert integer to decimal string without printf engine.
+ * str needs to have room for MBED_CMDLINE_INT_STR_SIZE characters.
+ * \return length of the string
+ */
+static int cmd_itoa(int value, char *str)
+{
+    if (value < 0) {
+        // use unsigned to handle INT_MIN correctly
+        *str = '-';
+        return 1 + cmd_utoa(0u - (uint32_t)value, str + 1);
+    }
+    return cmd_utoa((uint32_t)value, str);
+}
+
+/**
+ * print retcode using retfmt format.
+ * Formats which contains only %i, %d and %% conversions are handled without
+ * printf engine, others are given as they are to the output function.
+ */
+static void cmd_print_retcode(const char *retfmt, int retcode)
+{
+    const char *ptr;
+    for (ptr = retfmt; *ptr; ptr++) {
+        if (*ptr == '%') {
+            ptr++;
+            if (*ptr != 'i' && *ptr != 'd' && *ptr != '%') {
+                cmd_printf(retfmt, retcode);
+                return;
+            }
+        }
+    }
+    cmd_mutex_lock();
+    for (ptr = retfmt; *ptr; ptr++) {
+        if (*ptr != '%') {
+            cmd_fmt_putc(*ptr);
+        } else if (*(++ptr) == '%') {
+            cmd_fmt_putc('%');
+        } else {
+            cmd_fmt_int(retcode);
+        }
+    }
+    cmd_fmt_flush();
+    cmd_mutex_unlock();
+}
@@ -0,0 +1,382 @@
+/*
+ * Copyright (c) 2015-2019, Pelion and affiliates.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file \test\Bench.cpp
+ *
+ * \brief Microbenchmarks for mbed-client-cli
+ *
+ * Usage: mbed_client_cli_bench_<variant> [--json] [--iterations N] [--filter text]
+ *
+ * Each benchmark reports time and allocations per operation. Allocations are
+ * counted with cmd_set_allocator(). Library traces go to stdout in this build,
+ * so stdout is redirected to /dev/null while benchmarks run and results are
+ * written to the original stdout.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef BENCH_VARIANT
+#define BENCH_VARIANT "unknown"
+#endif
+// features of the predefined configurations, see Test.cpp
+#if MBED_CONF_CMDLINE_USE_MINIMUM_SET == 1
+#define BENCH_FULL_SET 0
+#define BENCH_ARGUMENTS_MAX_COUNT 10
+#else
+#define BENCH_FULL_SET 1
+#define BENCH_ARGUMENTS_MAX_COUNT 30
+#endif
+
+#include "mbed-client-cli/ns_cmdline.h"
+
+#define ESCAPE(x) "\x1b" x
+#define ETX 0x03
+
+struct bench_result_t {
+    std::string name;
+    long iterations;
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+static uint64_t alloc_count = 0;
+static std::vector<bench_result_t> results;
+static long iterations = 20000;
+static const char *filter = NULL;
+
+static void *bench_alloc(void *ctx, size_t size)
+{
+    (void)ctx;
+    alloc_count++;
+    return malloc(size);
+}
+static void bench_free(void *ctx, void *ptr)
+{
+    (void)ctx;
+    free(ptr);
+}
+static const cmd_allocator_t bench_allocator = { bench_alloc, bench_free, NULL };
+
+// output is formatted like a real host would, then dropped
+static void bench_print(const char *fmt, va_list ap)
+{
+    static char buf[256];
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+}
+static int bench_cmd(int argc, char *argv[])
+{
+    (void)argc;
+    (void)argv;
+    return CMDLINE_RETCODE_SUCCESS;
+}
+
+static void bench_input(const char *str)
+{
+    while (*str != 0) {
+        cmd_char_input(*str++);
+    }
+}
+
+static void bench_init(void)
+{
+    cmd_set_allocator(&bench_allocator);
+    cmd_init(&bench_print);
+    cmd_add("bench", bench_cmd, NULL, NULL);
+}
+
+static void bench_deinit(void)
+{
+    cmd_free();
+    cmd_set_allocator(NULL);
+}
+
+// runs op for each iteration, ops_per_call operations are counted for each call
+static void bench_run(const std::string &name, const std::function<void(long)> &op, long ops_per_call = 1)
+{
+    if (filter && name.find(filter) == std::string::npos) {
+        return;
+    }
+    op(0); // warm up
+    uint64_t allocs_before = alloc_count;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++) {
+        op(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ops = (double)iterations * ops_per_call;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    results.push_back({name, iterations, ns / ops, (alloc_count - allocs_before) / ops});
+}
+
+// cmd_exe() with growing count of arguments
+static void bench_exe(void)
+{
+    const int counts[] = {1, 8, BENCH_ARGUMENTS_MAX_COUNT - 1};
+    for (int count : counts) {
+        std::string line = "bench";
+        for (int i = 0; i < count; i++) {
+            line += " argument" + std::to_string(i);
+        }
+        std::vector<char> str(line.size() + 1);
+        bench_init();
+        bench_run("exe/args=" + std::to_string(count) + "/bytes=" + std::to_string(line.size()), [&](long) {
+            memcpy(str.data(), line.c_str(), str.size());
+            cmd_exe(str.data());
+        });
+        bench_deinit();
+    }
+}
+
+// command chains separated with ';', cost per executed command
+static void bench_chain(void)
+{
+#if BENCH_FULL_SET == 1
+    const int counts[] = {1, 4, 16};
+    for (int count : counts) {
+        std::string line = "bench";
+        for (int i = 1; i < count; i++) {
+            line += ";bench";
+        }
+        std::vector<char> str(line.size() + 1);
+        bench_init();
+        bench_run("chain/commands=" + std::to_string(count), [&](long) {
+            memcpy(str.data(), line.c_str(), str.size());
+            cmd_exe(str.data());
+        }, count);
+        bench_deinit();
+    }
+#endif
+}
+
+// variable and alias expansion, the last defined one is used
+static void bench_expand(void)
+{
+#if BENCH_FULL_SET == 1
+    const int counts[] = {1, 16, 128};
+    for (int count : counts) {
+        char name[16];
+        char line[32];
+        bench_init();
+        for (int i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "var%d", i);
+            cmd_variable_add(name, (char *)"value");
+        }
+        snprintf(line, sizeof(line), "bench $var%d", count - 1);
+        std::string var_line = line;
+        bench_run("expand/variables=" + std::to_string(count), [&](long) {
+            strcpy(line, var_line.c_str());
+            cmd_exe(line);
+        });
+        bench_deinit();
+
+        bench_init();
+        for (int i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "alias%d", i);
+            cmd_alias_add(name, "bench");
+        }
+        snprintf(line, sizeof(line), "alias%d", count - 1);
+        std::string alias_line = line;
+        bench_run("expand/aliases=" + std::to_string(count), [&](long) {
+            strcpy(line, alias_line.c_str());
+            cmd_exe(line);
+        });
+        bench_deinit();
+    }
+#endif
+}
+
+// command lookup, the last registered command is executed
+static void bench_find(void)
+{
+    const int counts[] = {8, 64, 512};
+    for (int count : counts) {
+        std::vector<std::string> names(count);
+        std::vector<cmd_descriptor_t> descs(count);
+        char line[16];
+        bench_init();
+        for (int i = 0; i < count; i++) {
+            char name[16];
+            snprintf(name, sizeof(name), "cmd%04d", i);
+            names[i] = name;
+            descs[i] = cmd_descriptor_t();
+            descs[i].name_ptr = names[i].c_str();
+            descs[i].run_cb = bench_cmd;
+            cmd_add_static(&descs[i]);
+        }
+        bench_run("find/commands=" + std::to_string(count), [&](long) {
+            strcpy(line, names[count - 1].c_str());
+            cmd_exe(line);
+        });
+        bench_deinit();
+    }
+}
+
+// typing a line character by character, line is dropped with ctrl+c
+static void bench_char_input(void)
+{
+    const char *line = "bench --key=value 1 2 3 4";
+    bench_init();
+    bench_run("char_input/chars=" + std::to_string(strlen(line)), [&](long) {
+        bench_input(line);
+        cmd_char_input(ETX);
+    }, strlen(line) + 1);
+    bench_deinit();
+}
+
+// key up and down over full history
+static void bench_history(void)
+{
+#if BENCH_FULL_SET == 1
+    const int count = 32;
+    char line[16];
+    bench_init();
+    cmd_history_size(count);
+    for (int i = 0; i < count; i++) {
+        snprintf(line, sizeof(line), "bench %d", i);
+        bench_input(line);
+        cmd_char_input('\n');
+    }
+    bench_run("history/entries=" + std::to_string(count), [&](long) {
+        for (int i = 1; i < count; i++) {
+            bench_input(ESCAPE("[A"));
+        }
+        for (int i = 1; i < count; i++) {
+            bench_input(ESCAPE("[B"));
+        }
+    }, 2 * (count - 1));
+    bench_deinit();
+#endif
+}
+
+// bulk parameter parsers against the same conversion done with strtoul()/strtol() loops
+static void bench_parameters(void)
+{
+    const int counts[] = {4, 32};
+    for (int count : counts) {
+        std::string hex, ints;
+        for (int i = 0; i < count; i++) {
+            char item[16];
+            snprintf(item, sizeof(item), "%s%02x", i ? ":" : "", (i * 37) & 0xff);
+            hex += item;
+            snprintf(item, sizeof(item), "%s%d", i ? "," : "", (i & 1 ? -1 : 1) * i * 1237);
+            ints += item;
+        }
+        std::vector<uint8_t> bytes(count);
+        std::vector<int32_t> values(count);
+        char *bytes_argv[] = {(char *)"bench", (char *)"--key", &hex[0]};
+        char *ints_argv[] = {(char *)"bench", (char *)"--values", &ints[0]};
+        volatile int sink = 0;
+
+        bench_run("parameter_bytes/bytes=" + std::to_string(count), [&](long) {
+            sink = cmd_parameter_bytes(3, bytes_argv, "--key", bytes.data(), bytes.size());
+        });
+        bench_run("parameter_bytes_strtoul/bytes=" + std::to_string(count), [&](long) {
+            char *str = NULL;
+            char *end;
+            cmd_parameter_val(3, bytes_argv, "--key", &str);
+            int len = 0;
+            while (*str && len < count) {
+                bytes[len++] = (uint8_t)strtoul(str, &end, 16);
+                str = *end == ':' ? end + 1 : end;
+            }
+            sink = len;
+        });
+        bench_run("parameter_int_array/values=" + std::to_string(count), [&](long) {
+            sink = cmd_parameter_int_array(3, ints_argv, "--values", values.data(), values.size());
+        });
+        bench_run("parameter_int_array_strtol/values=" + std::to_string(count), [&](long) {
+            char *str = NULL;
+            char *end;
+            cmd_parameter_val(3, ints_argv, "--values", &str);
+            int len = 0;
+            while (*str && len < count) {
+                values[len++] = (int32_t)strtol(str, &end, 0);
+                str = *end == ',' ? end + 1 : end;
+            }
+            sink = len;
+        });
+        (void)sink;
+    }
+}
+
+static void bench_print_results(FILE *out, bool json)
+{
+    if (json) {
+        fprintf(out, "{\"variant\":\"%s\",\"results\":[", BENCH_VARIANT);
+        for (size_t i = 0; i < results.size(); i++) {
+            fprintf(out, "%s{\"name\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f,\"allocs_per_op\":%.3f}",
+                    i ? "," : "", results[i].name.c_str(), results[i].iterations,
+                    results[i].ns_per_op, results[i].allocs_per_op);
+        }
+        fprintf(out, "]}\n");
+        return;
+    }
+    fprintf(out, "variant: %s\n", BENCH_VARIANT);
+    fprintf(out, "%-36s %12s %12s\n", "benchmark", "ns/op", "allocs/op");
+    for (const bench_result_t &result : results) {
+        fprintf(out, "%-36s %12.1f %12.3f\n", result.name.c_str(), result.ns_per_op, result.allocs_per_op);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool json = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--iterations N] [--filter text]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    fflush(stdout);
+    FILE *out = fdopen(dup(fileno(stdout)), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "can not redirect stdout\n");
+        return 1;
+    }
+
+    bench_exe();
+    bench_chain();
+    bench_expand();
+    bench_find();
+    bench_char_input();
+    bench_history();
+    bench_parameters();
+
+    bench_print_results(out, json);
+    fclose(out);
+    return 0;
+}
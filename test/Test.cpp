@@ -26,6 +26,9 @@
 #include <stdio.h>
 #include <stdarg.h>
 
+#include <string>
+#include <vector>
+
 #include "gtest/gtest.h"
 
 #define MBED_CONF_MBED_TRACE_ENABLE 1
@@ -57,6 +60,7 @@
 #define MBED_CONF_CMDLINE_MAX_LINE_LENGTH 100
 #define MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT 10
 #define MBED_CONF_CMDLINE_HISTORY_MAX_COUNT 0
+#define MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT 0
 #else
 // this is copypaste from pre-defined minimum config
 #define MBED_CONF_CMDLINE_INIT_AUTOMATION_MODE 0
@@ -67,9 +71,46 @@
 #define MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS 1
 #define MBED_CONF_CMDLINE_ENABLE_INTERNAL_VARIABLES 1
 #define MBED_CONF_CMDLINE_INCLUDE_MAN 1
+#if defined(MBED_CONF_CMDLINE_STATIC_MEMORY) && MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+// static memory profile defaults
+#define MBED_CONF_CMDLINE_MAX_LINE_LENGTH 128
+#define MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT 32
+#define HISTORY_MAX_S "7"
+#else
 #define MBED_CONF_CMDLINE_MAX_LINE_LENGTH 2000
-#define MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT 30
+#define MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT 1000
+#define HISTORY_MAX_S "31"
+#endif
 #define MBED_CONF_CMDLINE_HISTORY_MAX_COUNT 10
+#define MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT 1
+#endif
+// opt-in features are enabled by the build
+#ifndef MBED_CONF_CMDLINE_ENABLE_MEM_STATS
+#define MBED_CONF_CMDLINE_ENABLE_MEM_STATS 0
+#endif
+#ifndef MBED_CONF_CMDLINE_STATIC_MEMORY
+#define MBED_CONF_CMDLINE_STATIC_MEMORY 0
+#endif
+#ifndef MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION
+#define MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION 0
+#endif
+#ifndef MBED_CONF_CMDLINE_ENABLE_TAB_LISTING
+#define MBED_CONF_CMDLINE_ENABLE_TAB_LISTING 0
+#endif
+#ifndef MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS
+#define MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS 0
+#endif
+#ifndef MBED_CONF_CMDLINE_ENABLE_TRACE_RING
+#define MBED_CONF_CMDLINE_ENABLE_TRACE_RING 0
+#endif
+#ifndef MBED_CONF_CMDLINE_ENABLE_HISTORY_SEARCH
+#define MBED_CONF_CMDLINE_ENABLE_HISTORY_SEARCH 0
+#endif
+#ifndef MBED_CONF_CMDLINE_STATIC_ALIASES_MAX
+#define MBED_CONF_CMDLINE_STATIC_ALIASES_MAX 8
+#endif
+#ifndef MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH
+#define MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH 64
 #endif
 
 #include "mbed-trace/mbed_trace.h"
@@ -97,8 +138,18 @@ void my_mutex_release()
     mutex_release_count++;
 }
 
+// stack high-water measurement: lowest frame address seen while executing
+uintptr_t stack_low = UINTPTR_MAX;
+void stack_mark(void)
+{
+    uintptr_t sp = (uintptr_t)__builtin_frame_address(0);
+    if (sp < stack_low) {
+        stack_low = sp;
+    }
+}
 void myprint(const char *fmt, va_list ap)
 {
+    stack_mark();
     if (check_mutex_lock_state) {
         ASSERT_TRUE((mutex_wait_count - mutex_release_count) == mutex_count_expected_difference);
     }
@@ -313,6 +364,56 @@ TEST_F(mbedClientCli, parameters_float)
     ok = cmd_parameter_float(8, argv, "p5", &val);
     EXPECT_EQ(false, ok);
 }
+TEST_F(mbedClientCli, parameters_bytes)
+{
+    uint8_t buf[4];
+    char *argv[] =  { "cmd", "a", "00:1a:B2:ff", "b", "001ab2ff", "c", "0x001AB2", "d", "0 1a b:f",
+                      "e", "001", "f", "00:", "g", "00::11", "h", "00:11:22:33:44", "i", "0g"
+                    };
+    const uint8_t expected[] = { 0x00, 0x1a, 0xb2, 0xff };
+
+    EXPECT_EQ(4, cmd_parameter_bytes(19, argv, "a", buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(expected, buf, 4));
+    memset(buf, 0, sizeof(buf));
+    EXPECT_EQ(4, cmd_parameter_bytes(19, argv, "b", buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(expected, buf, 4));
+    EXPECT_EQ(3, cmd_parameter_bytes(19, argv, "c", buf, sizeof(buf)));
+    EXPECT_EQ(0, memcmp(expected, buf, 3));
+    EXPECT_EQ(4, cmd_parameter_bytes(19, argv, "d", buf, sizeof(buf)));
+    EXPECT_EQ(0x0f, buf[3]);
+
+    EXPECT_EQ(-1, cmd_parameter_bytes(19, argv, "e", buf, sizeof(buf)));
+    EXPECT_EQ(-1, cmd_parameter_bytes(19, argv, "f", buf, sizeof(buf)));
+    EXPECT_EQ(-1, cmd_parameter_bytes(19, argv, "g", buf, sizeof(buf)));
+    EXPECT_EQ(-1, cmd_parameter_bytes(19, argv, "h", buf, sizeof(buf)));
+    EXPECT_EQ(-1, cmd_parameter_bytes(19, argv, "i", buf, sizeof(buf)));
+    EXPECT_EQ(-1, cmd_parameter_bytes(19, argv, "x", buf, sizeof(buf)));
+}
+TEST_F(mbedClientCli, parameters_int_array)
+{
+    int32_t values[4];
+    char *argv[] =  { "cmd", "a", "1,-2,0x30,+4", "b", " 10  20, 30 ", "c", "2147483647,-2147483648",
+                      "d", "2147483648", "e", "1,,2", "f", "1,", "g", "1x", "h", "1,2,3,4,5", "i", "0x"
+                    };
+
+    EXPECT_EQ(4, cmd_parameter_int_array(19, argv, "a", values, 4));
+    EXPECT_EQ(1, values[0]);
+    EXPECT_EQ(-2, values[1]);
+    EXPECT_EQ(0x30, values[2]);
+    EXPECT_EQ(4, values[3]);
+    EXPECT_EQ(3, cmd_parameter_int_array(19, argv, "b", values, 4));
+    EXPECT_EQ(30, values[2]);
+    EXPECT_EQ(2, cmd_parameter_int_array(19, argv, "c", values, 4));
+    EXPECT_EQ(INT32_MAX, values[0]);
+    EXPECT_EQ(INT32_MIN, values[1]);
+
+    EXPECT_EQ(-1, cmd_parameter_int_array(19, argv, "d", values, 4));
+    EXPECT_EQ(-1, cmd_parameter_int_array(19, argv, "e", values, 4));
+    EXPECT_EQ(-1, cmd_parameter_int_array(19, argv, "f", values, 4));
+    EXPECT_EQ(-1, cmd_parameter_int_array(19, argv, "g", values, 4));
+    EXPECT_EQ(-1, cmd_parameter_int_array(19, argv, "h", values, 4));
+    EXPECT_EQ(-1, cmd_parameter_int_array(19, argv, "i", values, 4));
+}
 TEST_F(mbedClientCli, cmd_parameter_last)
 {
     char *argv[] =  { "cmd", "p1", "p2", "3", "p4", "p5" };
@@ -328,6 +429,198 @@ TEST_F(mbedClientCli, cmd_has_option)
     char *argv[] =  { "cmd", "-p", "p2", "3", "p4", "p5" };
     EXPECT_EQ(cmd_has_option(6, argv, "-p"), true);
 }
+TEST_F(mbedClientCli, cmd_options)
+{
+    char *argv[] =  { "cmd", "-vx", "--mode=fast", "--level", "3", "p1", "--mode=slow", "--flag" };
+    cmd_options_t opts;
+    cmd_options_init(&opts, 8, argv);
+
+    EXPECT_EQ(5, cmd_options_index(&opts, "p1"));
+    EXPECT_EQ(6, cmd_options_index(&opts, "--mode=slow"));
+    EXPECT_EQ(-1, cmd_options_index(&opts, "--mode"));
+    EXPECT_EQ(-1, cmd_options_index(&opts, "cmd"));
+
+    EXPECT_TRUE(cmd_options_has(&opts, "v"));
+    EXPECT_TRUE(cmd_options_has(&opts, "x"));
+    EXPECT_TRUE(cmd_options_has(&opts, "vx"));
+    EXPECT_FALSE(cmd_options_has(&opts, "f"));
+    EXPECT_FALSE(cmd_options_has(&opts, "xv"));
+
+    EXPECT_STREQ("fast", cmd_options_value(&opts, "--mode"));
+    EXPECT_STREQ("3", cmd_options_value(&opts, "--level"));
+    EXPECT_STREQ("--mode=slow", cmd_options_value(&opts, "p1"));
+    EXPECT_EQ(NULL, cmd_options_value(&opts, "--flag"));
+    EXPECT_EQ(NULL, cmd_options_value(&opts, "--none"));
+
+    char *val;
+    EXPECT_TRUE(cmd_parameter_val(8, argv, "--mode", &val));
+    EXPECT_STREQ("fast", val);
+}
+TEST_F(mbedClientCli, cmd_options_partly_indexed)
+{
+    char names[CMDLINE_OPTIONS_SLOTS][8];
+    char *argv[CMDLINE_OPTIONS_SLOTS + 1];
+    argv[0] = (char *)"cmd";
+    for (int i = 1; i <= CMDLINE_OPTIONS_SLOTS; i++) {
+        sprintf(names[i - 1], i % 2 ? "-o%d" : "%d", i);
+        argv[i] = names[i - 1];
+    }
+    cmd_options_t opts;
+    cmd_options_init(&opts, CMDLINE_OPTIONS_SLOTS + 1, argv);
+    EXPECT_EQ(2, cmd_options_index(&opts, "2"));
+    EXPECT_EQ(CMDLINE_OPTIONS_SLOTS, cmd_options_index(&opts, argv[CMDLINE_OPTIONS_SLOTS]));
+    EXPECT_STREQ(argv[CMDLINE_OPTIONS_SLOTS], cmd_options_value(&opts, argv[CMDLINE_OPTIONS_SLOTS - 1]));
+    EXPECT_TRUE(cmd_options_has(&opts, argv[CMDLINE_OPTIONS_SLOTS - 1] + 1));
+}
+static int cmd_options_probe(int argc, char *argv[])
+{
+    int32_t level = 0;
+    char *mode = NULL;
+    if (!cmd_parameter_int(argc, argv, "--level", &level) ||
+            !cmd_parameter_val(argc, argv, "--mode", &mode) ||
+            !cmd_has_option(argc, argv, "v")) {
+        return CMDLINE_RETCODE_INVALID_PARAMETERS;
+    }
+    cmd_printf("%s %d\r\n", mode, (int)level);
+    return CMDLINE_RETCODE_SUCCESS;
+}
+TEST_F(mbedClientCli, cmd_options_running_command)
+{
+    cmd_add("probe", cmd_options_probe, 0, 0);
+    REQUEST("probe -v --mode=fast --level 7");
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+    EXPECT_TRUE(strstr(buf, "fast 7\r\n") != NULL);
+    REQUEST("probe --mode fast --level 7");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    cmd_delete("probe");
+}
+typedef struct {
+    int32_t count;
+    bool verbose;
+    bool enable;
+    char *host;
+} ping_args_t;
+static const cmd_arg_t ping_args[] = {
+    { "--count", CMD_ARG_INT, false, 1, 100, offsetof(ping_args_t, count), "count of requests" },
+    { "-v", CMD_ARG_FLAG, false, 0, 0, offsetof(ping_args_t, verbose), "verbose output" },
+    { "--enable", CMD_ARG_BOOL, false, 0, 0, offsetof(ping_args_t, enable), NULL },
+    { "--host", CMD_ARG_STRING, true, 1, 8, offsetof(ping_args_t, host), "target host" }
+};
+static const cmd_schema_t ping_schema = { ping_args, 4, sizeof(ping_args_t) };
+static int ping_calls;
+static int cmd_ping(int argc, char *argv[])
+{
+    const ping_args_t *args = (const ping_args_t *)cmd_args();
+    ping_calls++;
+    cmd_printf("%s %d %d %d %s\r\n", args->host, (int)args->count, args->verbose, args->enable,
+               cmd_parameter_last(argc, argv));
+    return CMDLINE_RETCODE_SUCCESS;
+}
+TEST_F(mbedClientCli, cmd_schema)
+{
+    cmd_add("ping", cmd_ping, "ping host", NULL);
+    cmd_set_schema("ping", &ping_schema);
+    ping_calls = 0;
+
+    REQUEST("ping --host=abc --count 5 -v x");
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+    EXPECT_TRUE(strstr(buf, "abc 5 1 0 x\r\n") != NULL);
+    REQUEST("ping --enable on --host abc");
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+    EXPECT_TRUE(strstr(buf, "abc 0 0 1 abc\r\n") != NULL);
+    EXPECT_EQ(NULL, cmd_args());
+    EXPECT_EQ(2, ping_calls);
+
+    // callback is not called with invalid arguments
+    REQUEST("ping --count 5");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    EXPECT_TRUE(strstr(buf, "Missing option: --host\r\n") != NULL);
+#if MBED_CONF_CMDLINE_INCLUDE_MAN == 1
+    EXPECT_TRUE(strstr(buf, "Usage: ping [options]\r\n"
+                       "  --count <int>         count of requests [1..100]\r\n"
+                       "  -v                    verbose output\r\n"
+                       "  --enable <bool>       \r\n"
+                       "  --host <str>          target host [1..8] (required)\r\n") != NULL);
+#endif
+    REQUEST("ping --host abc --count 500");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    EXPECT_TRUE(strstr(buf, "Invalid value: --count\r\n") != NULL);
+    REQUEST("ping --host abcdefghijk");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    REQUEST("ping --host abc --verbose");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    EXPECT_TRUE(strstr(buf, "Unknown option: --verbose\r\n") != NULL);
+    REQUEST("ping --host");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    EXPECT_TRUE(strstr(buf, "Missing value: --host\r\n") != NULL);
+    EXPECT_EQ(2, ping_calls);
+#if MBED_CONF_CMDLINE_INCLUDE_MAN == 1 && MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+    REQUEST("help ping");
+    EXPECT_TRUE(strstr(buf, "Command: ping\r\nping host\r\nUsage: ping [options]\r\n") != NULL);
+#endif
+
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING
+    // options are completed
+    input("ping --h");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("ping --host ", "1", BACKWARD), buf);
+    input("\x7f\x7f\x7f\x7f\x7f\x7f-");
+#if MBED_CONF_CMDLINE_ENABLE_TAB_LISTING == 0
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("ping --count ", "1", BACKWARD), buf);
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("ping -v ", "1", BACKWARD), buf);
+#else
+    input("\t");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ("\r\n--count   -v        --enable  --host\r\n" CMDLINE_CUR("ping - ", "1", BACKWARD), buf);
+#endif
+    CLEAN();
+#endif
+    cmd_delete("ping");
+}
+static const cmd_arg_t number_args[] = {
+    { "--n", CMD_ARG_INT, false, 0, 0, 0, NULL }
+};
+static const cmd_schema_t number_schema = { number_args, 1, sizeof(int32_t) };
+static int cmd_number(int argc, char *argv[])
+{
+    char out[64];
+    int retcode;
+    // inner commands without schema or with invalid options leave arguments of this one
+    cmd_exe_capture("probe", out, sizeof(out), &retcode);
+    cmd_exe_capture("ping --verbose", out, sizeof(out), &retcode);
+    cmd_printf("n=%ld\r\n", (long)*(const int32_t *)cmd_args());
+    return CMDLINE_RETCODE_SUCCESS;
+}
+TEST_F(mbedClientCli, cmd_schema_nested)
+{
+    cmd_add("ping", cmd_ping, "ping host", NULL);
+    cmd_set_schema("ping", &ping_schema);
+    cmd_add("probe", cmd_options_probe, 0, 0);
+    cmd_add("number", cmd_number, 0, 0);
+    cmd_set_schema("number", &number_schema);
+
+    REQUEST("number --n 7");
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+    EXPECT_TRUE(strstr(buf, "n=7\r\n") != NULL);
+    EXPECT_EQ(NULL, cmd_args());
+    REQUEST("number --n -2147483648");
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+    EXPECT_TRUE(strstr(buf, "n=-2147483648\r\n") != NULL);
+    // value without range needs to fit int32_t
+    REQUEST("number --n 2147483648");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    REQUEST("number --n 99999999999999999999");
+    CHECK_RETCODE(CMDLINE_RETCODE_INVALID_PARAMETERS);
+    cmd_delete("number");
+    cmd_delete("probe");
+    cmd_delete("ping");
+}
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
 TEST_F(mbedClientCli, echo_state)
 {
@@ -521,6 +814,55 @@ TEST_F(mbedClientCli, cmd_arrows_up_down)
     EXPECT_STREQ(CMDLINE(" "), buf);
     CLEAN();
 }
+#if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING && MBED_CONF_CMDLINE_ENABLE_HISTORY_SEARCH
+#define SEARCH_HEAD "(reverse-i-search)`"
+TEST_F(mbedClientCli, cmd_history_search)
+{
+    REQUEST("echo alpha");
+    REQUEST("echo beta");
+    REQUEST("echo gamma");
+    input("ec");
+    INIT_BUF();
+    input("\x12");
+    EXPECT_STREQ(CR_S ESCAPE("[2K") SEARCH_HEAD "': ec", buf);
+    // only the changed tail is redrawn
+    INIT_BUF();
+    input("a");
+    EXPECT_STREQ(CR_S ESCAPE("[19C") "a': echo gamma" ESCAPE("[K") ESCAPE("[4D"), buf);
+    INIT_BUF();
+    input("l");
+    EXPECT_STREQ(CR_S ESCAPE("[20C") "l': echo alpha" ESCAPE("[K") ESCAPE("[5D"), buf);
+    INIT_BUF();
+    input("\x12");
+    EXPECT_STREQ(CR_S ESCAPE("[2K") "(failed reverse-i-search)`al': echo alpha" ESCAPE("[5D"), buf);
+    INIT_BUF();
+    BACKSPACE();
+    EXPECT_STREQ(CR_S ESCAPE("[2K") SEARCH_HEAD "a': echo gamma" ESCAPE("[4D"), buf);
+    INIT_BUF();
+    input("\x12");
+    EXPECT_STREQ(CR_S ESCAPE("[23C") "echo beta" ESCAPE("[K") ESCAPE("[1D"), buf);
+    // enter accepts and executes the found entry
+    REQUEST("");
+    EXPECT_TRUE(strstr(buf, "beta") != NULL);
+
+    // ctrl+r with empty pattern searches again with previous one
+    input("\x12");
+    INIT_BUF();
+    input("\x12");
+    EXPECT_STREQ(CR_S ESCAPE("[19C") "a': echo beta" ESCAPE("[K") ESCAPE("[1D"), buf);
+    // ctrl+g cancels search and restores edited line
+    INIT_BUF();
+    input("\x07");
+    EXPECT_STREQ(CMDLINE(" "), buf);
+    input("xyz");
+    input("\x12");
+    input("gam");
+    INIT_BUF();
+    input("\x07");
+    EXPECT_STREQ(CMDLINE("xyz "), buf);
+    CLEAN();
+}
+#endif
 TEST_F(mbedClientCli, cmd_set)
 {
     TEST_RETCODE_WITH_COMMAND("set abc def", CMDLINE_RETCODE_SUCCESS);
@@ -536,7 +878,7 @@ TEST_F(mbedClientCli, cmd_history)
     INIT_BUF();
     REQUEST("history");
     const char *to_be =
-        "\r\nHistory [2/31]:\r\n" \
+        "\r\nHistory [2/" HISTORY_MAX_S "]:\r\n" \
         "[0]: echo test\r\n" \
         "[1]: history\r\n" \
         CMDLINE_EMPTY;
@@ -551,7 +893,7 @@ TEST_F(mbedClientCli, cmd_history_clear)
     INIT_BUF();
     REQUEST("history");
     const char *to_be =
-        "\r\nHistory [1/31]:\r\n" \
+        "\r\nHistory [1/" HISTORY_MAX_S "]:\r\n" \
         "[0]: history\r\n" \
         CMDLINE_EMPTY;
     EXPECT_STREQ(to_be, buf);
@@ -566,20 +908,117 @@ TEST_F(mbedClientCli, cmd_history_skip_duplicates)
     INIT_BUF();
     REQUEST("history");
     const char *to_be =
-        "\r\nHistory [2/31]:\r\n" \
+        "\r\nHistory [2/" HISTORY_MAX_S "]:\r\n" \
         "[0]: echo test\r\n" \
         "[1]: history\r\n" \
         CMDLINE_EMPTY;
     EXPECT_STREQ(to_be, buf);
     CLEAN();
 }
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_ERASE_DUPS == 1
+TEST_F(mbedClientCli, cmd_history_erase_dups)
+{
+    // alternating commands are stored once, the executed one is moved to the start
+    for (int i = 0; i < 40; i++) {
+        REQUEST("echo poll-a");
+        REQUEST("echo poll-b");
+    }
+    REQUEST("echo other");
+    REQUEST("echo poll-a");
+    INIT_BUF();
+    REQUEST("history");
+    const char *to_be =
+        "\r\nHistory [4/" HISTORY_MAX_S "]:\r\n" \
+        "[0]: echo poll-b\r\n" \
+        "[1]: echo other\r\n" \
+        "[2]: echo poll-a\r\n" \
+        "[3]: history\r\n" \
+        CMDLINE_EMPTY;
+    EXPECT_STREQ(to_be, buf);
+    INIT_BUF();
+    PAGE_UP();
+    EXPECT_STREQ(CMDLINE("echo poll-b "), buf);
+    INIT_BUF();
+    DOWN();
+    EXPECT_STREQ(CMDLINE("echo other "), buf);
+    INIT_BUF();
+    PAGE_DOWN();
+    EXPECT_STREQ(CMDLINE("history "), buf);
+    // entry executed from history is moved too
+    UP();
+    UP();
+    UP();
+    INIT_BUF();
+    REQUEST("");
+    EXPECT_TRUE(strstr(buf, "other") != NULL);
+    UP();
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("history "), buf);
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo poll-a "), buf);
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo poll-b "), buf);
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo poll-b "), buf);
+    CLEAN();
+}
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_EXPANSION == 1
+TEST_F(mbedClientCli, cmd_history_expansion)
+{
+    REQUEST("echo alpha");
+    REQUEST("echo beta");
+    INIT_BUF();
+    REQUEST("!!");
+    EXPECT_STREQ("\r\necho beta\r\nbeta \r\n" CMDLINE_EMPTY, buf);
+    REQUEST("!0");
+    EXPECT_TRUE(strstr(buf, "\r\necho alpha\r\nalpha \r\n") != NULL);
+    REQUEST("!ech");
+    EXPECT_TRUE(strstr(buf, "\r\necho alpha\r\nalpha \r\n") != NULL);
+    REQUEST("echo !-2 !!");
+    EXPECT_TRUE(strstr(buf, "\r\necho echo beta echo alpha\r\necho beta echo alpha \r\n") != NULL);
+    REQUEST("^alpha^gamma");
+    EXPECT_TRUE(strstr(buf, "\r\necho echo beta echo gamma\r\necho beta echo gamma \r\n") != NULL);
+    // not expanded in quotes or when not followed by designator
+    REQUEST("echo \"x!!y\" ! a!=b");
+    EXPECT_TRUE(strstr(buf, "\r\nx!!y ! a!=b \r\n") != NULL);
+    // failed expansion is not executed nor stored
+    INIT_BUF();
+    REQUEST("echo !nosuch");
+    EXPECT_STREQ("\r\n!nosuch: event not found\r\n" CMDLINE_EMPTY, buf);
+    INIT_BUF();
+    REQUEST("^zzz^y");
+    EXPECT_STREQ("\r\n^zzz^y: substitution failed\r\n" CMDLINE_EMPTY, buf);
+    INIT_BUF();
+    REQUEST("!99");
+    EXPECT_STREQ("\r\n!99: event not found\r\n" CMDLINE_EMPTY, buf);
+    INIT_BUF();
+    REQUEST("history");
+    const char *to_be =
+        "\r\nHistory [7/" HISTORY_MAX_S "]:\r\n" \
+        "[0]: echo alpha\r\n" \
+        "[1]: echo beta\r\n" \
+        "[2]: echo alpha\r\n" \
+        "[3]: echo echo beta echo alpha\r\n" \
+        "[4]: echo echo beta echo gamma\r\n" \
+        "[5]: echo \"x!!y\" ! a!=b\r\n" \
+        "[6]: history\r\n" \
+        CMDLINE_EMPTY;
+    EXPECT_STREQ(to_be, buf);
+    CLEAN();
+}
+#endif
 TEST_F(mbedClientCli, cmd_history_empty)
 {
     //history when its empty
     INIT_BUF();
     REQUEST("history");
     const char *to_be =
-        "\r\nHistory [1/31]:\r\n" \
+        "\r\nHistory [1/" HISTORY_MAX_S "]:\r\n" \
         "[0]: history\r\n" \
         CMDLINE_EMPTY;
     EXPECT_STREQ(to_be, buf);
@@ -633,6 +1072,263 @@ TEST_F(mbedClientCli, cmd_text_pageup_up)
     EXPECT_STREQ(CMDLINE("hello "), buf);
     CLEAN();
 }
+static char history_log[1024];
+static uint32_t history_log_length;
+static int history_log_reads;
+
+static int history_log_read(void *, uint32_t offset, void *data, uint16_t length)
+{
+    history_log_reads++;
+    if (offset >= history_log_length) {
+        return 0;
+    }
+    if (length > history_log_length - offset) {
+        length = history_log_length - offset;
+    }
+    memcpy(data, history_log + offset, length);
+    return length;
+}
+static int history_log_append(void *, const void *data, uint16_t length)
+{
+    if (history_log_length + length > sizeof(history_log)) {
+        return -1;
+    }
+    memcpy(history_log + history_log_length, data, length);
+    history_log_length += length;
+    return 0;
+}
+static int history_log_reset(void *)
+{
+    history_log_length = 0;
+    return 0;
+}
+static char history_spare[1024];
+static uint32_t history_spare_length;
+static int history_spare_writes_left = -1; // writes before a failure, -1 never fails
+static int history_spare_commits;
+static int history_spare_write(void *, uint32_t offset, const void *data, uint16_t length)
+{
+    if (history_spare_writes_left == 0 || offset != (offset ? history_spare_length : 0) ||
+            offset + length > sizeof(history_spare)) {
+        return -1;
+    }
+    if (history_spare_writes_left > 0) {
+        history_spare_writes_left--;
+    }
+    memcpy(history_spare + offset, data, length);
+    history_spare_length = offset + length;
+    return 0;
+}
+static int history_spare_commit(void *, uint32_t length)
+{
+    if (length != history_spare_length) {
+        return -1;
+    }
+    memcpy(history_log, history_spare, length);
+    history_log_length = length;
+    history_spare_commits++;
+    return 0;
+}
+// store stays across cmd_free(), so it is detached also when test fails
+class mbedClientCliHistoryStore : public mbedClientCli {
+protected:
+    void TearDown()
+    {
+        cmd_history_set_store(NULL);
+        mbedClientCli::TearDown();
+    }
+};
+TEST_F(mbedClientCliHistoryStore, cmd_history_store)
+{
+    cmd_history_store_t store = { history_log_read, history_log_append, history_log_reset,
+                                  history_spare_write, history_spare_commit, NULL
+                                };
+    // log of previous session
+    memcpy(history_log, "echo a\0echo b\0", 14);
+    history_log_length = 14;
+    history_log_reads = 0;
+    cmd_history_set_store(&store);
+
+    REQUEST("echo c");
+    EXPECT_EQ(0, history_log_reads);
+    EXPECT_EQ(21, (int)history_log_length);
+    EXPECT_EQ(0, memcmp(history_log, "echo a\0echo b\0echo c\0", 21));
+
+    // loaded when browsed first time
+    input("ec");
+    INIT_BUF();
+    UP();
+    // one pass, last read finds the end
+    EXPECT_EQ(2, history_log_reads);
+    EXPECT_STREQ(CMDLINE("echo c "), buf);
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo b "), buf);
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo a "), buf);
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo a "), buf);
+    INIT_BUF();
+    PAGE_DOWN();
+    EXPECT_STREQ(CMDLINE("ec "), buf);
+    CLEAN();
+
+    // log is rewritten with the current history when it grows
+    cmd_history_size(4);
+    char line[32];
+    for (int i = 0; i < 10; i++) {
+        sprintf(line, "echo %d", i);
+        REQUEST(line);
+    }
+    EXPECT_LE((int)history_log_length, 9 * 7);
+    EXPECT_EQ(0, memcmp(history_log + history_log_length - 21, "echo 7\0echo 8\0echo 9\0", 21));
+
+    // new session sees only the newest entries
+    cmd_free();
+    cmd_init(&myprint);
+    cmd_set_ready_cb(cmd_ready_cb);
+    cmd_history_size(4);
+    INIT_BUF();
+    PAGE_UP();
+    EXPECT_STREQ(CMDLINE("echo 7 "), buf);
+    CLEAN();
+
+    TEST_RETCODE_WITH_COMMAND("history clear", CMDLINE_RETCODE_SUCCESS);
+    EXPECT_EQ(0, (int)history_log_length);
+}
+TEST_F(mbedClientCliHistoryStore, cmd_history_store_interrupted)
+{
+    cmd_history_store_t store = { history_log_read, history_log_append, history_log_reset,
+                                  history_spare_write, history_spare_commit, NULL
+                                };
+    history_log_length = 0;
+    history_spare_commits = 0;
+    cmd_history_set_store(&store);
+    cmd_history_size(4);
+    char line[32];
+    // spare log stops in the middle, like on power loss
+    history_spare_writes_left = 1;
+    for (int i = 0; i < 9; i++) {
+        sprintf(line, "echo %d", i);
+        REQUEST(line);
+    }
+    EXPECT_EQ(0, history_spare_commits);
+    EXPECT_EQ(9 * 7, (int)history_log_length);
+    EXPECT_EQ(0, memcmp(history_log + 8 * 7, "echo 8", 7));
+
+    // compaction is done again after next command
+    history_spare_writes_left = -1;
+    REQUEST("echo 9");
+    EXPECT_EQ(1, history_spare_commits);
+    EXPECT_EQ(21, (int)history_log_length);
+    EXPECT_EQ(0, memcmp(history_log, "echo 7\0echo 8\0echo 9\0", 21));
+
+    // store without spare log is not compacted
+    store.spare_write = NULL;
+    cmd_history_set_store(&store);
+    for (int i = 0; i < 9; i++) {
+        sprintf(line, "echo %d", i);
+        REQUEST(line);
+    }
+    EXPECT_EQ(1, history_spare_commits);
+    EXPECT_EQ(21 + 9 * 7, (int)history_log_length);
+}
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 1
+TEST_F(mbedClientCli, cmd_history_compressed)
+{
+    char line[64];
+    // entries sharing long prefixes fit to arena which is too small for them uncompressed
+    cmd_history_size(100);
+    for (int i = 0; i < 60; i++) {
+        sprintf(line, "echo mbedcloud get /3/0/%d", i);
+        REQUEST(line);
+    }
+    INIT_BUF();
+    REQUEST("history");
+    EXPECT_TRUE(strstr(buf, "History [61/99]:\r\n[0]: echo mbedcloud get /3/0/0\r\n") != NULL);
+    EXPECT_TRUE(strstr(buf, "[29]: echo mbedcloud get /3/0/29\r\n") != NULL);
+
+    // edited entry does not change older ones
+    UP();
+    UP();
+    BACKSPACE();
+    BACKSPACE();
+    input("x");
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo mbedcloud get /3/0/58 "), buf);
+    INIT_BUF();
+    DOWN();
+    EXPECT_STREQ(CMDLINE("echo mbedcloud get /3/0/x "), buf);
+    INIT_BUF();
+    PAGE_UP();
+    EXPECT_STREQ(CMDLINE("echo mbedcloud get /3/0/0 "), buf);
+    CLEAN();
+
+    // oldest entries are dropped when arena is full
+    for (int i = 0; i < 60; i++) {
+        sprintf(line, "echo %d %s", i, "abcdefghijklmnopqrstuvwxyz");
+        REQUEST(line);
+    }
+    INIT_BUF();
+    REQUEST("history");
+    EXPECT_TRUE(strstr(buf, "[0]: echo ") != NULL);
+    EXPECT_TRUE(strstr(buf, "[0]: echo 0 abcdefghijklmnopqrstuvwxyz\r\n") == NULL);
+    UP();
+    INIT_BUF();
+    UP();
+    EXPECT_STREQ(CMDLINE("echo 59 abcdefghijklmnopqrstuvwxyz "), buf);
+    CLEAN();
+}
+TEST_F(mbedClientCli, cmd_history_compressed_edit_full)
+{
+    char line[128];
+    char edited[128];
+    const char *shared = "echo zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz";
+    cmd_history_size(100);
+    // arena gets full, so there is less space left than editing moves to the older entry
+    for (int i = 0; i < 40; i++) {
+        sprintf(line, "echo %d abcdefghijklmnopqrstuvwxyz", i);
+        REQUEST(line);
+    }
+    sprintf(line, "%sy", shared);
+    REQUEST(line);
+    REQUEST(shared);
+    for (int i = 0; i < 3; i++) {
+        sprintf(line, "echo %d abcdefghijklmnopqrstuvwxyz", i);
+        REQUEST(line);
+    }
+    for (int i = 0; i < 3; i++) {
+        UP();
+    }
+    INIT_BUF();
+    UP();
+    sprintf(line, CMDLINE("%s "), shared);
+    EXPECT_STREQ(line, buf);
+    for (int i = 0; i < 60; i++) {
+        BACKSPACE();
+    }
+    input("q");
+    sprintf(edited, CMDLINE("%.*sq "), (int)strlen(shared) - 60, shared);
+    INIT_BUF();
+    UP();
+    sprintf(line, CMDLINE("%sy "), shared);
+    EXPECT_STREQ(line, buf);
+    INIT_BUF();
+    DOWN();
+    EXPECT_STREQ(edited, buf);
+    INIT_BUF();
+    DOWN();
+    EXPECT_STREQ(CMDLINE("echo 0 abcdefghijklmnopqrstuvwxyz "), buf);
+    CLEAN();
+    INIT_BUF();
+    REQUEST("history");
+    EXPECT_TRUE(strstr(buf, "\r\n[0]: echo ") != NULL);
+    EXPECT_TRUE(strstr(buf, "]: echo 39 abcdefghijklmnopqrstuvwxyz\r\n") != NULL);
+}
+#endif
 #endif
 #if MBED_CONF_CMDLINE_ENABLE_ESCAPE_HANDLING
 TEST_F(mbedClientCli, cmd_alt_left_right)
@@ -771,6 +1467,15 @@ TEST_F(mbedClientCli, cmd_tab_1)
 
     input("\n");
 }
+static const char *const kv_keys[] = { "alpha", "beta", "alpine" };
+int kv_complete_calls = 0;
+std::string kv_complete_args;
+const char *kv_complete(cmd_complete_t *it)
+{
+    kv_complete_calls++;
+    kv_complete_args = std::to_string(it->argc) + ":" + it->argv[it->argc - 1];
+    return it->index < 3 ? kv_keys[it->index] : NULL;
+}
 TEST_F(mbedClientCli, cmd_tab_2)
 {
     INIT_BUF();
@@ -781,6 +1486,19 @@ TEST_F(mbedClientCli, cmd_tab_2)
     input("r");
     INIT_BUF();
 
+#if MBED_CONF_CMDLINE_ENABLE_TAB_LISTING == 1
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("r ", "1", BACKWARD), buf);
+
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ("\r\nrole   route  rile\r\n" CMDLINE_CUR("r ", "1", BACKWARD), buf);
+
+    input("o");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("ro ", "1", BACKWARD), buf);
+#else
     input("\t");
     EXPECT_STREQ(CMDLINE_CUR("role ", "1", BACKWARD), buf);
 
@@ -799,9 +1517,124 @@ TEST_F(mbedClientCli, cmd_tab_2)
     INIT_BUF();
     input("\x1b[Z");
     EXPECT_STREQ(CMDLINE_CUR("role ", "1", BACKWARD), buf);
+#endif
 
     input("\n");
 }
+#if MBED_CONF_CMDLINE_ENABLE_TAB_LISTING == 0
+TEST_F(mbedClientCli, cmd_completion)
+{
+    cmd_add("kv", cmd_dummy, 0, 0);
+    cmd_set_completion("kv", kv_complete);
+    kv_complete_calls = 0;
+    input("kv get al");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("kv get alpha ", "1", BACKWARD), buf);
+    EXPECT_EQ("2:get", kv_complete_args);
+    // iteration continues from previous candidate
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("kv get alpine ", "1", BACKWARD), buf);
+    EXPECT_EQ(3, kv_complete_calls);
+    // and starts over when cycling backwards
+    INIT_BUF();
+    input("\x1b[Z");
+    EXPECT_STREQ(CMDLINE_CUR("kv get alpha ", "1", BACKWARD), buf);
+    EXPECT_EQ(4, kv_complete_calls);
+    CLEAN();
+
+    input("kv ");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("kv alpha ", "1", BACKWARD), buf);
+    EXPECT_EQ("1:kv", kv_complete_args);
+    CLEAN();
+
+    cmd_set_completion("kv", NULL);
+    input("kv ");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("kv  ", "1", BACKWARD), buf);
+    CLEAN();
+    cmd_delete("kv");
+}
+#else
+TEST_F(mbedClientCli, cmd_tab_listing)
+{
+    cmd_add("zzalpha", cmd_dummy, 0, 0);
+    cmd_add("zzalpine", cmd_dummy, 0, 0);
+    cmd_add("zzbeta", cmd_dummy, 0, 0);
+    input("zz");
+    // common prefix is already typed
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("zz ", "1", BACKWARD), buf);
+    // second TAB lists candidates
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ("\r\nzzalpha   zzalpine  zzbeta\r\n" CMDLINE_CUR("zz ", "1", BACKWARD), buf);
+    input("a");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("zzalp ", "1", BACKWARD), buf);
+    input("h");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("zzalpha ", "1", BACKWARD), buf);
+    CLEAN();
+
+    // listing uses terminal width
+    REQUEST("set COLUMNS 20");
+    input("zz");
+    input("\t");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ("\r\nzzalpha   zzalpine\r\nzzbeta\r\n" CMDLINE_CUR("zz ", "1", BACKWARD), buf);
+    CLEAN();
+    REQUEST("unset COLUMNS");
+
+    // arguments given by completion callback
+    cmd_add("kv", cmd_dummy, 0, 0);
+    cmd_set_completion("kv", kv_complete);
+    input("kv get ");
+    input("\t");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ("\r\nalpha   beta    alpine\r\n" CMDLINE_CUR("kv get  ", "1", BACKWARD), buf);
+    CLEAN();
+    cmd_delete("kv");
+}
+int grow_passes = 0;
+const char *grow_complete(cmd_complete_t *it)
+{
+    static char names[40][32];
+    if (it->index == 0) {
+        grow_passes++;
+    }
+    // listing pass gets more candidates than were counted before it, common prefix "grow-0" limits them to 10
+    if (it->index >= (grow_passes < 3 ? 2u : 40u)) {
+        return NULL;
+    }
+    sprintf(names[it->index], "grow-%02d-abcdefghijklmnopqrstu", (int)it->index);
+    return names[it->index];
+}
+TEST_F(mbedClientCli, cmd_tab_listing_grows)
+{
+    cmd_add("kv", cmd_dummy, 0, 0);
+    cmd_set_completion("kv", grow_complete);
+    grow_passes = 0;
+    input("kv ");
+    input("\t");
+    INIT_BUF();
+    input("\t");
+    EXPECT_EQ(3, grow_passes);
+    EXPECT_TRUE(strstr(buf, "\r\ngrow-00-abcdefghijklmnopqrstu  grow-01") != NULL);
+    EXPECT_TRUE(strstr(buf, "grow-09-abcdefghijklmnopqrstu\r\n") != NULL);
+    CLEAN();
+    cmd_delete("kv");
+}
+#endif
 #endif
 TEST_F(mbedClientCli, cmd_delete)
 {
@@ -833,6 +1666,21 @@ TEST_F(mbedClientCli, cmd_tab_3)
 
     input("r");
 
+#if MBED_CONF_CMDLINE_ENABLE_TAB_LISTING == 1
+    // aliases are candidates as well
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("ro ", "1", BACKWARD), buf);
+
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ("\r\nrole  rose  rope\r\n" CMDLINE_CUR("ro ", "1", BACKWARD), buf);
+
+    input("s");
+    INIT_BUF();
+    input("\t");
+    EXPECT_STREQ(CMDLINE_CUR("rose ", "1", BACKWARD), buf);
+#else
     INIT_BUF();
     input("\t");
     EXPECT_STREQ(CMDLINE_CUR("role ", "1", BACKWARD), buf);
@@ -852,6 +1700,7 @@ TEST_F(mbedClientCli, cmd_tab_3)
     INIT_BUF();
     input("o");
     EXPECT_STREQ(CMDLINE_CUR("ro ", "1", BACKWARD), buf);
+#endif
 
     ESC();
     INIT_BUF();
@@ -985,6 +1834,48 @@ TEST_F(mbedClientCli, cmd_var_2)
     EXPECT_STREQ(RESPONSE("hello world! "), buf);
     REQUEST("unset faa");
 }
+TEST_F(mbedClientCli, cmd_var_inline)
+{
+    // short values are inline, longer ones reuse allocated buffer
+    REQUEST("set foo short");
+    REQUEST("echo $foo");
+    EXPECT_STREQ(RESPONSE("short "), buf);
+    REQUEST("set foo \"this value is longer than inline\"");
+    REQUEST("echo $foo");
+    EXPECT_STREQ(RESPONSE("this value is longer than inline "), buf);
+    REQUEST("set foo \"this value is long as well\"");
+    REQUEST("echo $foo");
+    EXPECT_STREQ(RESPONSE("this value is long as well "), buf);
+    REQUEST("set foo 1");
+    REQUEST("echo $foo");
+    EXPECT_STREQ(RESPONSE("1 "), buf);
+    REQUEST("unset foo");
+
+    // special variables can be removed and added back
+    REQUEST("unset PS1");
+    REQUEST("set PS1 \"a rather long prompt>\"");
+    INIT_BUF();
+    REQUEST("set");
+    EXPECT_STREQ("\r\nvariables:\r\n"
+                 "?=0\r\n"
+                 "PS1='a rather long prompt>'\r\n"
+                 "\r\x1b[2Ka rather long prompt> \x1b[1D", buf);
+    REQUEST("set PS1=/>");
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    // running commands does not allocate for "?" and "_"
+    cmd_mem_stats_t before, after;
+    REQUEST("echo hello world");
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_VARIABLES, &before));
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_ALIASES, &after));
+    before.allocs += after.allocs;
+    REQUEST("echo hello");
+    REQUEST("invalid");
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_VARIABLES, &after));
+    size_t allocs = after.allocs;
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_ALIASES, &after));
+    EXPECT_EQ(before.allocs, allocs + after.allocs);
+#endif
+}
 #endif
 #if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS
 TEST_F(mbedClientCli, cmd__)
@@ -1020,6 +1911,354 @@ TEST_F(mbedClientCli, var_ps1)
                  "\r" ESCAPE("[2K") "abc " ESCAPE("[1D"), buf);
 }
 
+TEST_F(mbedClientCli, var_int_limits)
+{
+    cmd_variable_add_int("min", -2147483647 - 1);
+    cmd_variable_add_int("max", 2147483647);
+    REQUEST("echo $min $max");
+    EXPECT_STREQ(RESPONSE("-2147483648 2147483647 "), buf);
+}
+TEST_F(mbedClientCli, retfmt)
+{
+    REQUEST("set --retfmt \"rc %i%%\"");
+    REQUEST("false");
+    EXPECT_STREQ("\r\nrc -1%" CMDLINE_EMPTY, buf);
+    // formats which are not handled internally are given to the output function
+    REQUEST("set --retfmt \"rc %3i|\"");
+    REQUEST("false");
+    EXPECT_STREQ("\r\nrc  -1|" CMDLINE_EMPTY, buf);
+    REQUEST("set --retcode false");
+    REQUEST("true");
+    EXPECT_STREQ(CR_S LF_S CMDLINE_EMPTY, buf);
+}
+int out_print_count = 0;
+int out_write_count = 0;
+void count_print(const char *fmt, va_list ap)
+{
+    out_print_count++;
+    myprint(fmt, ap);
+}
+void count_write(const char *str, size_t len)
+{
+    out_write_count++;
+    size_t room = BUFSIZE - 1 - strlen(buf);
+    strncat(buf, str, len < room ? len : room);
+}
+TEST_F(mbedClientCli, out_write_func)
+{
+    std::string line(MBED_CONF_CMDLINE_MAX_LINE_LENGTH < 200 ? MBED_CONF_CMDLINE_MAX_LINE_LENGTH - 8 : 200, 'x');
+    cmd_out_func(count_print);
+    // without write function line refresh is one call of the print function
+    input("a");
+    EXPECT_STREQ(CMDLINE("a "), buf);
+    EXPECT_EQ(1, out_print_count);
+    CLEAN();
+    cmd_out_write_func(count_write);
+    out_print_count = 0;
+    input(line.c_str());
+    INIT_BUF();
+    out_write_count = 0;
+    input("y");
+    EXPECT_EQ(CR_S ESCAPE("[2K") DEFAULT_PROMPT + line + "y " ESCAPE("[1D"), std::string(buf));
+    EXPECT_EQ(1, out_write_count);
+    EXPECT_EQ(0, out_print_count);
+    CLEAN();
+    // retcode and prompt are written without the print function
+    REQUEST("set --retfmt \"rc %i\"");
+    input("false");
+    INIT_BUF();
+    out_write_count = 0;
+    out_print_count = 0;
+    cmd_char_input(LF);
+    EXPECT_STREQ("\r\nrc -1" CMDLINE_EMPTY, buf);
+    EXPECT_EQ(3, out_write_count);
+    EXPECT_EQ(0, out_print_count);
+    cmd_out_write_func(NULL);
+    cmd_out_func(myprint);
+}
+
+#if MBED_CONF_CMDLINE_ENABLE_JSON_OUTPUT == 1
+uint32_t fake_clock_now = 0;
+uint32_t fake_clock(void)
+{
+    return fake_clock_now;
+}
+int cmd_kv(int argc, char *argv[])
+{
+    fake_clock_now += 25;
+    cmd_emit_kv("text", "a\"b\\c\r\n\t\x01 and some more text to exceed the buffer");
+    cmd_emit_kv_int("count", -12);
+    cmd_emit_kv("none", NULL);
+    return argc > 1 ? CMDLINE_RETCODE_INVALID_PARAMETERS : CMDLINE_RETCODE_SUCCESS;
+}
+TEST_F(mbedClientCli, json_kv)
+{
+    cmd_add("kv", cmd_kv, "emit values", 0);
+    REQUEST("kv");
+    EXPECT_STREQ("\r\n"
+                 "text: a\"b\\c\r\n\t\x01 and some more text to exceed the buffer\r\n"
+                 "count: -12\r\n"
+                 "none: \r\n"
+                 CMDLINE_EMPTY, buf);
+    cmd_echo_off();
+    cmd_set_output_mode(CMDLINE_OUTPUT_JSON);
+    EXPECT_EQ(CMDLINE_OUTPUT_JSON, cmd_get_output_mode());
+    cmd_set_clock_func(fake_clock);
+    REQUEST("kv");
+    EXPECT_STREQ("{\"type\":\"kv\",\"cmd\":\"kv\",\"key\":\"text\","
+                 "\"value\":\"a\\\"b\\\\c\\r\\n\\t\\u0001 and some more text to exceed the buffer\"}\r\n"
+                 "{\"type\":\"kv\",\"cmd\":\"kv\",\"key\":\"count\",\"value\":-12}\r\n"
+                 "{\"type\":\"kv\",\"cmd\":\"kv\",\"key\":\"none\",\"value\":null}\r\n"
+                 "{\"type\":\"result\",\"line\":\"kv\",\"retcode\":0,\"elapsed\":25}\r\n", buf);
+    REQUEST("kv x");
+    EXPECT_STREQ("{\"type\":\"kv\",\"cmd\":\"kv\",\"key\":\"text\","
+                 "\"value\":\"a\\\"b\\\\c\\r\\n\\t\\u0001 and some more text to exceed the buffer\"}\r\n"
+                 "{\"type\":\"kv\",\"cmd\":\"kv\",\"key\":\"count\",\"value\":-12}\r\n"
+                 "{\"type\":\"kv\",\"cmd\":\"kv\",\"key\":\"none\",\"value\":null}\r\n"
+                 "{\"type\":\"error\",\"message\":\"Invalid parameters\",\"cmd\":\"kv\"}\r\n"
+                 "{\"type\":\"command\",\"name\":\"kv\",\"info\":\"emit values\",\"man\":null}\r\n"
+                 "{\"type\":\"result\",\"line\":\"kv x\",\"retcode\":-2,\"elapsed\":25}\r\n", buf);
+    cmd_set_clock_func(NULL);
+}
+#if MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS == 1
+static uint32_t stats_clock = 0;
+uint32_t stats_clock_func(void)
+{
+    return stats_clock;
+}
+int cmd_timed(int argc, char *argv[])
+{
+    stats_clock += 10 * argc;
+    if (argc > 1 && strcmp(argv[1], "fail") == 0) {
+        return CMDLINE_RETCODE_FAIL;
+    }
+    return CMDLINE_RETCODE_SUCCESS;
+}
+int cmd_timed_async(int argc, char *argv[])
+{
+    return CMDLINE_RETCODE_EXCUTING_CONTINUE;
+}
+TEST_F(mbedClientCli, cmd_stats)
+{
+    cmd_stats_t stats;
+    stats_clock = 1000;
+    cmd_set_clock_func(stats_clock_func);
+    cmd_add("timed", cmd_timed, NULL, NULL);
+    cmd_add("async", cmd_timed_async, NULL, NULL);
+    EXPECT_FALSE(cmd_stats("nosuch", &stats));
+    ASSERT_TRUE(cmd_stats("timed", &stats));
+    EXPECT_EQ(0u, stats.calls);
+    EXPECT_EQ(0u, stats.min_time);
+
+    REQUEST("timed");
+    REQUEST("timed a b");
+    REQUEST("timed fail");
+    ASSERT_TRUE(cmd_stats("timed", &stats));
+    EXPECT_EQ(3u, stats.calls);
+    EXPECT_EQ(1u, stats.failures);
+    EXPECT_EQ(0u, stats.busy);
+    EXPECT_EQ(60u, stats.total_time);
+    EXPECT_EQ(10u, stats.min_time);
+    EXPECT_EQ(30u, stats.max_time);
+    EXPECT_EQ(20u, stats.last_time);
+
+    // latency is measured until cmd_ready(), running command rejects new executions
+    REQUEST("async");
+    char out[8];
+    int retcode;
+    cmd_exe_capture("async", out, sizeof(out), &retcode);
+    stats_clock += 100;
+    cmd_ready(CMDLINE_RETCODE_SUCCESS);
+    ASSERT_TRUE(cmd_stats("async", &stats));
+    EXPECT_EQ(1u, stats.calls);
+    EXPECT_EQ(1u, stats.busy);
+    EXPECT_EQ(100u, stats.last_time);
+
+    INIT_BUF();
+    REQUEST("stats");
+    EXPECT_TRUE(strstr(buf, "\r\ncommand            calls   fails    busy     total       min       max      last\r\n"
+                       "stats                  1       0       0         0         0         0         0\r\n"
+                       "timed                  3       1       0        60        10        30        20\r\n"
+                       "async                  1       0       1       100       100       100       100\r\n") != NULL);
+
+    TEST_RETCODE_WITH_COMMAND("stats reset nosuch", CMDLINE_RETCODE_FAIL);
+    TEST_RETCODE_WITH_COMMAND("stats reset timed", CMDLINE_RETCODE_SUCCESS);
+    ASSERT_TRUE(cmd_stats("timed", &stats));
+    EXPECT_EQ(0u, stats.calls);
+    EXPECT_EQ(0u, stats.total_time);
+    ASSERT_TRUE(cmd_stats("async", &stats));
+    EXPECT_EQ(1u, stats.calls);
+    cmd_stats_reset(NULL);
+    ASSERT_TRUE(cmd_stats("async", &stats));
+    EXPECT_EQ(0u, stats.calls);
+    cmd_set_clock_func(NULL);
+}
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_TRACE_RING == 1
+uint32_t trace_clock_func(void)
+{
+    return 0x12345678;
+}
+TEST_F(mbedClientCli, cmd_trace_ring)
+{
+    cmd_trace_record_t records[80];
+    uint32_t dropped = 1;
+    cmd_echo_off();
+    cmd_trace_clear();
+    EXPECT_EQ(0u, cmd_trace_read(records, 80, &dropped));
+    EXPECT_EQ(0u, dropped);
+
+    REQUEST("true");
+    size_t count = cmd_trace_read(records, 80, &dropped);
+    EXPECT_EQ(0u, dropped);
+    const cmd_trace_record_t expected[] = {
+        {0, CMDLINE_TRACE_INPUT, 't'}, {0, CMDLINE_TRACE_INPUT, 'r'},
+        {0, CMDLINE_TRACE_INPUT, 'u'}, {0, CMDLINE_TRACE_INPUT, 'e'},
+        {0, CMDLINE_TRACE_INPUT, LF}, {0, CMDLINE_TRACE_SPLIT, 1},
+        {0, CMDLINE_TRACE_EXPAND, 4}, {0, CMDLINE_TRACE_DISPATCH, 1},
+        {0, CMDLINE_TRACE_READY, 0}
+    };
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].event == CMDLINE_TRACE_OUTPUT) {
+            continue;
+        }
+        ASSERT_LT(n, sizeof(expected) / sizeof(expected[0]));
+        EXPECT_EQ(expected[n].event, records[i].event);
+        EXPECT_EQ(expected[n].arg, records[i].arg);
+        n++;
+    }
+    EXPECT_EQ(sizeof(expected) / sizeof(expected[0]), n);
+
+    // ring keeps the latest records
+    cmd_trace_clear();
+    for (int i = 0; i < 100; i++) {
+        cmd_char_input('a');
+    }
+    cmd_char_input(LF);
+    count = cmd_trace_read(records, 80, &dropped);
+    EXPECT_EQ(64u, count);
+    EXPECT_LE(37u, dropped);
+    EXPECT_EQ(CMDLINE_TRACE_INPUT, records[0].event);
+    EXPECT_EQ('a', records[0].arg);
+    EXPECT_EQ(2u, cmd_trace_read(records, 2, NULL));
+
+    // export
+    cmd_set_clock_func(trace_clock_func);
+    cmd_trace_clear();
+    REQUEST("trace");
+    EXPECT_TRUE(strncmp(buf, "trace: version 1, records ", 26) == 0);
+    EXPECT_TRUE(strstr(buf, ", dropped 0\r\ntrace: 7856341201007400"
+                       "7856341201007200") != NULL);
+    EXPECT_TRUE(strstr(buf, "\r\ntrace: end\r\n") != NULL);
+    TEST_RETCODE_WITH_COMMAND("trace clear", CMDLINE_RETCODE_SUCCESS);
+    TEST_RETCODE_WITH_COMMAND("trace x", CMDLINE_RETCODE_INVALID_PARAMETERS);
+    cmd_set_clock_func(NULL);
+}
+uint32_t trace_clock_ticks = 0;
+uint32_t trace_counting_clock_func(void)
+{
+    return ++trace_clock_ticks;
+}
+std::string trace_out;
+void trace_print(const char *fmt, va_list ap)
+{
+    char line[256];
+    vsnprintf(line, sizeof(line), fmt, ap);
+    trace_out += line;
+}
+TEST_F(mbedClientCli, cmd_trace_export_full)
+{
+    cmd_echo_off();
+    cmd_set_clock_func(trace_counting_clock_func);
+    cmd_trace_clear();
+    for (int i = 0; i < 100; i++) {
+        cmd_char_input('a');
+    }
+    cmd_char_input(LF);
+    trace_out.clear();
+    cmd_out_func(trace_print);
+    input("trace");
+    cmd_char_input(LF);
+    cmd_out_func(myprint);
+    cmd_set_clock_func(NULL);
+
+    // decode like tools/cli_trace.py
+    std::vector<cmd_trace_record_t> records;
+    const char *ptr = trace_out.c_str();
+    while ((ptr = strstr(ptr, "trace: ")) != NULL) {
+        ptr += 7;
+        size_t len = strspn(ptr, "0123456789abcdef");
+        if (len == 0 || len % 16 != 0 || ptr[len] != '\r') {
+            continue;
+        }
+        for (size_t pos = 0; pos < len; pos += 16) {
+            uint8_t bytes[8];
+            for (int b = 0; b < 8; b++) {
+                char hex[3] = { ptr[pos + 2 * b], ptr[pos + 2 * b + 1], 0 };
+                bytes[b] = (uint8_t)strtoul(hex, NULL, 16);
+            }
+            cmd_trace_record_t record;
+            record.time = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+            record.event = bytes[4];
+            record.arg = bytes[6] | bytes[7] << 8;
+            records.push_back(record);
+        }
+        ptr += len;
+    }
+    EXPECT_TRUE(trace_out.find("trace: version 1, records 64, dropped ") == 0) << trace_out;
+    ASSERT_EQ(64u, records.size());
+    // ring is exported as it was when the command started
+    for (size_t i = 1; i < records.size(); i++) {
+        EXPECT_LT(records[i - 1].time, records[i].time) << i;
+    }
+    EXPECT_EQ(CMDLINE_TRACE_DISPATCH, records.back().event);
+    EXPECT_EQ(1, records.back().arg);
+    EXPECT_EQ(CMDLINE_TRACE_EXPAND, records[records.size() - 2].event);
+}
+#endif
+TEST_F(mbedClientCli, json_builtins)
+{
+    cmd_echo_off();
+    REQUEST("set --json on");
+    EXPECT_EQ(CMDLINE_OUTPUT_JSON, cmd_get_output_mode());
+    REQUEST("set");
+    EXPECT_STREQ("{\"type\":\"variable\",\"name\":\"PS1\",\"value\":\"/>\"}\r\n"
+                 "{\"type\":\"variable\",\"name\":\"?\",\"value\":0}\r\n"
+                 "{\"type\":\"result\",\"line\":\"set\",\"retcode\":0}\r\n", buf);
+    REQUEST("alias");
+    EXPECT_STREQ("{\"type\":\"alias\",\"name\":\"_\",\"value\":\"set\"}\r\n"
+                 "{\"type\":\"result\",\"line\":\"alias\",\"retcode\":0}\r\n", buf);
+    REQUEST("help true");
+    EXPECT_STREQ("{\"type\":\"command\",\"name\":\"true\",\"info\":null,\"man\":null}\r\n"
+                 "{\"type\":\"result\",\"line\":\"help true\",\"retcode\":0}\r\n", buf);
+    REQUEST("history");
+    EXPECT_STREQ("{\"type\":\"history\",\"index\":0,\"command\":\"set --json on\"}\r\n"
+                 "{\"type\":\"history\",\"index\":1,\"command\":\"set\"}\r\n"
+                 "{\"type\":\"history\",\"index\":2,\"command\":\"alias\"}\r\n"
+                 "{\"type\":\"history\",\"index\":3,\"command\":\"help true\"}\r\n"
+                 "{\"type\":\"history\",\"index\":4,\"command\":\"history\"}\r\n"
+                 "{\"type\":\"result\",\"line\":\"history\",\"retcode\":0}\r\n", buf);
+    REQUEST("invalid");
+    EXPECT_STREQ("{\"type\":\"error\",\"message\":\"Command not found\",\"cmd\":\"invalid\"}\r\n"
+                 "{\"type\":\"result\",\"line\":\"invalid\",\"retcode\":-5}\r\n", buf);
+    REQUEST("set --json off");
+    EXPECT_EQ(CMDLINE_OUTPUT_HUMAN, cmd_get_output_mode());
+    // mode at completion time decides the format
+    EXPECT_STREQ("", buf);
+}
+TEST_F(mbedClientCli, json_no_prompt)
+{
+    REQUEST("set --json on");
+    REQUEST("help nosuch");
+    EXPECT_STREQ("\r\n{\"type\":\"error\",\"message\":\"Command not found\",\"cmd\":\"nosuch\"}\r\n"
+                 "{\"type\":\"result\",\"line\":\"help nosuch\",\"retcode\":-5}\r\n", buf);
+    CHECK_RETCODE(CMDLINE_RETCODE_COMMAND_NOT_FOUND);
+    REQUEST("set --json off");
+    EXPECT_STREQ("\r\n" CMDLINE_EMPTY, buf);
+}
+#endif
+
 // operators
 #if MBED_CONF_CMDLINE_ENABLE_OPERATORS
 TEST_F(mbedClientCli, operator_semicolon)
@@ -1029,7 +2268,11 @@ TEST_F(mbedClientCli, operator_semicolon)
     CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
 
     REQUEST("setd faa \"hello world\";echo $faa");
+#if MBED_CONF_CMDLINE_ENABLE_SUGGESTIONS == 1
+    EXPECT_STREQ("\r\nCommand 'setd' not found.\r\nDid you mean: set?\r\n$faa \r\n" CMDLINE_EMPTY, buf);
+#else
     EXPECT_STREQ("\r\nCommand 'setd' not found.\r\n$faa \r\n" CMDLINE_EMPTY, buf);
+#endif
 }
 TEST_F(mbedClientCli, operators_and)
 {
@@ -1147,6 +2390,635 @@ TEST_F(mbedClientCli, cmd_continue)
     CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
     EXPECT_EQ(cmd_long_called, 1);
 }
+// stack budget for executing a command, measured from cmd_exe() to output/callback
+#define STACK_BUDGET 2048
+int cmd_stack_probe(int argc, char *argv[])
+{
+    stack_mark();
+    return 0;
+}
+// returns stack used while executing given command line
+int stack_usage(const char *line)
+{
+    std::string str(line);
+    uintptr_t top = (uintptr_t)__builtin_frame_address(0);
+    stack_low = top;
+    cmd_exe(&str[0]);
+    return (int)(top - stack_low);
+}
+#if MBED_CONF_CMDLINE_USE_MINIMUM_SET == 1
+// minimum set allows 10 arguments
+#define STACK_PROBE_ARGS 9
+#else
+#define STACK_PROBE_ARGS 20
+#endif
+TEST_F(mbedClientCli, stack_usage)
+{
+    cmd_add("probe", cmd_stack_probe, 0, 0);
+    int single = stack_usage("probe");
+    EXPECT_GT(single, 0);
+    RecordProperty("stack_single", single);
+    // same below and past the count of arguments which are kept inline
+    std::string line("probe");
+    for (int i = 1; i <= STACK_PROBE_ARGS; i++) {
+        line += " " + std::to_string(i);
+        EXPECT_EQ(single, stack_usage(line.c_str())) << line;
+    }
+#if MBED_CONF_CMDLINE_ENABLE_OPERATORS == 1
+    std::string chain;
+    for (int i = 0; i < 300; i++) {
+        chain += "probe;";
+    }
+    int chained = stack_usage(chain.c_str());
+    RecordProperty("stack_chain", chained);
+    EXPECT_EQ(single, chained);
+    EXPECT_LT(chained, STACK_BUDGET);
+#endif
+    EXPECT_LT(single, STACK_BUDGET);
+}
+int argv_count = 0;
+std::string argv_last;
+int cmd_argv_count(int argc, char *argv[])
+{
+    argv_count = argc;
+    argv_last = argv[argc - 1];
+    return 0;
+}
+TEST_F(mbedClientCli, argv_spill)
+{
+    cmd_add("count", cmd_argv_count, 0, 0);
+    // fits to inline argv in every configuration
+    REQUEST("count 1 2 3");
+    EXPECT_EQ(4, argv_count);
+    EXPECT_EQ("3", argv_last);
+    // spills, quoted argument after the inline part
+    REQUEST("count 1 2 3 4 5 6 7 \"8 9\"");
+    EXPECT_EQ(9, argv_count);
+    EXPECT_EQ("8 9", argv_last);
+    REQUEST("count 1 2 3 4 5 6 7 8 9   ");
+    EXPECT_EQ(10, argv_count);
+    EXPECT_EQ("9", argv_last);
+}
+#if MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT > 30
+TEST_F(mbedClientCli, argv_many)
+{
+    cmd_add("count", cmd_argv_count, 0, 0);
+    argv_count = 0;
+    // as many one character arguments as fit to the line
+    std::string line("count");
+    int argc = 1;
+    while (argc < MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT && line.length() + 2 < MBED_CONF_CMDLINE_MAX_LINE_LENGTH) {
+        line += " " + std::to_string(argc++ % 10);
+    }
+    EXPECT_GT(argc, 30);
+    cmd_exe(&line[0]);
+    EXPECT_EQ(argc, argv_count);
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+}
+#endif
+// a line of one character arguments reaches the limit only when it is below half of line length
+#if MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT * 2 < MBED_CONF_CMDLINE_MAX_LINE_LENGTH
+TEST_F(mbedClientCli, argv_too_many)
+{
+    cmd_add("count", cmd_argv_count, 0, 0);
+    argv_count = 0;
+    std::string line("count");
+    for (int i = 0; i < MBED_CONF_CMDLINE_ARGUMENTS_MAX_COUNT; i++) {
+        line += " " + std::to_string(i % 10);
+    }
+    INIT_BUF();
+    cmd_exe(&line[0]);
+    EXPECT_EQ(0, argv_count);
+    EXPECT_TRUE(strstr(buf, "Too many arguments, maximum is ") != NULL);
+    CHECK_RETCODE(CMDLINE_RETCODE_FAIL);
+}
+#endif
+int early_ready_depth = 0;
+int early_ready_max_depth = 0;
+int early_ready_called = 0;
+int cmd_early_ready(int argc, char *argv[])
+{
+    early_ready_called++;
+    early_ready_depth++;
+    early_ready_max_depth = MAX(early_ready_depth, early_ready_max_depth);
+    // completes before returning, e.g. event from another thread
+    cmd_ready(CMDLINE_RETCODE_FAIL);
+    early_ready_depth--;
+    return CMDLINE_RETCODE_EXCUTING_CONTINUE;
+}
+int flood_called = 0;
+int cmd_flood(int argc, char *argv[])
+{
+    flood_called++;
+    // misbehaving command fills the event queue before completing
+    for (int i = 0; i < 8; i++) {
+        cmd_next(CMDLINE_RETCODE_SUCCESS);
+    }
+    cmd_ready(CMDLINE_RETCODE_FAIL);
+    cmd_ready(CMDLINE_RETCODE_SUCCESS);
+    return CMDLINE_RETCODE_EXCUTING_CONTINUE;
+}
+TEST_F(mbedClientCli, cmd_ready_queue_full)
+{
+    flood_called = 0;
+    cmd_add("flood", cmd_flood, 0, 0);
+    REQUEST("flood");
+    // completion was not dropped, so command is not busy anymore
+    REQUEST("flood");
+    EXPECT_EQ(2, flood_called);
+}
+TEST_F(mbedClientCli, cmd_ready_while_executing)
+{
+    early_ready_depth = early_ready_max_depth = early_ready_called = 0;
+    cmd_add("early", cmd_early_ready, 0, 0);
+#if MBED_CONF_CMDLINE_ENABLE_OPERATORS == 1
+    TEST_RETCODE_WITH_COMMAND("early;early;early", CMDLINE_RETCODE_FAIL);
+    EXPECT_EQ(3, early_ready_called);
+#else
+    TEST_RETCODE_WITH_COMMAND("early", CMDLINE_RETCODE_FAIL);
+    EXPECT_EQ(1, early_ready_called);
+#endif
+    EXPECT_EQ(1, early_ready_max_depth);
+}
+int cmd_hello(int argc, char *argv[])
+{
+    cmd_printf("hello %s\r\n", argc > 1 ? argv[1] : "world");
+    return argc > 2 ? CMDLINE_RETCODE_FAIL : CMDLINE_RETCODE_SUCCESS;
+}
+char inner_out[32];
+int inner_len = 0;
+int inner_retcode = 0;
+int cmd_outer(int argc, char *argv[])
+{
+    inner_len = cmd_exe_capture("hello inner", inner_out, sizeof(inner_out), &inner_retcode);
+    cmd_printf("outer %s\r\n", argv[0]);
+    return CMDLINE_RETCODE_SUCCESS;
+}
+TEST_F(mbedClientCli, cmd_exe_capture)
+{
+    char out[16];
+    int retcode = 111;
+    cmd_add("hello", cmd_hello, 0, 0);
+    EXPECT_EQ(13, cmd_exe_capture("hello", out, sizeof(out), &retcode));
+    EXPECT_STREQ("hello world\r\n", out);
+    EXPECT_EQ(CMDLINE_RETCODE_SUCCESS, retcode);
+    EXPECT_STREQ("", buf);
+    // truncated output
+    EXPECT_EQ(24, cmd_exe_capture("hello abcdefghijklmnop", out, sizeof(out), &retcode));
+    EXPECT_STREQ("hello abcdefghi", out);
+    EXPECT_EQ(9, cmd_exe_capture("hello a b", NULL, 0, &retcode));
+    EXPECT_EQ(CMDLINE_RETCODE_FAIL, retcode);
+    EXPECT_EQ(-1, cmd_exe_capture(NULL, out, sizeof(out), &retcode));
+    // completed during execution
+    cmd_add("early", cmd_early_ready, 0, 0);
+    cmd_exe_capture("early", out, sizeof(out), &retcode);
+    EXPECT_EQ(CMDLINE_RETCODE_FAIL, retcode);
+    // cannot wait for background completion, command stays busy until it completes
+    cmd_add("long", cmd_long, 0, 0);
+    cmd_exe_capture("long", out, sizeof(out), &retcode);
+    EXPECT_EQ(CMDLINE_RETCODE_EXCUTING_CONTINUE, retcode);
+    cmd_exe_capture("long", out, sizeof(out), &retcode);
+    EXPECT_EQ(CMDLINE_RETCODE_COMMAND_BUSY, retcode);
+    cmd_ready(CMDLINE_RETCODE_SUCCESS);
+    cmd_exe_capture("long", out, sizeof(out), &retcode);
+    EXPECT_EQ(CMDLINE_RETCODE_EXCUTING_CONTINUE, retcode);
+    cmd_ready(CMDLINE_RETCODE_SUCCESS);
+#if MBED_CONF_CMDLINE_ENABLE_OPERATORS == 1
+    EXPECT_EQ(18, cmd_exe_capture("hello a;hello b b && hello c", out, sizeof(out), &retcode));
+    EXPECT_STREQ("hello a\r\nhello ", out);
+    EXPECT_EQ(CMDLINE_RETCODE_FAIL, retcode);
+#endif
+    // nested in running command, outer command and its output are not affected
+    cmd_add("outer", cmd_outer, 0, 0);
+    TEST_RETCODE_WITH_COMMAND("outer", CMDLINE_RETCODE_SUCCESS);
+    EXPECT_EQ(13, inner_len);
+    EXPECT_STREQ("hello inner\r\n", inner_out);
+    EXPECT_EQ(CMDLINE_RETCODE_SUCCESS, inner_retcode);
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+    EXPECT_STREQ(RESPONSE("outer outer"), buf);
+#else
+    EXPECT_STREQ("outer outer\r\nretcode: 0\r\n", buf);
+#endif
+}
+int cmd_outer_continue(int argc, char *argv[])
+{
+    inner_len = cmd_exe_capture("long", inner_out, sizeof(inner_out), &inner_retcode);
+    return CMDLINE_RETCODE_EXCUTING_CONTINUE;
+}
+TEST_F(mbedClientCli, cmd_exe_capture_continue)
+{
+    cmd_add("long", cmd_long, 0, 0);
+    cmd_add("outer", cmd_outer_continue, 0, 0);
+    REQUEST("outer");
+    EXPECT_EQ(CMDLINE_RETCODE_EXCUTING_CONTINUE, inner_retcode);
+    previous_retcode = 111;
+    // completion of the captured command does not complete the running one
+    cmd_ready(-5);
+    CHECK_RETCODE(111);
+    cmd_ready(CMDLINE_RETCODE_SUCCESS);
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+    // both are ready again
+    REQUEST("outer");
+    EXPECT_EQ(CMDLINE_RETCODE_EXCUTING_CONTINUE, inner_retcode);
+    cmd_ready(CMDLINE_RETCODE_SUCCESS);
+    cmd_ready(CMDLINE_RETCODE_FAIL);
+    CHECK_RETCODE(CMDLINE_RETCODE_FAIL);
+#if MBED_CONF_CMDLINE_ENABLE_OPERATORS == 1
+    // background command is ready for the captured line, but not for good
+    char out[8];
+    int retcode;
+    cmd_add("hello", cmd_hello, 0, 0);
+    EXPECT_EQ(13, cmd_exe_capture("long &hello", NULL, 0, &retcode));
+    EXPECT_EQ(CMDLINE_RETCODE_SUCCESS, retcode);
+    cmd_exe_capture("long", out, sizeof(out), &retcode);
+    EXPECT_EQ(CMDLINE_RETCODE_COMMAND_BUSY, retcode);
+    cmd_ready(CMDLINE_RETCODE_SUCCESS);
+#endif
+}
+uintptr_t current_thread = 1;
+uintptr_t thread_id(void)
+{
+    return current_thread;
+}
+int self_capture_calls = 0;
+int self_capture_retcode = 0;
+bool self_capture_mutex_free = false;
+int cmd_self_capture(int argc, char *argv[])
+{
+    char out[8];
+    self_capture_calls++;
+    // help of the running command and the running command itself
+    cmd_exe_capture("self -h", out, sizeof(out), NULL);
+    cmd_exe_capture("self", out, sizeof(out), &self_capture_retcode);
+    return CMDLINE_RETCODE_SUCCESS;
+}
+int cmd_mutex_state(int argc, char *argv[])
+{
+    // output mutex is not held while captured command runs
+    self_capture_mutex_free = mutex_wait_count == mutex_release_count;
+    return CMDLINE_RETCODE_SUCCESS;
+}
+TEST_F(mbedClientCli, cmd_exe_capture_running_state)
+{
+    char out[8];
+    self_capture_calls = 0;
+    cmd_add("self", cmd_self_capture, 0, 0);
+    TEST_RETCODE_WITH_COMMAND("self", CMDLINE_RETCODE_SUCCESS);
+    EXPECT_EQ(1, self_capture_calls);
+    EXPECT_EQ(CMDLINE_RETCODE_COMMAND_BUSY, self_capture_retcode);
+
+    cmd_mutex_wait_func(my_mutex_wait);
+    cmd_mutex_release_func(my_mutex_release);
+    cmd_thread_id_func(thread_id);
+    cmd_add("mutex", cmd_mutex_state, 0, 0);
+    self_capture_mutex_free = false;
+    cmd_exe_capture("mutex", out, sizeof(out), NULL);
+    EXPECT_TRUE(self_capture_mutex_free);
+    EXPECT_EQ(mutex_wait_count, mutex_release_count);
+    cmd_thread_id_func(NULL);
+    cmd_mutex_wait_func(0);
+    cmd_mutex_release_func(0);
+}
+int cmd_other_thread(int argc, char *argv[])
+{
+    // another thread prints and completes the running command meanwhile
+    current_thread = 2;
+    cmd_printf("other\r\n");
+    cmd_ready(CMDLINE_RETCODE_FAIL);
+    current_thread = 1;
+    cmd_printf("mine\r\n");
+    return CMDLINE_RETCODE_SUCCESS;
+}
+TEST_F(mbedClientCli, cmd_exe_capture_other_thread)
+{
+    char out[16];
+    int retcode;
+    cmd_add("long", cmd_long, 0, 0);
+    cmd_add("other", cmd_other_thread, 0, 0);
+    cmd_thread_id_func(thread_id);
+    TEST_RETCODE_WITH_COMMAND("long", 0);
+    previous_retcode = 111;
+    INIT_BUF();
+    EXPECT_EQ(6, cmd_exe_capture("other", out, sizeof(out), &retcode));
+    EXPECT_STREQ("mine\r\n", out);
+    EXPECT_EQ(CMDLINE_RETCODE_SUCCESS, retcode);
+    EXPECT_TRUE(strstr(buf, "other\r\n") == buf);
+    // completion of the running command was handled after capture
+    CHECK_RETCODE(CMDLINE_RETCODE_FAIL);
+
+    // with output mutex other threads cannot be told apart without thread id
+    cmd_thread_id_func(NULL);
+    cmd_mutex_wait_func(my_mutex_wait);
+    cmd_mutex_release_func(my_mutex_release);
+    int called = cmd_long_called;
+    EXPECT_EQ(-1, cmd_exe_capture("long", out, sizeof(out), &retcode));
+    EXPECT_EQ(called, cmd_long_called);
+    cmd_mutex_wait_func(0);
+    cmd_mutex_release_func(0);
+}
+int alloc_count = 0;
+int free_count = 0;
+void *counting_alloc(void *ctx, size_t size)
+{
+    alloc_count++;
+    return malloc(size);
+}
+void counting_free(void *ctx, void *ptr)
+{
+    free_count++;
+    free(ptr);
+}
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 0
+TEST_F(mbedClientCli, cmd_set_allocator)
+{
+    cmd_allocator_t allocator = { counting_alloc, counting_free, NULL };
+    // not allowed while initialized
+    cmd_set_allocator(&allocator);
+    cmd_add("dummy", cmd_dummy, 0, 0);
+    EXPECT_EQ(0, alloc_count);
+    cmd_free();
+    cmd_set_allocator(&allocator);
+    cmd_init(&myprint);
+    cmd_set_ready_cb(cmd_ready_cb);
+    cmd_add("hello", cmd_hello, 0, 0);
+    TEST_RETCODE_WITH_COMMAND("hello", CMDLINE_RETCODE_SUCCESS);
+    EXPECT_GT(alloc_count, 0);
+    EXPECT_GT(free_count, 0);
+    cmd_free();
+    cmd_set_allocator(NULL);
+    cmd_init(&myprint);
+}
+#endif
+TEST_F(mbedClientCli, cmd_arena)
+{
+    static uint8_t mem[200];
+    cmd_arena_t arena;
+    cmd_arena_init(&arena, mem + 1, sizeof(mem) - 1);
+    void *a = cmd_arena_alloc(&arena, 10);
+    void *b = cmd_arena_alloc(&arena, 10);
+    ASSERT_TRUE(a != NULL && b != NULL);
+    EXPECT_EQ(0u, (uintptr_t)a % sizeof(void *));
+    EXPECT_EQ(0u, (uintptr_t)b % sizeof(void *));
+    // latest allocation is given back
+    cmd_arena_free(&arena, b);
+    EXPECT_EQ(b, cmd_arena_alloc(&arena, 20));
+    EXPECT_TRUE(cmd_arena_alloc(&arena, sizeof(mem)) == NULL);
+    cmd_arena_free(&arena, a);
+    cmd_arena_free(&arena, b);
+    // empty arena is reset
+    EXPECT_EQ(a, cmd_arena_alloc(&arena, 10));
+}
+TEST_F(mbedClientCli, cmd_pool)
+{
+    static uint8_t mem[4096];
+    static uint8_t fallback_mem[8192];
+    cmd_arena_t arena;
+    cmd_pool_t pool;
+    cmd_pool_init(&pool, mem, sizeof(mem), NULL);
+    size_t blocks = pool.free_count;
+    ASSERT_GT(blocks, 0u);
+    EXPECT_GE(pool.block_size, 4 * sizeof(void *));
+    void *a = cmd_pool_alloc(&pool, 1);
+    ASSERT_TRUE(a != NULL);
+    cmd_pool_free(&pool, a);
+    EXPECT_EQ(a, cmd_pool_alloc(&pool, pool.block_size));
+    EXPECT_TRUE(cmd_pool_alloc(&pool, pool.block_size + 1) == NULL);
+    while (pool.free_count) {
+        cmd_pool_alloc(&pool, 1);
+    }
+    EXPECT_TRUE(cmd_pool_alloc(&pool, 1) == NULL);
+
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 0
+    // whole interpreter running in pool with arena fallback
+    cmd_arena_init(&arena, fallback_mem, sizeof(fallback_mem));
+    cmd_allocator_t fallback = { cmd_arena_alloc, cmd_arena_free, &arena };
+    cmd_pool_init(&pool, mem, sizeof(mem), &fallback);
+    cmd_allocator_t allocator = { cmd_pool_alloc, cmd_pool_free, &pool };
+    cmd_free();
+    cmd_set_allocator(&allocator);
+    cmd_init(&myprint);
+    cmd_set_ready_cb(cmd_ready_cb);
+    cmd_add("hello", cmd_hello, 0, 0);
+    EXPECT_LT(pool.free_count, blocks);
+    TEST_RETCODE_WITH_COMMAND("hello", CMDLINE_RETCODE_SUCCESS);
+    size_t free_blocks = pool.free_count;
+    ASSERT_GT(free_blocks, 0u);
+    cmd_delete("hello");
+    // descriptor, and statistics allocated when it was executed
+    EXPECT_EQ(free_blocks + 1 + MBED_CONF_CMDLINE_ENABLE_COMMAND_STATS, pool.free_count);
+    cmd_free();
+    cmd_set_allocator(NULL);
+    cmd_init(&myprint);
+#endif
+}
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 0
+// setup documented for cmd_set_allocator()
+TEST_F(mbedClientCli, cmd_pool_heap_fallback)
+{
+    static uint8_t cli_heap[4096];
+    static cmd_pool_t pool;
+    cmd_allocator_t heap = { counting_alloc, counting_free, NULL };
+    cmd_pool_init(&pool, cli_heap, sizeof(cli_heap), &heap);
+    cmd_allocator_t allocator = { cmd_pool_alloc, cmd_pool_free, &pool };
+    cmd_free();
+    cmd_set_allocator(&allocator);
+    cmd_init(&myprint);
+    cmd_set_ready_cb(cmd_ready_cb);
+    cmd_add("hello", cmd_hello, 0, 0);
+    alloc_count = free_count = 0;
+    TEST_RETCODE_WITH_COMMAND("hello", CMDLINE_RETCODE_SUCCESS);
+    TEST_RETCODE_WITH_COMMAND("hello a b", CMDLINE_RETCODE_FAIL);
+    // line buffers are taken from fallback and given back
+    EXPECT_GT(alloc_count, 0);
+    EXPECT_EQ(alloc_count, free_count);
+    cmd_free();
+    cmd_set_allocator(NULL);
+    cmd_init(&myprint);
+}
+#endif
+static cmd_descriptor_t hello_desc = { "hello", cmd_hello, "static hello", NULL };
+TEST_F(mbedClientCli, cmd_add_static)
+{
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    cmd_mem_stats_t before, after;
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_COMMANDS, &before));
+#endif
+    cmd_add_static(&hello_desc);
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_COMMANDS, &after));
+    EXPECT_EQ(before.allocs, after.allocs);
+#endif
+    REQUEST("hello static");
+    CHECK_RETCODE(CMDLINE_RETCODE_SUCCESS);
+    EXPECT_TRUE(strstr(buf, "hello static\r\n") != NULL);
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+    REQUEST("help");
+    EXPECT_TRUE(strstr(buf, "hello           static hello\r\n") != NULL);
+#endif
+
+    // descriptor is unlinked, not freed, and can be added again
+    cmd_delete("hello");
+    TEST_RETCODE_WITH_COMMAND("hello", CMDLINE_RETCODE_COMMAND_NOT_FOUND);
+    cmd_add_static(&hello_desc);
+    TEST_RETCODE_WITH_COMMAND("hello", CMDLINE_RETCODE_SUCCESS);
+    cmd_free();
+    cmd_init(&myprint);
+    cmd_set_ready_cb(cmd_ready_cb);
+    TEST_RETCODE_WITH_COMMAND("hello", CMDLINE_RETCODE_COMMAND_NOT_FOUND);
+    EXPECT_STREQ("hello", hello_desc.name_ptr);
+}
+#if MBED_CONF_CMDLINE_ENABLE_SUGGESTIONS == 1
+#define SUGGEST_COMMANDS 300
+static char suggest_names[SUGGEST_COMMANDS][8];
+static cmd_descriptor_t suggest_desc[SUGGEST_COMMANDS];
+TEST_F(mbedClientCli, cmd_suggestions)
+{
+#if MBED_CONF_CMDLINE_ENABLE_INTERNAL_COMMANDS == 1
+    REQUEST("hepl");
+    CHECK_RETCODE(CMDLINE_RETCODE_COMMAND_NOT_FOUND);
+    EXPECT_TRUE(strstr(buf, "Command 'hepl' not found.\r\nDid you mean: help?\r\n") != NULL);
+#endif
+    for (int i = 0; i < SUGGEST_COMMANDS; i++) {
+        snprintf(suggest_names[i], sizeof(suggest_names[i]), "cmd%03d", i);
+        suggest_desc[i] = { suggest_names[i], cmd_hello, NULL, NULL };
+        cmd_add_static(&suggest_desc[i]);
+    }
+    // transposition is one edit, and only the closest ones are suggested
+    REQUEST("mcd042");
+    EXPECT_TRUE(strstr(buf, "Command 'mcd042' not found.\r\nDid you mean: cmd042?\r\n") != NULL);
+    // at most three suggestions
+    REQUEST("cmd12");
+    EXPECT_TRUE(strstr(buf, "Did you mean: cmd012, cmd102, cmd112?\r\n") != NULL);
+    REQUEST("xyzzy");
+    CHECK_RETCODE(CMDLINE_RETCODE_COMMAND_NOT_FOUND);
+    EXPECT_TRUE(strstr(buf, "Did you mean") == NULL);
+    cmd_free();
+    cmd_init(&myprint);
+    cmd_set_ready_cb(cmd_ready_cb);
+}
+#endif
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+void *failing_alloc(void *ctx, size_t size)
+{
+    return NULL;
+}
+TEST_F(mbedClientCli, cmd_mem_stats)
+{
+    cmd_mem_stats_t stats, history;
+    EXPECT_FALSE(cmd_mem_stats(CMDLINE_MEM_TOTAL, NULL));
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_COMMANDS, &stats));
+    EXPECT_GT(stats.current, 0u);
+    EXPECT_GE(stats.peak, stats.current);
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_HISTORY, &history));
+    REQUEST("echo hello");
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 0
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_HISTORY, &stats));
+    EXPECT_GT(stats.current, history.current + strlen("echo hello"));
+    EXPECT_GT(stats.allocs, history.allocs);
+#endif
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_EXEC, &stats));
+    EXPECT_EQ(0u, stats.current);
+    EXPECT_GE(stats.peak, (size_t)MBED_CONF_CMDLINE_MAX_LINE_LENGTH);
+
+    REQUEST("meminfo");
+    EXPECT_TRUE(strstr(buf, "subsystem") != NULL);
+    EXPECT_TRUE(strstr(buf, "history") != NULL);
+    EXPECT_TRUE(strstr(buf, "total") != NULL);
+
+    // everything is released by cmd_free()
+    cmd_alias_add("foo", "echo foo");
+    cmd_variable_add_int("bar", 1);
+    cmd_free();
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_TOTAL, &stats));
+    EXPECT_EQ(0u, stats.current);
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+    cmd_init(&myprint);
+#else
+
+    uint32_t failures = stats.failures;
+    cmd_allocator_t allocator = { failing_alloc, counting_free, NULL };
+    cmd_set_allocator(&allocator);
+    cmd_init(&myprint);
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_TOTAL, &stats));
+    EXPECT_GT(stats.failures, failures);
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_COMMANDS, &stats));
+    EXPECT_GT(stats.failures, 0u);
+    cmd_free();
+    cmd_set_allocator(NULL);
+    cmd_init(&myprint);
+#endif
+}
+#endif
+#if MBED_CONF_CMDLINE_STATIC_MEMORY == 1
+TEST_F(mbedClientCli, static_memory)
+{
+    char name[16];
+    char value[MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH + 3];
+    // external allocator is not used
+    cmd_allocator_t allocator = { counting_alloc, counting_free, NULL };
+    cmd_free();
+    cmd_set_allocator(&allocator);
+    cmd_init(&myprint);
+    cmd_set_ready_cb(cmd_ready_cb);
+    cmd_add("hello", cmd_hello, 0, 0);
+    TEST_RETCODE_WITH_COMMAND("hello", CMDLINE_RETCODE_SUCCESS);
+    EXPECT_EQ(0, alloc_count);
+
+    // alias table capacity, "_" alias has own slot
+    for (int i = 1; i <= MBED_CONF_CMDLINE_STATIC_ALIASES_MAX; i++) {
+        sprintf(name, "a%d", i);
+        cmd_alias_add(name, "hello");
+    }
+    TEST_RETCODE_WITH_COMMAND("alias full hello", CMDLINE_RETCODE_FAIL);
+    EXPECT_TRUE(strstr(buf, "Cannot store alias full: out of memory") != NULL);
+    TEST_RETCODE_WITH_COMMAND("alias a1", CMDLINE_RETCODE_SUCCESS);
+    TEST_RETCODE_WITH_COMMAND("alias full hello", CMDLINE_RETCODE_SUCCESS);
+
+    // values are limited in length
+    memset(value, 'x', sizeof(value) - 1);
+    value[sizeof(value) - 1] = 0;
+    cmd_variable_add("long", value);
+    REQUEST("set");
+    EXPECT_TRUE(strstr(buf, "long") == NULL);
+
+    // last executed line is kept even when it is longer than alias values
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    cmd_mem_stats_t aliases;
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_ALIASES, &aliases));
+#endif
+    std::string line("hello ");
+    line.append(MBED_CONF_CMDLINE_STATIC_VALUE_MAX_LENGTH, 'y');
+    TEST_RETCODE_WITH_COMMAND(line.c_str(), CMDLINE_RETCODE_SUCCESS);
+    TEST_RETCODE_WITH_COMMAND(line.c_str(), CMDLINE_RETCODE_SUCCESS);
+    REQUEST("alias");
+    EXPECT_TRUE(strstr(buf, line.c_str()) != NULL);
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    uint32_t failures = aliases.failures;
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_ALIASES, &aliases));
+    EXPECT_EQ(failures, aliases.failures);
+#endif
+
+    uint8_t history_max = cmd_history_size(0);
+#if MBED_CONF_CMDLINE_ENABLE_HISTORY_COMPRESSION == 1
+    // compressed history is limited only by its arena
+    EXPECT_EQ(255, cmd_history_size(255));
+    cmd_history_size(history_max);
+#else
+    // history is limited to configured maximum
+    EXPECT_EQ(history_max, cmd_history_size(255));
+#endif
+
+    // everything is released to static storage
+    cmd_free();
+#if MBED_CONF_CMDLINE_ENABLE_MEM_STATS == 1
+    cmd_mem_stats_t stats;
+    ASSERT_TRUE(cmd_mem_stats(CMDLINE_MEM_TOTAL, &stats));
+    EXPECT_EQ(0u, stats.current);
+#endif
+    cmd_set_allocator(NULL);
+    cmd_init(&myprint);
+}
+#endif
 TEST_F(mbedClientCli, cmd_out_func_set_null)
 {
     cmd_out_func(NULL);
@@ -1182,6 +3054,11 @@ TEST_F(mbedClientCli, cmd_ctrl_func_set)
     cmd_ctrl_func(sohf_cb);
     REQUEST("\x04");
     EXPECT_EQ(sohf_cb_called, 1);
+    // ctrl+r searches history only in interactive mode
+    cmd_echo_off();
+    REQUEST("\x12");
+    EXPECT_EQ(sohf_cb_called, 2);
+    cmd_echo_on();
     cmd_ctrl_func(NULL);
 }
 #endif
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2015-2019, Pelion and affiliates.
+# SPDX-License-Identifier: Apache-2.0
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Decode mbed-client-cli trace ring exported with the `trace` command.
+
+Usage: cli_trace.py [--summary] [log]
+
+Reads `trace:` lines from log file or stdin, other lines are ignored, and
+prints the records with time from previous record. Summary prints count of
+each event and dispatch to ready latencies. Time unit is the one of the
+clock function given to cmd_set_clock_func().
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+EVENTS = {
+    1: "INPUT",
+    2: "SPLIT",
+    3: "EXPAND",
+    4: "DISPATCH",
+    5: "READY",
+    6: "OUTPUT",
+}
+RECORD = struct.Struct("<IBxH")
+HEADER = re.compile(r"trace: version (\d+), records (\d+), dropped (\d+)")
+DATA = re.compile(r"trace: ([0-9a-fA-F]+)\s*$")
+
+
+def parse(lines):
+    """Return (dropped, records) of the last export in lines."""
+    dropped = 0
+    records = None
+    for line in lines:
+        header = HEADER.search(line)
+        if header:
+            if int(header.group(1)) != 1:
+                raise ValueError("unsupported trace version %s" % header.group(1))
+            dropped = int(header.group(3))
+            records = []
+            continue
+        data = DATA.search(line)
+        if data and records is not None:
+            raw = bytes.fromhex(data.group(1))
+            if len(raw) % RECORD.size:
+                raise ValueError("truncated trace line: %s" % line.strip())
+            records.extend(RECORD.iter_unpack(raw))
+    if records is None:
+        raise ValueError("no trace export found")
+    return dropped, records
+
+
+def describe(event, arg):
+    name = EVENTS.get(event, "EVENT%d" % event)
+    if event == 1:
+        char = chr(arg) if 32 <= arg < 127 else "\\x%02x" % arg
+        return name, "'%s'" % char
+    if event == 5:
+        # retcode is signed
+        return name, str(arg - 0x10000 if arg & 0x8000 else arg)
+    return name, str(arg)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode mbed-client-cli trace ring")
+    parser.add_argument("log", nargs="?", help="log with trace export, default stdin")
+    parser.add_argument("--summary", action="store_true", help="print only summary")
+    args = parser.parse_args()
+
+    stream = open(args.log, errors="replace") if args.log else sys.stdin
+    with stream:
+        try:
+            dropped, records = parse(stream)
+        except ValueError as error:
+            print("error: %s" % error, file=sys.stderr)
+            return 1
+
+    if not args.summary:
+        print("%10s %8s  %-9s %s" % ("time", "delta", "event", "arg"))
+        previous = records[0][0] if records else 0
+        for time, event, arg in records:
+            name, value = describe(event, arg)
+            print("%10u %8u  %-9s %s" % (time, (time - previous) & 0xffffffff, name, value))
+            previous = time
+
+    counts = {}
+    latencies = []
+    dispatch = None
+    for time, event, _ in records:
+        counts[event] = counts.get(event, 0) + 1
+        if event == 4:
+            dispatch = time
+        elif event == 5 and dispatch is not None:
+            latencies.append((time - dispatch) & 0xffffffff)
+            dispatch = None
+
+    print("records %d, dropped %d" % (len(records), dropped))
+    for event in sorted(counts):
+        print("%-9s %6d" % (EVENTS.get(event, "EVENT%d" % event), counts[event]))
+    if latencies:
+        print("dispatch to ready: count %d, min %u, avg %u, max %u" %
+              (len(latencies), min(latencies), sum(latencies) // len(latencies), max(latencies)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())